@@ -63,6 +63,9 @@
 /* TCP client task header file. */
 #include "tcp_client.h"
 
+/* UDP transport of single AWEP commands. */
+#include "udp_client.h"
+
 #include "cy_network_mw_core.h"
 #include "cy_nw_helper.h"
 
@@ -100,6 +103,9 @@ cy_rslt_t create_tcp_client_socket();
 cy_rslt_t tcp_client_recv_handler(cy_socket_t socket_handle, void *arg);
 cy_rslt_t tcp_disconnection_handler(cy_socket_t socket_handle, void *arg);
 cy_rslt_t connect_to_tcp_server(cy_socket_sockaddr_t address);
+cy_rslt_t send_command(cy_socket_sockaddr_t address, const char *message, uint32_t *bytes_sent);
+cy_rslt_t close_connection(cy_socket_t socket_handle);
+static void report_latency(void);
 static cy_rslt_t connect_to_wifi_ap(void);
 void isr_button_press( void *callback_arg, cyhal_gpio_event_t event);
 
@@ -112,6 +118,15 @@ cy_socket_t client_handle;
 /* Binary semaphore handle to keep track of TCP server connection. */
 SemaphoreHandle_t connect_to_server;
 
+/* True while client_handle is connected to the TCP server. */
+volatile bool client_connected = false;
+
+/* Tick count the command in flight was started at, and the round trips of
+ * the commands answered so far. */
+TickType_t command_start;
+uint32_t command_count = 0;
+uint32_t command_total_ms = 0;
+
 /* Flags to track the LED state. */
 bool led_state = CYBSP_LED_STATE_OFF;
 
@@ -196,27 +211,23 @@ void tcp_client_task(void *arg)
 	tcp_server_address.port = TCP_SERVER_PORT;
 	printf("AWEP server found! Press the user button to send a message!\n");
 
+#if TCP_CLIENT_USE_UDP
+	/* The commands go out as datagrams from one socket kept for all of them. */
+	result = udp_client_init(&tcp_server_address.ip_address);
+	if(result != CY_RSLT_SUCCESS)
+	{
+		CY_ASSERT(0);
+	}
+	printf("Sending the commands over UDP to Port: %d\n", UDP_SERVER_PORT);
+#elif TCP_CLIENT_KEEP_ALIVE
+	printf("Keeping the connection to the TCP server open between commands\n");
+#endif
+
     for(;;)
     {
     	/* Wait till user button is pressed to send LED ON/OFF command to TCP server. */
 		xTaskNotifyWait(0, 0, &led_state_cmd, portMAX_DELAY);
 
-        /* Wait till semaphore is acquired so as to connect to a TCP server. */
-        xSemaphoreTake(connect_to_server, portMAX_DELAY);
-
-        /* Connect to the TCP server. If the connection fails, retry
-         * to connect to the server for MAX_TCP_SERVER_CONN_RETRIES times.
-         */
-        cy_nw_ntoa((cy_nw_ip_address_t *)&(tcp_server_address.ip_address), ipAddrString);
-                printf("Connecting to TCP Server (IP Address: %s, Port: %d)\n\n",
-                		ipAddrString, TCP_SERVER_PORT);
-        result = connect_to_tcp_server(tcp_server_address);
-        if(result != CY_RSLT_SUCCESS)
-        {
-            printf("Failed to connect to TCP server.\n");
-            CY_ASSERT(0);
-        }
-
         //message buffer
 		char message[MAX_TCP_DATA_PACKET_LENGTH];
 
@@ -229,10 +240,39 @@ void tcp_client_task(void *arg)
 			snprintf(message, sizeof(message), "W%04x050000", mac_checksum);
 		}
 
-		/* Send the command to TCP server. */
-        /* Send only the string length plus the null termination*/
-		result = cy_socket_send(client_handle, message, strlen(message)+1,
-					   CY_SOCKET_FLAGS_NONE, &bytes_sent);
+#if TCP_CLIENT_USE_UDP
+		/* One datagram and its reply, no connection to set up or tear down.
+		 * The reply only confirms the write, the LED already shows it. */
+		char reply[MAX_TCP_DATA_PACKET_LENGTH];
+		uint32_t reply_length;
+		(void)bytes_sent;
+		command_start = xTaskGetTickCount();
+		result = udp_client_request(message, strlen(message)+1, reply, sizeof(reply) - 1, &reply_length);
+		if(result == CY_RSLT_SUCCESS)
+		{
+			reply[reply_length] = '\0';
+			report_latency();
+			printf("message received: %s\n", reply);
+		}
+		else
+		{
+			printf("No reply from the AWEP server. Error: %d\n", (int)result);
+		}
+#else
+		/* The round trip counts the connection set up for the command too. */
+		command_start = xTaskGetTickCount();
+		result = send_command(tcp_server_address, message, &bytes_sent);
+#if TCP_CLIENT_KEEP_ALIVE
+		if(result != CY_RSLT_SUCCESS)
+		{
+			/* The connection kept from an earlier command is gone without the
+			 * disconnection callback having run. Drop it and send the command
+			 * once more over a new one. */
+			printf("Lost the connection to the TCP server. Error: %d\n", (int)result);
+			close_connection(client_handle);
+			result = send_command(tcp_server_address, message, &bytes_sent);
+		}
+#endif
 		if(result == CY_RSLT_SUCCESS )
 		{
 			if(led_state_cmd == LED_ON_CMD)
@@ -247,20 +287,9 @@ void tcp_client_task(void *arg)
 		else
 		{
 			printf("Failed to send command to server. Error: %d\n", (int)result);
-			if(result == CY_RSLT_MODULE_SECURE_SOCKETS_CLOSED)
-			{
-				/* Disconnect the socket. */
-				cy_socket_disconnect(client_handle, 0);
-			}
+			close_connection(client_handle);
 		}
-
-		/* Disconnect the socket. */
-		cy_socket_disconnect(client_handle, 0);
-		printf("Disconnecting from TCP Server.\n");
-		/* Free the resources allocated to the socket. */
-		cy_socket_delete(client_handle);
-		/* Give the semaphore so as to connect to TCP server.  */
-		xSemaphoreGive(connect_to_server);
+#endif
     }
  }
 
@@ -485,6 +514,113 @@ cy_rslt_t connect_to_tcp_server(cy_socket_sockaddr_t address)
      return result;
 }
 
+/*******************************************************************************
+ * Function Name: send_command
+ *******************************************************************************
+ * Summary:
+ *  Function to send a command to the TCP server. It connects first unless
+ *  TCP_CLIENT_KEEP_ALIVE is set and the connection of an earlier command is
+ *  still open.
+ *
+ * Parameters:
+ *  cy_socket_sockaddr_t address: Address of TCP server socket
+ *  const char *message: Command, sent with its null termination
+ *  uint32_t *bytes_sent: Number of bytes sent
+ *
+ * Return:
+ *  cy_result result: Result of the operation
+ *
+ *******************************************************************************/
+cy_rslt_t send_command(cy_socket_sockaddr_t address, const char *message, uint32_t *bytes_sent)
+{
+    cy_rslt_t result;
+
+    if(!TCP_CLIENT_KEEP_ALIVE || !client_connected)
+    {
+        /* Wait till semaphore is acquired so as to connect to a TCP server. */
+        xSemaphoreTake(connect_to_server, portMAX_DELAY);
+
+        /* Connect to the TCP server. If the connection fails, retry
+         * to connect to the server for MAX_TCP_SERVER_CONN_RETRIES times.
+         */
+        cy_nw_ntoa((cy_nw_ip_address_t *)&(address.ip_address), ipAddrString);
+        printf("Connecting to TCP Server (IP Address: %s, Port: %d)\n\n",
+                ipAddrString, TCP_SERVER_PORT);
+        result = connect_to_tcp_server(address);
+        if(result != CY_RSLT_SUCCESS)
+        {
+            printf("Failed to connect to TCP server.\n");
+            CY_ASSERT(0);
+        }
+        client_connected = true;
+    }
+
+    /* Send only the string length plus the null termination*/
+    return cy_socket_send(client_handle, message, strlen(message)+1,
+                          CY_SOCKET_FLAGS_NONE, bytes_sent);
+}
+
+/*******************************************************************************
+ * Function Name: close_connection
+ *******************************************************************************
+ * Summary:
+ *  Function to disconnect from the TCP server and free the socket, so that the
+ *  next command connects again. Either the client task or the socket
+ *  callbacks may get here first for the same connection; only the first
+ *  closes it.
+ *
+ * Parameters:
+ *  cy_socket_t socket_handle: Connection handle for the TCP client socket
+ *
+ * Return:
+ *  cy_result result: Result of the operation
+ *
+ *******************************************************************************/
+cy_rslt_t close_connection(cy_socket_t socket_handle)
+{
+    cy_rslt_t result;
+    bool connected;
+
+    taskENTER_CRITICAL();
+    connected = client_connected;
+    client_connected = false;
+    taskEXIT_CRITICAL();
+
+    if(!connected)
+    {
+        return CY_RSLT_SUCCESS;
+    }
+
+    /* Disconnect the TCP client. */
+    result = cy_socket_disconnect(socket_handle, 0);
+
+    /* Free the resources allocated to the socket. */
+    cy_socket_delete(socket_handle);
+
+    /* Give the semaphore so as to connect to TCP server. */
+    xSemaphoreGive(connect_to_server);
+
+    return result;
+}
+
+/*******************************************************************************
+ * Function Name: report_latency
+ *******************************************************************************
+ * Summary:
+ *  Print the time from the start of the command in flight to its reply, and
+ *  the average over the commands answered so far.
+ *
+ *******************************************************************************/
+static void report_latency(void)
+{
+    uint32_t round_trip_ms = (uint32_t)(xTaskGetTickCount() - command_start) * 1000u / configTICK_RATE_HZ;
+
+    command_count++;
+    command_total_ms += round_trip_ms;
+    printf("Command round trip: %"PRIu32" ms, average %"PRIu32" ms over %"PRIu32" commands\n",
+           round_trip_ms, command_total_ms / command_count, command_count);
+}
+
 /*******************************************************************************
  * Function Name: tcp_client_recv_handler
  *******************************************************************************
@@ -507,8 +643,21 @@ cy_rslt_t tcp_client_recv_handler(cy_socket_t socket_handle, void *arg)
     char message_buffer[MAX_TCP_DATA_PACKET_LENGTH];
 	cy_rslt_t result ;
 
-	result = cy_socket_recv(socket_handle, message_buffer, TCP_LED_CMD_LEN,
+	result = cy_socket_recv(socket_handle, message_buffer, MAX_TCP_DATA_PACKET_LENGTH - 1,
 							CY_SOCKET_FLAGS_NONE, &bytes_received);
+	if(result != CY_RSLT_SUCCESS || bytes_received == 0)
+	{
+		return result;
+	}
+	message_buffer[bytes_received] = '\0';
+	report_latency();
+	printf("message received: %s\n", message_buffer);
+
+#if !TCP_CLIENT_KEEP_ALIVE
+	/* Disconnect the socket once the response message has been received. */
+	printf("Disconnecting from TCP Server.\n");
+	close_connection(socket_handle);
+#endif
 
 	return result;
 }
@@ -529,20 +678,11 @@ cy_rslt_t tcp_client_recv_handler(cy_socket_t socket_handle, void *arg)
  *******************************************************************************/
 cy_rslt_t tcp_disconnection_handler(cy_socket_t socket_handle, void *arg)
 {
-    cy_rslt_t result;
-
-    /* Disconnect the TCP client. */
-    result = cy_socket_disconnect(socket_handle, 0);
-
-    /* Free the resources allocated to the socket. */
-    cy_socket_delete(socket_handle);
-
     printf("Disconnected from the TCP server! \n");
 
-    /* Give the semaphore so as to connect to TCP server. */
-    xSemaphoreGive(connect_to_server);
-
-    return result;
+    /* Disconnect the TCP client and free the socket. With
+     * TCP_CLIENT_KEEP_ALIVE the next command connects again. */
+    return close_connection(socket_handle);
 }
 
 /*******************************************************************************
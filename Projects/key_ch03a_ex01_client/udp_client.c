@@ -0,0 +1,161 @@
+/******************************************************************************
+* File Name:   udp_client.c
+*
+* Description: This file contains functions that send single AWEP commands to
+* the server as UDP datagrams. A command costs one round trip and no
+* connection: it goes out behind a request ID and is sent again with the same
+* ID until the reply carrying that ID comes back. The server answers a repeated
+* ID from its reply cache, so a write is never applied twice.
+*
+*******************************************************************************/
+
+/* Header file includes. */
+#include "cyhal.h"
+#include "cybsp.h"
+
+/* FreeRTOS header file. */
+#include <FreeRTOS.h>
+#include <task.h>
+
+/* Standard C header files. */
+#include <string.h>
+#include <inttypes.h>
+
+/* UDP client header file. */
+#include "udp_client.h"
+
+/*******************************************************************************
+* Global Variables
+********************************************************************************/
+/* UDP client socket handle, created once and kept. */
+static cy_socket_t udp_handle;
+
+/* Address of the AWEP server. */
+static cy_socket_sockaddr_t udp_server_address;
+
+/* ID of the last request, a new command takes the next one. */
+static uint16_t udp_request_id;
+
+/*******************************************************************************
+ * Function Name: udp_client_init
+ *******************************************************************************
+ * Summary:
+ *  Create the UDP socket the commands are sent from. It has no connection, so
+ *  it stays open for every command.
+ *
+ * Parameters:
+ *  const cy_socket_ip_address_t *server_ip: IP address of the AWEP server
+ *
+ * Return:
+ *  cy_result result: Result of the operation
+ *
+ *******************************************************************************/
+cy_rslt_t udp_client_init(const cy_socket_ip_address_t *server_ip)
+{
+    cy_rslt_t result;
+
+    udp_server_address.ip_address = *server_ip;
+    udp_server_address.port = UDP_SERVER_PORT;
+
+    /* Start from a different ID after a reset, so the first command is not
+     * mistaken for a retransmission of the last one before it. */
+    udp_request_id = (uint16_t)xTaskGetTickCount();
+
+    result = cy_socket_create(CY_SOCKET_DOMAIN_AF_INET, CY_SOCKET_TYPE_DGRAM,
+                              CY_SOCKET_IPPROTO_UDP, &udp_handle);
+    if(result != CY_RSLT_SUCCESS)
+    {
+        printf("Failed to create UDP socket! Error code: 0x%08"PRIx32"\n", (uint32_t)result);
+    }
+    return result;
+}
+
+/*******************************************************************************
+ * Function Name: udp_client_request
+ *******************************************************************************
+ * Summary:
+ *  Send one AWEP command and wait for its reply. The command is sent again
+ *  after UDP_CLIENT_RETRY_TIMEOUT_MS, and after twice as long each time after
+ *  that, up to UDP_CLIENT_MAX_ATTEMPTS times. A late reply to an earlier
+ *  request is dropped.
+ *
+ * Parameters:
+ *  const char *command: AWEP command
+ *  uint32_t length: Length of the command, with its NUL if it has one
+ *  char *reply: Buffer for the reply, without the request ID
+ *  uint32_t reply_size: Size of the buffer
+ *  uint32_t *reply_length: Length of the reply
+ *
+ * Return:
+ *  cy_result result: Result of the operation, a timeout if no reply came
+ *
+ *******************************************************************************/
+cy_rslt_t udp_client_request(const char *command, uint32_t length,
+                             char *reply, uint32_t reply_size, uint32_t *reply_length)
+{
+    char datagram[UDP_CLIENT_MAX_DATAGRAM];
+    cy_socket_sockaddr_t peer_addr;
+    uint32_t peer_addr_len;
+    uint32_t bytes_sent;
+    uint32_t bytes_received;
+    uint32_t timeout = UDP_CLIENT_RETRY_TIMEOUT_MS;
+    cy_rslt_t result = CY_RSLT_MODULE_SECURE_SOCKETS_TIMEOUT;
+
+    if(length > UDP_CLIENT_MAX_DATAGRAM - UDP_CLIENT_ID_LEN)
+    {
+        return CY_RSLT_MODULE_SECURE_SOCKETS_BADARG;
+    }
+    udp_request_id++;
+    datagram[0] = (char)(udp_request_id >> 8);
+    datagram[1] = (char)udp_request_id;
+    memcpy(&datagram[UDP_CLIENT_ID_LEN], command, length);
+
+    for(uint32_t attempt = 0; attempt < UDP_CLIENT_MAX_ATTEMPTS; attempt++, timeout *= 2u)
+    {
+        result = cy_socket_setsockopt(udp_handle, CY_SOCKET_SOL_SOCKET, CY_SOCKET_SO_RCVTIMEO,
+                                      &timeout, sizeof(timeout));
+        if(result != CY_RSLT_SUCCESS)
+        {
+            printf("Set socket option: CY_SOCKET_SO_RCVTIMEO failed\n");
+            return result;
+        }
+        result = cy_socket_sendto(udp_handle, datagram, length + UDP_CLIENT_ID_LEN, CY_SOCKET_FLAGS_NONE,
+                                  &udp_server_address, sizeof(udp_server_address), &bytes_sent);
+        if(result != CY_RSLT_SUCCESS)
+        {
+            printf("Failed to send datagram. Error: %d\n", (int)result);
+            return result;
+        }
+
+        /* Wait for the reply to this request, a reply to an earlier one is
+         * from a retransmission that was not needed. */
+        for(;;)
+        {
+            char received[UDP_CLIENT_MAX_DATAGRAM];
+            peer_addr_len = sizeof(peer_addr);
+            result = cy_socket_recvfrom(udp_handle, received, sizeof(received), CY_SOCKET_FLAGS_NONE,
+                                        &peer_addr, &peer_addr_len, &bytes_received);
+            if(result != CY_RSLT_SUCCESS)
+            {
+                break;
+            }
+            if(bytes_received > UDP_CLIENT_ID_LEN &&
+               received[0] == datagram[0] && received[1] == datagram[1] &&
+               peer_addr.ip_address.ip.v4 == udp_server_address.ip_address.ip.v4)
+            {
+                *reply_length = bytes_received - UDP_CLIENT_ID_LEN;
+                if(*reply_length > reply_size)
+                {
+                    *reply_length = reply_size;
+                }
+                memcpy(reply, &received[UDP_CLIENT_ID_LEN], *reply_length);
+                return CY_RSLT_SUCCESS;
+            }
+        }
+        printf("No reply from the AWEP server, attempt %d of %d\n",
+               (int)(attempt + 1u), (int)UDP_CLIENT_MAX_ATTEMPTS);
+    }
+    return result;
+}
+
+/* [] END OF FILE */
@@ -71,6 +71,19 @@
 
 #define TCP_SERVER_PORT                           (50007)
 
+/* 1: send each command to the AWEP server as a UDP datagram, one round trip
+ * and no connection. 0: connect over TCP for each command. */
+#ifndef TCP_CLIENT_USE_UDP
+#define TCP_CLIENT_USE_UDP                    (0)
+#endif
+
+/* 1: keep the TCP connection to the AWEP server open across commands and
+ * connect again only once it is lost, found by the TCP keep alive or the
+ * server closing it. 0: connect for each command and disconnect after it.
+ * The client prints the round trip of every command either way. */
+#ifndef TCP_CLIENT_KEEP_ALIVE
+#define TCP_CLIENT_KEEP_ALIVE                 (1)
+#endif
 
 /*******************************************************************************
 * Function Prototype
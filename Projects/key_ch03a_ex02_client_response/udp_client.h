@@ -0,0 +1,39 @@
+/******************************************************************************
+* File Name:   udp_client.h
+*
+* Description: This file contains declaration of functions that send single
+* AWEP commands to the server as UDP datagrams.
+*
+*******************************************************************************/
+
+#ifndef UDP_CLIENT_H_
+#define UDP_CLIENT_H_
+
+#include <stdint.h>
+#include "cy_secure_sockets.h"
+
+/*******************************************************************************
+* Macros
+********************************************************************************/
+/* The server answers AWEP datagrams on the same port number as TCP. */
+#define UDP_SERVER_PORT                       (50007)
+
+/* Time to wait for the reply before the first retransmission, doubled for each
+ * one after it. */
+#define UDP_CLIENT_RETRY_TIMEOUT_MS           (200u)
+
+/* Times a command is sent before giving up. */
+#define UDP_CLIENT_MAX_ATTEMPTS               (4u)
+
+/* A datagram is a 2 byte request ID followed by the command or the reply. */
+#define UDP_CLIENT_ID_LEN                     (2u)
+#define UDP_CLIENT_MAX_DATAGRAM               (32u)
+
+/*******************************************************************************
+* Function Prototypes
+********************************************************************************/
+cy_rslt_t udp_client_init(const cy_socket_ip_address_t *server_ip);
+cy_rslt_t udp_client_request(const char *command, uint32_t length,
+                             char *reply, uint32_t reply_size, uint32_t *reply_length);
+
+#endif /* UDP_CLIENT_H_ */
@@ -0,0 +1,103 @@
+//register storage of the board, in the auxiliary flash set aside for EEPROM
+//emulation. The host build keeps it in files instead, see host/storage.c
+#include <stdio.h>
+#include <string.h>
+#include "cyhal.h"
+#include "cybsp.h"
+#include "awep_persist.h"
+
+// The 32 KB of auxiliary flash, in 512 byte rows that read 0x00 once erased.
+// A snapshot of DB_MAX_ENTRIES registers fits a slot with room to spare and
+// each log holds 1536 writes, so a snapshot is taken every 768
+#define AWEP_FLASH_SNAPSHOT_SIZE    (4096u)
+#define AWEP_FLASH_LOG_SIZE         (12288u)
+
+#if (2u * (AWEP_FLASH_SNAPSHOT_SIZE + AWEP_FLASH_LOG_SIZE) > CY_EM_EEPROM_SIZE)
+#error "The register storage does not fit the auxiliary flash"
+#endif
+
+static const uint32_t awepFlashBase[AWEP_REGION_COUNT] = {
+    [AWEP_REGION_SNAPSHOT_0] = CY_EM_EEPROM_BASE,
+    [AWEP_REGION_SNAPSHOT_1] = CY_EM_EEPROM_BASE + AWEP_FLASH_SNAPSHOT_SIZE,
+    [AWEP_REGION_LOG_0]      = CY_EM_EEPROM_BASE + 2u * AWEP_FLASH_SNAPSHOT_SIZE,
+    [AWEP_REGION_LOG_1]      = CY_EM_EEPROM_BASE + 2u * AWEP_FLASH_SNAPSHOT_SIZE + AWEP_FLASH_LOG_SIZE,
+};
+
+static cyhal_flash_t awepFlash;
+static bool awepFlashReady;
+static uint32_t awepFlashRowSize;
+// a row is written whole, so whatever of it is kept is read in here first
+static uint32_t awepFlashRow[CY_FLASH_SIZEOF_ROW / sizeof(uint32_t)];
+
+// awepFlashInit:
+// The flash driver is opened on first use, storage starts before anything else
+static bool awepFlashInit(void){
+    cyhal_flash_info_t info;
+    if(awepFlashReady){
+        return true;
+    }
+    if(cyhal_flash_init(&awepFlash) != CY_RSLT_SUCCESS){
+        printf("Flash driver initialization failed\n");
+        return false;
+    }
+    cyhal_flash_get_info(&awepFlash, &info);
+    awepFlashRowSize = info.blocks[0].page_size;
+    if(awepFlashRowSize > sizeof(awepFlashRow)){
+        return false;
+    }
+    awepFlashReady = true;
+    return true;
+}
+
+uint32_t awep_port_storage_size(awep_region_t region){
+    return (region < AWEP_REGION_LOG_0) ? AWEP_FLASH_SNAPSHOT_SIZE : AWEP_FLASH_LOG_SIZE;
+}
+
+// awep_port_storage_read:
+// The flash is memory mapped, erased rows simply read as zeroes
+bool awep_port_storage_read(awep_region_t region, uint32_t offset, void *data, uint32_t length){
+    if(offset + length > awep_port_storage_size(region)){
+        return false;
+    }
+    memcpy(data, (const void *)(awepFlashBase[region] + offset), length);
+    return true;
+}
+
+// awep_port_storage_write:
+// Rows the bytes fall in are read, patched and written back. Log pages line up
+// with rows, so a log write rewrites one row
+bool awep_port_storage_write(awep_region_t region, uint32_t offset, const void *data, uint32_t length){
+    const uint8_t *bytes = data;
+    if(offset + length > awep_port_storage_size(region) || !awepFlashInit()){
+        return false;
+    }
+    while(length > 0){
+        uint32_t address = awepFlashBase[region] + offset;
+        uint32_t row = address - (address % awepFlashRowSize);
+        uint32_t chunk = awepFlashRowSize - (address - row);
+        if(chunk > length){
+            chunk = length;
+        }
+        memcpy(awepFlashRow, (const void *)row, awepFlashRowSize);
+        memcpy((uint8_t *)awepFlashRow + (address - row), bytes, chunk);
+        if(cyhal_flash_write(&awepFlash, row, awepFlashRow) != CY_RSLT_SUCCESS){
+            return false;
+        }
+        bytes += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+bool awep_port_storage_erase(awep_region_t region){
+    if(!awepFlashInit()){
+        return false;
+    }
+    for(uint32_t offset = 0; offset < awep_port_storage_size(region); offset += awepFlashRowSize){
+        if(cyhal_flash_erase(&awepFlash, awepFlashBase[region] + offset) != CY_RSLT_SUCCESS){
+            return false;
+        }
+    }
+    return true;
+}
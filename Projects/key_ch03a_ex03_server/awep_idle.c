@@ -0,0 +1,128 @@
+//timer wheel of connection idle timeouts, touched from the receive path and
+//expired from the server task
+#include <stddef.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include "awep_idle.h"
+
+#if (AWEP_MAX_CONNECTIONS >= 0xFFu)
+#error "AWEP_MAX_CONNECTIONS must fit the 8 bit wheel links"
+#endif
+
+// Marks the end of a slot's list and a connection that is not on the wheel
+#define AWEP_IDLE_NONE  (0xFFu)
+
+// Each slot is a doubly linked list of connection indexes, so a touch can
+// unlink a connection without walking its slot
+static uint8_t awepIdleHead[AWEP_IDLE_SLOTS];
+static uint8_t awepIdleNext[AWEP_MAX_CONNECTIONS];
+static uint8_t awepIdlePrev[AWEP_MAX_CONNECTIONS];
+static uint8_t awepIdleSlot[AWEP_MAX_CONNECTIONS];
+static uint32_t awepIdleTimeout[AWEP_MAX_CONNECTIONS];
+// Slot each connection is due in, counted like the cursor
+static uint32_t awepIdleDeadline[AWEP_MAX_CONNECTIONS];
+// Last slot expired, counted in slots since the tick count started
+static uint32_t awepIdleCursor;
+
+static SemaphoreHandle_t awepIdleLock;
+static StaticSemaphore_t awepIdleLockBuffer;
+
+// awepIdleUnlink:
+// Take a connection off its slot, if it is on one. Called with the lock held
+static void awepIdleUnlink(uint32_t index){
+    uint8_t slot = awepIdleSlot[index];
+    if(slot == AWEP_IDLE_NONE){
+        return;
+    }
+    if(awepIdlePrev[index] != AWEP_IDLE_NONE){
+        awepIdleNext[awepIdlePrev[index]] = awepIdleNext[index];
+    }
+    else{
+        awepIdleHead[slot] = awepIdleNext[index];
+    }
+    if(awepIdleNext[index] != AWEP_IDLE_NONE){
+        awepIdlePrev[awepIdleNext[index]] = awepIdlePrev[index];
+    }
+    awepIdleSlot[index] = AWEP_IDLE_NONE;
+}
+
+// awepIdleLink:
+// Put a connection on the slot its timeout ends in. Rounding up to the next
+// whole slot means it is never expired early. Called with the lock held
+static void awepIdleLink(uint32_t index, uint32_t now){
+    uint32_t deadline = (now + awepIdleTimeout[index]) / AWEP_IDLE_SLOT_TICKS + 1u;
+    uint8_t slot = (uint8_t)(deadline % AWEP_IDLE_SLOTS);
+    awepIdleDeadline[index] = deadline;
+    awepIdleSlot[index] = slot;
+    awepIdlePrev[index] = AWEP_IDLE_NONE;
+    awepIdleNext[index] = awepIdleHead[slot];
+    if(awepIdleHead[slot] != AWEP_IDLE_NONE){
+        awepIdlePrev[awepIdleHead[slot]] = (uint8_t)index;
+    }
+    awepIdleHead[slot] = (uint8_t)index;
+}
+
+void awep_idle_init(uint32_t now){
+    if(awepIdleLock == NULL){
+        awepIdleLock = xSemaphoreCreateMutexStatic(&awepIdleLockBuffer);
+    }
+    for(uint32_t i = 0; i < AWEP_IDLE_SLOTS; i++){
+        awepIdleHead[i] = AWEP_IDLE_NONE;
+    }
+    for(uint32_t i = 0; i < AWEP_MAX_CONNECTIONS; i++){
+        awepIdleSlot[i] = AWEP_IDLE_NONE;
+    }
+    awepIdleCursor = now / AWEP_IDLE_SLOT_TICKS;
+}
+
+void awep_idle_start(uint32_t index, uint32_t now, uint32_t timeout){
+    xSemaphoreTake(awepIdleLock, portMAX_DELAY);
+    awepIdleUnlink(index);
+    awepIdleTimeout[index] = timeout;
+    awepIdleLink(index, now);
+    xSemaphoreGive(awepIdleLock);
+}
+
+void awep_idle_touch(uint32_t index, uint32_t now){
+    xSemaphoreTake(awepIdleLock, portMAX_DELAY);
+    if(awepIdleSlot[index] != AWEP_IDLE_NONE){
+        awepIdleUnlink(index);
+        awepIdleLink(index, now);
+    }
+    xSemaphoreGive(awepIdleLock);
+}
+
+void awep_idle_stop(uint32_t index){
+    xSemaphoreTake(awepIdleLock, portMAX_DELAY);
+    awepIdleUnlink(index);
+    xSemaphoreGive(awepIdleLock);
+}
+
+// awep_idle_expire:
+// A slot the cursor passes can also hold connections due on a later turn of
+// the wheel, those stay where they are.
+uint32_t awep_idle_expire(uint32_t now, uint8_t *expired){
+    uint32_t count = 0;
+    uint32_t current = now / AWEP_IDLE_SLOT_TICKS;
+
+    xSemaphoreTake(awepIdleLock, portMAX_DELAY);
+    // after a stall longer than a turn every slot is due once
+    if(current - awepIdleCursor > AWEP_IDLE_SLOTS){
+        awepIdleCursor = current - AWEP_IDLE_SLOTS;
+    }
+    while(awepIdleCursor != current){
+        awepIdleCursor++;
+        uint8_t slot = (uint8_t)(awepIdleCursor % AWEP_IDLE_SLOTS);
+        uint8_t index = awepIdleHead[slot];
+        while(index != AWEP_IDLE_NONE){
+            uint8_t next = awepIdleNext[index];
+            if((int32_t)(awepIdleDeadline[index] - awepIdleCursor) <= 0){
+                awepIdleUnlink(index);
+                expired[count++] = index;
+            }
+            index = next;
+        }
+    }
+    xSemaphoreGive(awepIdleLock);
+    return count;
+}
@@ -0,0 +1,438 @@
+//snapshot and append-only write log of the register database
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include "database.h"
+#include "awep_stats.h"
+#include "awep_server.h"
+#include "awep_persist.h"
+
+// A log region is an 8 byte header, "AWLG" and the generation, then 8 byte
+// records: AWEP_PERSIST_MARK, deviceId:2, regId, value:2, the low byte of the
+// generation and a CRC-8 of the seven bytes before it. A register the database
+// removed, an evicted one, is logged the same way with AWEP_PERSIST_REMOVED.
+// The first record that does not check out ends the log
+#define AWEP_PERSIST_LOG_HEADER     (8u)
+#define AWEP_PERSIST_LOG_RECORD     (8u)
+#define AWEP_PERSIST_MARK           (0xA5u)
+#define AWEP_PERSIST_REMOVED        (0x5Au)
+// A snapshot region is a 16 byte header, "AWSN", the generation, the register
+// count and a CRC-32 of the records, then 5 byte records: deviceId:2, regId,
+// value:2 in key order. The header is written last, it is the commit point.
+// A snapshot of generation G holds everything in the logs before G
+#define AWEP_PERSIST_SNAPSHOT_HEADER (16u)
+#define AWEP_PERSIST_SNAPSHOT_RECORD (5u)
+// Registers read from the database or storage at a time
+#define AWEP_PERSIST_CHUNK          (32u)
+
+#if (AWEP_PERSIST_PAGE_SIZE % AWEP_PERSIST_LOG_RECORD != 0)
+#error "AWEP_PERSIST_PAGE_SIZE must hold whole log records"
+#endif
+
+static const uint8_t awepLogMagic[4] = {'A', 'W', 'L', 'G'};
+static const uint8_t awepSnapshotMagic[4] = {'A', 'W', 'S', 'N'};
+
+// Everything below is guarded by awepPersistLock, which the journal takes with
+// the database write lock held. Nothing holding it calls into the database
+static SemaphoreHandle_t awepPersistLock;
+static StaticSemaphore_t awepPersistLockBuffer;
+static awep_region_t awepLog;           // active log
+static uint32_t awepGeneration;         // of the active log
+static uint32_t awepPageOffset;         // where the page starts in the active log
+static uint32_t awepPageLength;         // bytes gathered in the page
+static uint32_t awepPageWritten;        // of them, bytes already in storage
+static uint8_t awepPage[AWEP_PERSIST_PAGE_SIZE];
+static awep_region_t awepSnapshot;      // slot of the newest snapshot
+static bool awepFailed;                 // storage failed, nothing more is logged
+
+static void awepPut32(uint8_t *bytes, uint32_t value){
+    bytes[0] = (uint8_t)(value >> 24);
+    bytes[1] = (uint8_t)(value >> 16);
+    bytes[2] = (uint8_t)(value >> 8);
+    bytes[3] = (uint8_t)value;
+}
+
+static uint32_t awepGet32(const uint8_t *bytes){
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+           ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+static uint8_t awepCrc8(const uint8_t *bytes, uint32_t length){
+    uint8_t crc = 0;
+    while(length-- > 0){
+        crc ^= *bytes++;
+        for(uint32_t bit = 0; bit < 8u; bit++){
+            crc = (uint8_t)((crc & 0x80u) ? ((uint32_t)crc << 1) ^ 0x07u : (uint32_t)crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint32_t awepCrc32(uint32_t crc, const uint8_t *bytes, uint32_t length){
+    crc = ~crc;
+    while(length-- > 0){
+        crc ^= *bytes++;
+        for(uint32_t bit = 0; bit < 8u; bit++){
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+// awepFail:
+// Stop logging rather than leave storage that no longer matches the database
+static void awepFail(const char *what){
+    if(!awepFailed){
+        printf("Persistence stopped, storage %s failed\n", what);
+    }
+    awepFailed = true;
+}
+
+// awepFlushPage:
+// Write the part of the page not yet in storage. Called with the lock held
+static void awepFlushPage(void){
+    if(awepFailed || awepPageLength == awepPageWritten){
+        return;
+    }
+    if(!awep_port_storage_write(awepLog, awepPageOffset + awepPageWritten,
+                                &awepPage[awepPageWritten], awepPageLength - awepPageWritten)){
+        awepFail("write");
+        return;
+    }
+    awepPageWritten = awepPageLength;
+    if(awepPageLength == AWEP_PERSIST_PAGE_SIZE){
+        awepPageOffset += AWEP_PERSIST_PAGE_SIZE;
+        awepPageLength = 0;
+        awepPageWritten = 0;
+    }
+}
+
+// awepStartLog:
+// Make a log region the active one, with a header for generation. The region
+// must be erased. Called with the lock held
+static void awepStartLog(awep_region_t region, uint32_t generation){
+    awepLog = region;
+    awepGeneration = generation;
+    awepPageOffset = 0;
+    awepPageWritten = 0;
+    memcpy(awepPage, awepLogMagic, sizeof(awepLogMagic));
+    awepPut32(&awepPage[4], generation);
+    awepPageLength = AWEP_PERSIST_LOG_HEADER;
+    awepFlushPage();
+}
+
+// awep_persist_journal:
+// Called by the database with its write lock held, so only the page is
+// touched unless it fills up
+void awep_persist_journal(const dbEntry_t *entry, bool removed){
+    uint8_t *record;
+
+    if(awepPersistLock == NULL){
+        return;
+    }
+    xSemaphoreTake(awepPersistLock, portMAX_DELAY);
+    if(awepFailed ||
+       awepPageOffset + awepPageLength + AWEP_PERSIST_LOG_RECORD > awep_port_storage_size(awepLog)){
+        // the service is behind on snapshots, this write is not kept
+        xSemaphoreGive(awepPersistLock);
+        awep_stats_add(AWEP_STAT_LOG_DROPPED, 1u);
+        return;
+    }
+    record = &awepPage[awepPageLength];
+    record[0] = removed ? AWEP_PERSIST_REMOVED : AWEP_PERSIST_MARK;
+    record[1] = (uint8_t)(entry->deviceId >> 8);
+    record[2] = (uint8_t)entry->deviceId;
+    record[3] = (uint8_t)entry->regId;
+    record[4] = (uint8_t)(entry->value >> 8);
+    record[5] = (uint8_t)entry->value;
+    record[6] = (uint8_t)awepGeneration;
+    record[7] = awepCrc8(record, AWEP_PERSIST_LOG_RECORD - 1u);
+    awepPageLength += AWEP_PERSIST_LOG_RECORD;
+    if(awepPageLength == AWEP_PERSIST_PAGE_SIZE){
+        awepFlushPage();
+    }
+    xSemaphoreGive(awepPersistLock);
+    awep_stats_add(AWEP_STAT_LOG_RECORDS, 1u);
+}
+
+// awepReadSnapshot:
+// Check a snapshot slot and, if load is set, store its registers. Returns the
+// generation, 0 if the slot holds no valid snapshot
+static uint32_t awepReadSnapshot(awep_region_t region, bool load, uint32_t *count){
+    uint8_t header[AWEP_PERSIST_SNAPSHOT_HEADER];
+    uint8_t records[AWEP_PERSIST_CHUNK * AWEP_PERSIST_SNAPSHOT_RECORD];
+    uint32_t crc = 0;
+
+    if(!awep_port_storage_read(region, 0, header, sizeof(header)) ||
+       memcmp(header, awepSnapshotMagic, sizeof(awepSnapshotMagic)) != 0){
+        return 0;
+    }
+    uint32_t generation = awepGet32(&header[4]);
+    *count = awepGet32(&header[8]);
+    if(AWEP_PERSIST_SNAPSHOT_HEADER + *count * AWEP_PERSIST_SNAPSHOT_RECORD > awep_port_storage_size(region)){
+        return 0;
+    }
+    for(uint32_t done = 0; done < *count; ){
+        uint32_t chunk = (*count - done < AWEP_PERSIST_CHUNK) ? *count - done : AWEP_PERSIST_CHUNK;
+        if(!awep_port_storage_read(region, AWEP_PERSIST_SNAPSHOT_HEADER + done * AWEP_PERSIST_SNAPSHOT_RECORD,
+                                   records, chunk * AWEP_PERSIST_SNAPSHOT_RECORD)){
+            return 0;
+        }
+        crc = awepCrc32(crc, records, chunk * AWEP_PERSIST_SNAPSHOT_RECORD);
+        for(uint32_t i = 0; load && i < chunk; i++){
+            const uint8_t *record = &records[i * AWEP_PERSIST_SNAPSHOT_RECORD];
+            dbEntry_t entry = {
+                .deviceId = ((uint32_t)record[0] << 8) | record[1],
+                .regId = record[2],
+                .value = ((uint32_t)record[3] << 8) | record[4]
+            };
+            dbSetValue(&entry);
+        }
+        done += chunk;
+    }
+    return (crc == awepGet32(&header[12])) ? generation : 0;
+}
+
+// awepLogGeneration:
+// Generation of a log region, 0 if it has no valid header
+static uint32_t awepLogGeneration(awep_region_t region){
+    uint8_t header[AWEP_PERSIST_LOG_HEADER];
+    if(!awep_port_storage_read(region, 0, header, sizeof(header)) ||
+       memcmp(header, awepLogMagic, sizeof(awepLogMagic)) != 0){
+        return 0;
+    }
+    return awepGet32(&header[4]);
+}
+
+// awepReplayLog:
+// Store or remove the register of every record of a log in order, returns how
+// many there were
+static uint32_t awepReplayLog(awep_region_t region, uint32_t generation){
+    uint8_t records[AWEP_PERSIST_CHUNK * AWEP_PERSIST_LOG_RECORD];
+    uint32_t size = awep_port_storage_size(region);
+    uint32_t count = 0;
+
+    for(uint32_t offset = AWEP_PERSIST_LOG_HEADER; offset < size; offset += sizeof(records)){
+        uint32_t length = (size - offset < sizeof(records)) ? size - offset : sizeof(records);
+        if(!awep_port_storage_read(region, offset, records, length)){
+            // nothing after an unreadable chunk can be trusted
+            length = 0;
+        }
+        for(uint32_t i = 0; i + AWEP_PERSIST_LOG_RECORD <= length; i += AWEP_PERSIST_LOG_RECORD){
+            const uint8_t *record = &records[i];
+            if((record[0] != AWEP_PERSIST_MARK && record[0] != AWEP_PERSIST_REMOVED) ||
+               record[6] != (uint8_t)generation ||
+               record[7] != awepCrc8(record, AWEP_PERSIST_LOG_RECORD - 1u)){
+                return count;
+            }
+            dbEntry_t entry = {
+                .deviceId = ((uint32_t)record[1] << 8) | record[2],
+                .regId = record[3],
+                .value = ((uint32_t)record[4] << 8) | record[5]
+            };
+            if(record[0] == AWEP_PERSIST_REMOVED){
+                dbRemove(&entry);
+            }
+            else{
+                dbSetValue(&entry);
+            }
+            count++;
+        }
+        if(length < sizeof(records)){
+            break;
+        }
+    }
+    return count;
+}
+
+// awepEraseLocked, awepWriteLocked:
+// One storage call with the lock held, so it cannot overlap a log page write
+static bool awepEraseLocked(awep_region_t region){
+    xSemaphoreTake(awepPersistLock, portMAX_DELAY);
+    bool erased = awep_port_storage_erase(region);
+    xSemaphoreGive(awepPersistLock);
+    return erased;
+}
+
+static bool awepWriteLocked(awep_region_t region, uint32_t offset, const void *data, uint32_t length){
+    xSemaphoreTake(awepPersistLock, portMAX_DELAY);
+    bool written = awep_port_storage_write(region, offset, data, length);
+    xSemaphoreGive(awepPersistLock);
+    return written;
+}
+
+// awepWriteSnapshot:
+// Scan the database into the snapshot slot not holding the newest snapshot,
+// header last. The scan runs alongside writes, whatever it misses or catches
+// half way is in the log of generation, which is replayed over it
+static bool awepWriteSnapshot(uint32_t generation){
+    awep_region_t slot = (awepSnapshot == AWEP_REGION_SNAPSHOT_0) ? AWEP_REGION_SNAPSHOT_1 : AWEP_REGION_SNAPSHOT_0;
+    dbEntry_t entries[AWEP_PERSIST_CHUNK];
+    uint8_t records[AWEP_PERSIST_CHUNK * AWEP_PERSIST_SNAPSHOT_RECORD];
+    uint8_t header[AWEP_PERSIST_SNAPSHOT_HEADER];
+    uint32_t count = 0;
+    uint32_t crc = 0;
+    uint32_t key = 0;
+    uint32_t found;
+
+    if(!awepEraseLocked(slot)){
+        return false;
+    }
+    do{
+        found = dbScan(key, entries, AWEP_PERSIST_CHUNK);
+        if(AWEP_PERSIST_SNAPSHOT_HEADER + (count + found) * AWEP_PERSIST_SNAPSHOT_RECORD >
+           awep_port_storage_size(slot)){
+            return false;
+        }
+        for(uint32_t i = 0; i < found; i++){
+            uint8_t *record = &records[i * AWEP_PERSIST_SNAPSHOT_RECORD];
+            record[0] = (uint8_t)(entries[i].deviceId >> 8);
+            record[1] = (uint8_t)entries[i].deviceId;
+            record[2] = (uint8_t)entries[i].regId;
+            record[3] = (uint8_t)(entries[i].value >> 8);
+            record[4] = (uint8_t)entries[i].value;
+        }
+        if(found != 0){
+            if(!awepWriteLocked(slot, AWEP_PERSIST_SNAPSHOT_HEADER + count * AWEP_PERSIST_SNAPSHOT_RECORD,
+                                records, found * AWEP_PERSIST_SNAPSHOT_RECORD)){
+                return false;
+            }
+            crc = awepCrc32(crc, records, found * AWEP_PERSIST_SNAPSHOT_RECORD);
+            count += found;
+            key = ((entries[found - 1u].deviceId << 8) | entries[found - 1u].regId) + 1u;
+        }
+    }while(found == AWEP_PERSIST_CHUNK);
+
+    memcpy(header, awepSnapshotMagic, sizeof(awepSnapshotMagic));
+    awepPut32(&header[4], generation);
+    awepPut32(&header[8], count);
+    awepPut32(&header[12], crc);
+    if(!awepWriteLocked(slot, 0, header, sizeof(header))){
+        return false;
+    }
+    awepSnapshot = slot;
+    awep_stats_add(AWEP_STAT_SNAPSHOTS, 1u);
+    return true;
+}
+
+// awepCompact:
+// Switch to the other log, which is erased, snapshot everything before the
+// switch and erase the log it replaces
+static void awepCompact(void){
+    xSemaphoreTake(awepPersistLock, portMAX_DELAY);
+    awep_region_t old = awepLog;
+    awepFlushPage();
+    awepStartLog((old == AWEP_REGION_LOG_0) ? AWEP_REGION_LOG_1 : AWEP_REGION_LOG_0, awepGeneration + 1u);
+    uint32_t generation = awepGeneration;
+    bool failed = awepFailed;
+    xSemaphoreGive(awepPersistLock);
+
+    if(failed){
+        return;
+    }
+    if(!awepWriteSnapshot(generation)){
+        // the old log is still needed, there is no erased log to switch to next time
+        xSemaphoreTake(awepPersistLock, portMAX_DELAY);
+        awepFail("snapshot");
+        xSemaphoreGive(awepPersistLock);
+        return;
+    }
+    if(!awepEraseLocked(old)){
+        xSemaphoreTake(awepPersistLock, portMAX_DELAY);
+        awepFail("erase");
+        xSemaphoreGive(awepPersistLock);
+    }
+}
+
+ /*******************************************************************************
+ * Function Name: awep_persist_start
+ *******************************************************************************
+ * Summary:
+ *  Rebuild the register database from the newest valid snapshot and the logs
+ *  after it, in generation order. Everything restored then goes into a fresh
+ *  snapshot, and once that is committed both logs are erased and the next one
+ *  started empty.
+ *
+ * Parameters:
+ * awep_persist_restore_t *restore: What was restored and how long it took
+ *
+ * Return:
+ *  bool: false if storage could not be set up, the server then runs from RAM only
+ *
+ *******************************************************************************/
+bool awep_persist_start(awep_persist_restore_t *restore)
+{
+    uint32_t counts[2] = {0, 0};
+    uint32_t generations[2];
+    uint32_t logGenerations[2];
+    uint32_t newest = 0;
+
+    awepPersistLock = xSemaphoreCreateMutexStatic(&awepPersistLockBuffer);
+    memset(restore, 0, sizeof(*restore));
+    uint32_t start = awep_port_timer();
+
+    generations[0] = awepReadSnapshot(AWEP_REGION_SNAPSHOT_0, false, &counts[0]);
+    generations[1] = awepReadSnapshot(AWEP_REGION_SNAPSHOT_1, false, &counts[1]);
+    awepSnapshot = (generations[1] > generations[0]) ? AWEP_REGION_SNAPSHOT_1 : AWEP_REGION_SNAPSHOT_0;
+    restore->generation = generations[awepSnapshot - AWEP_REGION_SNAPSHOT_0];
+    if(restore->generation != 0){
+        awepReadSnapshot(awepSnapshot, true, &restore->snapshotRecords);
+    }
+    newest = restore->generation;
+
+    // the logs from the snapshot's generation on, oldest first
+    logGenerations[0] = awepLogGeneration(AWEP_REGION_LOG_0);
+    logGenerations[1] = awepLogGeneration(AWEP_REGION_LOG_1);
+    uint32_t first = (logGenerations[1] < logGenerations[0]) ? 1u : 0u;
+    for(uint32_t i = 0; i < 2u; i++){
+        uint32_t log = (first + i) % 2u;
+        if(logGenerations[log] != 0 && logGenerations[log] >= restore->generation){
+            restore->logRecords += awepReplayLog((awep_region_t)(AWEP_REGION_LOG_0 + log), logGenerations[log]);
+            if(logGenerations[log] > newest){
+                newest = logGenerations[log];
+            }
+        }
+    }
+    restore->micros = awep_port_timer_micros(awep_port_timer() - start);
+    awep_stats_set(AWEP_STAT_RESTORE_US, restore->micros);
+
+    // no client is served yet, so this snapshot is exact. It goes into the slot
+    // not holding the one just loaded, and the logs are only erased once it is
+    // committed: a reset in between restores from one or the other
+    if(!awepWriteSnapshot(newest + 1u)){
+        awepFail("snapshot");
+        return false;
+    }
+    if(!awep_port_storage_erase(AWEP_REGION_LOG_0) || !awep_port_storage_erase(AWEP_REGION_LOG_1)){
+        awepFail("erase");
+        return false;
+    }
+    awepStartLog(AWEP_REGION_LOG_0, newest + 1u);
+    return !awepFailed;
+}
+
+ /*******************************************************************************
+ * Function Name: awep_persist_service
+ *******************************************************************************
+ * Summary:
+ *  Write out the log records gathered since the last call, and take a new
+ *  snapshot once the active log is AWEP_PERSIST_COMPACT_PERCENT full.
+ *
+ *******************************************************************************/
+void awep_persist_service(void)
+{
+    if(awepPersistLock == NULL){
+        return;
+    }
+    xSemaphoreTake(awepPersistLock, portMAX_DELAY);
+    awepFlushPage();
+    uint32_t used = awepPageOffset + awepPageLength;
+    bool failed = awepFailed;
+    xSemaphoreGive(awepPersistLock);
+
+    if(!failed && (uint64_t)used * 100u >= (uint64_t)awep_port_storage_size(awepLog) * AWEP_PERSIST_COMPACT_PERCENT){
+        awepCompact();
+    }
+}
@@ -0,0 +1,187 @@
+//queues and worker tasks that take AWEP commands off the receive callback
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <queue.h>
+#include "awep_pipeline.h"
+
+typedef struct {
+    QueueHandle_t queue;
+    TaskHandle_t task;
+    awep_pipeline_stats_t stats;
+} awepWorker_t;
+
+static awepWorker_t awepWorkers[AWEP_WORKERS];
+static awep_job_handler_t awepHandle;
+static awep_flush_handler_t awepFlush;
+static awep_release_handler_t awepRelease;
+
+// awepWorkerTask:
+// Every client is tied to one worker, so its commands are run and answered in
+// the order they arrived. The replies are flushed once the worker has no more
+// commands from that client waiting, so a pipelined burst goes out together.
+// Notifications are timed until the flush that sends them. Each job holds its
+// client until it is done, the last one of a closed client frees it.
+static void awepWorkerTask(void *arg){
+    awepWorker_t *worker = arg;
+    awep_job_t job;
+    awep_job_t next;
+    uint32_t notifies = 0;      // notifications queued on the writer since the last flush
+    uint32_t notifiedAt = 0;    // sum of their queuedAt
+    uint32_t firstNotifiedAt = 0;
+
+    for(;;){
+        xQueueReceive(worker->queue, &job, portMAX_DELAY);
+
+        uint32_t started = xTaskGetTickCount();
+        uint32_t wait = started - job.queuedAt;
+        worker->stats.jobs++;
+        worker->stats.waitTicks += wait;
+        if(wait > worker->stats.maxWaitTicks){
+            worker->stats.maxWaitTicks = wait;
+        }
+
+        // the client went away while the command was queued. The job's hold
+        // keeps the entry, so it is still that client's and not a new one's
+        if(job.conn->closing){
+            awepRelease(job.conn);
+            continue;
+        }
+        if(job.kind == AWEP_JOB_NOTIFY){
+            if(notifies == 0){
+                firstNotifiedAt = job.queuedAt;
+            }
+            notifies++;
+            notifiedAt += job.queuedAt;
+        }
+        awepHandle(&job);
+        uint32_t handled = xTaskGetTickCount();
+        worker->stats.serviceTicks += handled - started;
+
+        if(xQueuePeek(worker->queue, &next, 0) != pdTRUE || next.conn != job.conn){
+            awepFlush(job.conn);
+            uint32_t flushed = xTaskGetTickCount();
+            worker->stats.flushTicks += flushed - handled;
+            if(notifies != 0){
+                worker->stats.notifications += notifies;
+                worker->stats.notifyTicks += notifies * flushed - notifiedAt;
+                if(flushed - firstNotifiedAt > worker->stats.maxNotifyTicks){
+                    worker->stats.maxNotifyTicks = flushed - firstNotifiedAt;
+                }
+                notifies = 0;
+                notifiedAt = 0;
+            }
+        }
+        awepRelease(job.conn);
+    }
+}
+
+bool awep_pipeline_start(awep_job_handler_t handle, awep_flush_handler_t flush,
+                         awep_release_handler_t release){
+    awepHandle = handle;
+    awepFlush = flush;
+    awepRelease = release;
+    for(uint32_t i = 0; i < AWEP_WORKERS; i++){
+        awepWorkers[i].queue = xQueueCreate(AWEP_QUEUE_DEPTH, sizeof(awep_job_t));
+        if(awepWorkers[i].queue == NULL){
+            return false;
+        }
+        if(xTaskCreate(awepWorkerTask, "AWEP worker", AWEP_WORKER_STACK_SIZE, &awepWorkers[i],
+                       AWEP_WORKER_PRIORITY, &awepWorkers[i].task) != pdPASS){
+            return false;
+        }
+    }
+    return true;
+}
+
+// awep_pipeline_submit:
+// A full queue means the worker is behind, so the callback waits for room
+// rather than drop a command the client expects an answer to.
+bool awep_pipeline_submit(awep_conn_t *conn, const char *frame, uint32_t length, bool throttled){
+    awepWorker_t *worker = &awepWorkers[awep_conn_index(conn) % AWEP_WORKERS];
+    awep_job_t job;
+
+    if(length > AWEP_JOB_FRAME_MAX){
+        length = AWEP_JOB_FRAME_MAX;
+    }
+    job.conn = conn;
+    job.kind = AWEP_JOB_COMMAND;
+    job.throttled = throttled;
+    job.length = length;
+    memcpy(job.frame, frame, length);
+    job.frame[length] = '\0';
+
+    uint32_t depth = (uint32_t)uxQueueMessagesWaiting(worker->queue) + 1u;
+    if(depth > worker->stats.maxDepth){
+        worker->stats.maxDepth = depth;
+    }
+
+    if(!awep_conn_hold(conn)){
+        return false;
+    }
+    job.queuedAt = xTaskGetTickCount();
+    if(xQueueSend(worker->queue, &job, 0) == pdTRUE){
+        return true;
+    }
+    worker->stats.queueFull++;
+    if(xQueueSend(worker->queue, &job, portMAX_DELAY) == pdTRUE){
+        return true;
+    }
+    awepRelease(conn);
+    return false;
+}
+
+bool awep_pipeline_notify(awep_conn_t *conn, uint32_t deviceId, uint32_t regId, uint32_t value){
+    awepWorker_t *worker = &awepWorkers[awep_conn_index(conn) % AWEP_WORKERS];
+    awep_job_t job;
+
+    job.conn = conn;
+    job.kind = AWEP_JOB_NOTIFY;
+    job.throttled = false;
+    job.length = 0;
+    job.frame[0] = '\0';
+    job.deviceId = deviceId;
+    job.regId = regId;
+    job.value = value;
+    if(!awep_conn_hold(conn)){
+        return false;
+    }
+    job.queuedAt = xTaskGetTickCount();
+    if(xQueueSend(worker->queue, &job, 0) == pdTRUE){
+        return true;
+    }
+    worker->stats.notifyDropped++;
+    awepRelease(conn);
+    return false;
+}
+
+void awep_pipeline_get_stats(awep_pipeline_stats_t *stats){
+    memset(stats, 0, sizeof(*stats));
+    stats->stackFree = AWEP_WORKER_STACK_SIZE;
+    for(uint32_t i = 0; i < AWEP_WORKERS; i++){
+        const awep_pipeline_stats_t *worker = &awepWorkers[i].stats;
+        if(awepWorkers[i].task != NULL){
+            uint32_t stackFree = (uint32_t)uxTaskGetStackHighWaterMark(awepWorkers[i].task);
+            if(stackFree < stats->stackFree){
+                stats->stackFree = stackFree;
+            }
+        }
+        stats->jobs += worker->jobs;
+        stats->queueFull += worker->queueFull;
+        stats->waitTicks += worker->waitTicks;
+        stats->serviceTicks += worker->serviceTicks;
+        stats->flushTicks += worker->flushTicks;
+        stats->notifications += worker->notifications;
+        stats->notifyDropped += worker->notifyDropped;
+        stats->notifyTicks += worker->notifyTicks;
+        if(worker->maxNotifyTicks > stats->maxNotifyTicks){
+            stats->maxNotifyTicks = worker->maxNotifyTicks;
+        }
+        if(worker->maxDepth > stats->maxDepth){
+            stats->maxDepth = worker->maxDepth;
+        }
+        if(worker->maxWaitTicks > stats->maxWaitTicks){
+            stats->maxWaitTicks = worker->maxWaitTicks;
+        }
+    }
+}
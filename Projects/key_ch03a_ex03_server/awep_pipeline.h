@@ -0,0 +1,82 @@
+#ifndef AWEP_PIPELINE_H_
+#define AWEP_PIPELINE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "awep_conn.h"
+
+// Worker tasks handling commands
+#ifndef AWEP_WORKERS
+#define AWEP_WORKERS (2u)
+#endif
+
+// Commands each worker can have waiting
+#ifndef AWEP_QUEUE_DEPTH
+#define AWEP_QUEUE_DEPTH (16u)
+#endif
+
+// Stack depth in words. The most a worker has used is 974 words, measured with
+// uxTaskGetStackHighWaterMark on the host, where frames are bigger than on the
+// board; the statistics dump prints the board's own figure
+#define AWEP_WORKER_STACK_SIZE  (1024 + 512)
+#define AWEP_WORKER_PRIORITY    (1)
+
+// Longest command carried through a queue, the framer truncates anything longer
+#define AWEP_JOB_FRAME_MAX      (20u)
+
+// What a job asks the worker to do
+typedef enum {
+    AWEP_JOB_COMMAND = 0,   // run the framed command
+    AWEP_JOB_NOTIFY         // push a watched register change to the client
+} awep_job_kind_t;
+
+// One framed command on its way from the receive callback to a worker, or a
+// notification on its way from the worker that ran the W
+typedef struct {
+    awep_conn_t *conn;  // held by the job until the worker is done with it
+    uint32_t queuedAt;  // tick count when the job was queued
+    awep_job_kind_t kind;
+    bool throttled;     // over the client's rate limit, answered without being run
+    uint32_t length;
+    char frame[AWEP_JOB_FRAME_MAX + 1];  // NUL terminated
+    uint32_t deviceId;  // AWEP_JOB_NOTIFY only
+    uint32_t regId;
+    uint32_t value;
+} awep_job_t;
+
+// Per stage timing, in ticks, and queue depth over all workers
+typedef struct {
+    uint32_t jobs;
+    uint32_t queueFull;     // commands the callback had to wait to queue
+    uint32_t maxDepth;      // most commands waiting for one worker
+    uint32_t waitTicks;     // total time commands spent queued
+    uint32_t maxWaitTicks;
+    uint32_t serviceTicks;  // total time spent decoding, looking up and encoding
+    uint32_t flushTicks;    // total time spent sending replies
+    uint32_t notifications; // notifications sent
+    uint32_t notifyDropped; // notifications lost to a full queue
+    uint32_t notifyTicks;   // total time from the W being applied to its notification being sent
+    uint32_t maxNotifyTicks;
+    uint32_t stackFree;     // fewest stack words any worker has never used
+} awep_pipeline_stats_t;
+
+// Run a command and queue its reply on job->conn->writer
+typedef void (*awep_job_handler_t)(awep_job_t *job);
+// Send whatever replies are queued on conn
+typedef void (*awep_flush_handler_t)(awep_conn_t *conn);
+// Drop the hold a job had on conn
+typedef void (*awep_release_handler_t)(awep_conn_t *conn);
+
+//create the queues and the worker tasks
+bool awep_pipeline_start(awep_job_handler_t handle, awep_flush_handler_t flush,
+                         awep_release_handler_t release);
+//queue a framed command, called from the receive callback with conn held.
+//Every queued job holds conn until the worker is done with it
+bool awep_pipeline_submit(awep_conn_t *conn, const char *frame, uint32_t length, bool throttled);
+//queue a notification for a watching client, called from a worker. It never
+//waits, two workers notifying each other could otherwise deadlock
+bool awep_pipeline_notify(awep_conn_t *conn, uint32_t deviceId, uint32_t regId, uint32_t value);
+//add up the statistics of all the workers
+void awep_pipeline_get_stats(awep_pipeline_stats_t *stats);
+
+#endif
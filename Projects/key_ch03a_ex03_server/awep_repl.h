@@ -0,0 +1,77 @@
+#ifndef AWEP_REPL_H_
+#define AWEP_REPL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "database.h"
+
+// A primary streams every register write it accepts to one standby over a
+// TCP connection of its own. Writes are numbered in the order the database
+// applied them, and the primary keeps the last AWEP_REPL_HISTORY of them so a
+// standby that reconnects picks up where it left off. One that was away for
+// longer, or that follows a different run of the primary, is sent every
+// register first. The standby answers clients' reads, turns their writes away
+// and becomes a primary when promoted.
+//
+// Frames on the replication connection, fields big endian:
+// standby to primary
+//   'H' <runId:4> <seq:4>      hello, the run followed and the last write applied
+//   'A' <seq:4>                every write up to seq applied, one for all the
+//                              batches a receive brought in
+// primary to standby
+//   'S' <runId:4> <seq:4>      every register follows, then writes from seq on
+//   'Y' <count:1> <record>...  registers of that copy
+//   'E'                        end of the copy
+//   'B' <seq:4> <count:1> <record>...  writes seq, seq + 1, ...
+// where a record is 'W' <deviceId:2> <regId:1> <value:2>, the value after the
+// write, or 'D' and the same fields for a register the primary evicted
+
+// Writes kept for the standby, a standby further behind is sent a full copy
+#ifndef AWEP_REPL_HISTORY
+#define AWEP_REPL_HISTORY (512u)
+#endif
+
+// Most writes in one batch frame
+#ifndef AWEP_REPL_BATCH
+#define AWEP_REPL_BATCH (48u)
+#endif
+
+// Ticks the primary waits for an ack before it looks again, while writes are
+// unacknowledged. With nothing outstanding it waits for the next write
+#ifndef AWEP_REPL_ACK_TICKS
+#define AWEP_REPL_ACK_TICKS (5u)
+#endif
+
+// Stack depth in words, the task has used at most 1070 measured the same way as
+// AWEP_WORKER_STACK_SIZE
+#define AWEP_REPL_STACK_SIZE    (1024 + 512)
+#define AWEP_REPL_PRIORITY      (1)
+
+#define AWEP_REPL_RECORD_LEN    (6u)
+#define AWEP_REPL_BATCH_HEADER  (6u)
+#define AWEP_REPL_FRAME_MAX     (AWEP_REPL_BATCH_HEADER + AWEP_REPL_BATCH * AWEP_REPL_RECORD_LEN)
+
+//start the replication task, as the primary or as a standby of the primary the
+//port connects to. Call after awep_server_start
+bool awep_repl_start(bool standby);
+//true while the server is a standby and client writes are turned away
+bool awep_repl_is_standby(void);
+//make a standby the primary, it stops following and starts serving writes
+void awep_repl_promote(void);
+//number the write or removal for the standby, the database journal
+void awep_repl_journal(const dbEntry_t *entry, bool removed);
+//stack words the replication task has never used, 0 before it starts
+uint32_t awep_repl_stack_free(void);
+
+// Provided by the port, tcp_server.c on the board. Sending and closing go
+// through awep_port_send and awep_port_close like a client socket
+
+//wait for a standby to connect to the replication port, NULL if none did
+void *awep_port_repl_accept(void);
+//connect to the primary's replication port, NULL on failure
+void *awep_port_repl_connect(void);
+//receive up to length bytes, waiting at most ticks. Returns the bytes
+//received, 0 if none came in time and -1 once the connection is gone
+int32_t awep_port_repl_receive(void *socket, char *data, uint32_t length, uint32_t ticks);
+
+#endif
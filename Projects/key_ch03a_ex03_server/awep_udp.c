@@ -0,0 +1,66 @@
+//reply cache of the UDP transport, suppresses retransmitted AWEP requests
+#include <stddef.h>
+#include <string.h>
+#include "awep_udp.h"
+
+// Last request of one peer and the reply it got
+typedef struct {
+    uint32_t address;   // IPv4 address of the peer, 0 when the entry is free
+    uint16_t port;
+    uint16_t requestId;
+    uint32_t lastHeard; // tick count of the last request
+    uint32_t length;
+    char reply[AWEP_UDP_REPLY_MAX];
+} awep_udp_peer_t;
+
+static awep_udp_peer_t awepUdpPeers[AWEP_UDP_PEERS];
+
+// awepUdpFind:
+// The cache is a handful of entries, a linear scan like the connection table
+static awep_udp_peer_t *awepUdpFind(uint32_t address, uint16_t port){
+    for(uint32_t i = 0; i < AWEP_UDP_PEERS; i++){
+        if(awepUdpPeers[i].address == address && awepUdpPeers[i].port == port){
+            return &awepUdpPeers[i];
+        }
+    }
+    return NULL;
+}
+
+void awep_udp_init(void){
+    memset(awepUdpPeers, 0, sizeof(awepUdpPeers));
+}
+
+const char *awep_udp_lookup(uint32_t address, uint16_t port, uint16_t requestId, uint32_t *length){
+    awep_udp_peer_t *peer = awepUdpFind(address, port);
+    if(peer == NULL || peer->requestId != requestId){
+        return NULL;
+    }
+    *length = peer->length;
+    return peer->reply;
+}
+
+// awep_udp_store:
+// A peer keeps its entry, otherwise a free one or the one heard from longest
+// ago is taken. Ticks are compared as ages so the wrap does not matter
+void awep_udp_store(uint32_t address, uint16_t port, uint16_t requestId,
+                    const char *reply, uint32_t length, uint32_t now){
+    awep_udp_peer_t *peer = awepUdpFind(address, port);
+    if(peer == NULL){
+        peer = &awepUdpPeers[0];
+        for(uint32_t i = 0; i < AWEP_UDP_PEERS && peer->address != 0; i++){
+            if(awepUdpPeers[i].address == 0 ||
+               now - awepUdpPeers[i].lastHeard > now - peer->lastHeard){
+                peer = &awepUdpPeers[i];
+            }
+        }
+    }
+    if(length > AWEP_UDP_REPLY_MAX){
+        length = AWEP_UDP_REPLY_MAX;
+    }
+    peer->address = address;
+    peer->port = port;
+    peer->requestId = requestId;
+    peer->lastHeard = now;
+    peer->length = length;
+    memcpy(peer->reply, reply, length);
+}
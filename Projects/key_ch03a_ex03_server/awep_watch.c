@@ -0,0 +1,61 @@
+//the registers each AWEP client has asked to be notified about
+#include <stddef.h>
+#include "awep_watch.h"
+
+void awep_watch_init(awep_watch_list_t *list){
+    list->count = 0;
+}
+
+// awepWatchFind:
+// Position of an exact watch, count if the list does not hold it
+static uint32_t awepWatchFind(const awep_watch_list_t *list, uint32_t deviceId, uint32_t regId){
+    uint32_t i;
+    for(i = 0; i < list->count; i++){
+        if(list->deviceId[i] == deviceId && list->regId[i] == regId){
+            break;
+        }
+    }
+    return i;
+}
+
+// awep_watch_add:
+// The entry is filled in before count covers it, so a writer matching against
+// the list at the same time never sees a half written watch
+awep_status_t awep_watch_add(awep_watch_list_t *list, uint32_t deviceId, uint32_t regId){
+    uint32_t i = awepWatchFind(list, deviceId, regId);
+    if(i < list->count){
+        return AWEP_OK;
+    }
+    if(list->count == AWEP_WATCH_MAX){
+        return AWEP_ERR_WATCH_LIMIT;
+    }
+    list->deviceId[i] = (uint16_t)deviceId;
+    list->regId[i] = (uint16_t)regId;
+    list->count = i + 1u;
+    return AWEP_OK;
+}
+
+// awep_watch_remove:
+// The last watch moves into the hole, the order of the list does not matter
+awep_status_t awep_watch_remove(awep_watch_list_t *list, uint32_t deviceId, uint32_t regId){
+    uint32_t i = awepWatchFind(list, deviceId, regId);
+    if(i == list->count){
+        return AWEP_ERR_NOT_FOUND;
+    }
+    uint32_t last = list->count - 1u;
+    list->deviceId[i] = list->deviceId[last];
+    list->regId[i] = list->regId[last];
+    list->count = last;
+    return AWEP_OK;
+}
+
+bool awep_watch_match(const awep_watch_list_t *list, uint32_t deviceId, uint32_t regId){
+    uint32_t count = list->count;
+    for(uint32_t i = 0; i < count; i++){
+        if(list->deviceId[i] == deviceId &&
+           (list->regId[i] == regId || list->regId[i] == AWEP_ALL_REGS)){
+            return true;
+        }
+    }
+    return false;
+}
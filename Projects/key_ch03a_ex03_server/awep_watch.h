@@ -0,0 +1,29 @@
+#ifndef AWEP_WATCH_H_
+#define AWEP_WATCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "awep.h"
+
+// Watches one client may hold, an S beyond this is answered "X Too Many Watches"
+#ifndef AWEP_WATCH_MAX
+#define AWEP_WATCH_MAX (4u)
+#endif
+
+// Registers, or whole devices, a client wants to hear about
+typedef struct {
+    uint16_t deviceId[AWEP_WATCH_MAX];
+    uint16_t regId[AWEP_WATCH_MAX];     // AWEP_ALL_REGS for a whole device
+    uint32_t count;
+} awep_watch_list_t;
+
+//drop every watch
+void awep_watch_init(awep_watch_list_t *list);
+//start watching, AWEP_ERR_WATCH_LIMIT if the list is full, watching twice is not an error
+awep_status_t awep_watch_add(awep_watch_list_t *list, uint32_t deviceId, uint32_t regId);
+//stop watching, AWEP_ERR_NOT_FOUND if it was not watched
+awep_status_t awep_watch_remove(awep_watch_list_t *list, uint32_t deviceId, uint32_t regId);
+//true if a write to deviceId/regId should be pushed to this client
+bool awep_watch_match(const awep_watch_list_t *list, uint32_t deviceId, uint32_t regId);
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef DATABASE_H_
+#define DATABASE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Maximum number of deviceId/regId registers the database will hold. The
+// entries come from a static pool of this size, nothing is taken from the heap.
+#ifndef DB_MAX_ENTRIES
+#define DB_MAX_ENTRIES (400u)
+#endif
+
+// The hash table has 2^DB_HASH_BITS slots. It must be at least twice
+// DB_MAX_ENTRIES so the probe sequences stay short.
+#ifndef DB_HASH_BITS
+#define DB_HASH_BITS (10u)
+#endif
+
+// 1: store records packed to the AWEP field widths (16 bit deviceId, 8 bit
+// regId, 16 bit value) as separate key and value arrays, 5 bytes per record.
+// 0: store full dbEntry_t records, 12 bytes per record.
+#ifndef DB_PACKED_STORAGE
+#define DB_PACKED_STORAGE (1)
+#endif
+
+// What dbSetValue does with a new register once every pool entry is in use.
+// DB_EVICT_NONE: reject it, dbSetValue returns false
+// DB_EVICT_CLOCK: replace a register that has not been accessed recently, using
+// the CLOCK (second chance) algorithm and a 1 byte last-access stamp per entry
+#define DB_EVICT_NONE  (0)
+#define DB_EVICT_CLOCK (1)
+#ifndef DB_EVICTION_POLICY
+#define DB_EVICTION_POLICY DB_EVICT_NONE
+#endif
+
+// The database is shared by every task that serves clients. Writers take a
+// mutex, readers do not lock: a lookup is repeated if a write ran in the middle
+// of it. After DB_READ_RETRIES tries the reader takes the mutex as well, which
+// also lends its priority to a preempted writer it would otherwise spin on.
+#ifndef DB_READ_RETRIES
+#define DB_READ_RETRIES (2u)
+#endif
+
+// Registers hold 16 bit AWEP values, dbAdd wraps around at this
+#define DB_VALUE_MASK (0xFFFFu)
+
+// Outcome of dbCompareAndSet and dbAdd
+typedef enum {
+    DB_UPDATED = 0,
+    DB_MISMATCH,    // the register holds another value than expected
+    DB_NOT_FOUND,
+    DB_FULL         // a new register and no room for it
+} dbUpdate_t;
+
+// the dbEntry is the structure used to pass registers in and out of the database.
+typedef struct dbEntry {
+    uint32_t deviceId;
+    uint32_t regId;
+    uint32_t value;
+} dbEntry_t;
+
+// Called with every register a write changed and its new value, in the order
+// the writes are applied. removed is set for a register taken out, by dbRemove
+// or to make room for a new one with DB_EVICT_CLOCK, and comes before the write
+// that replaced it. It runs with the write lock held, so it must be short and
+// must not call back into the database
+typedef void (*dbJournal_t)(const dbEntry_t *entry, bool removed);
+
+//init function, call once before the tasks using the database start
+void dbInit(void);
+//Find Function, copies the stored value into find and returns it, NULL if not found
+dbEntry_t *dbFind(dbEntry_t *find);
+//range function, copies up to max registers of deviceId from firstReg to lastReg
+//into out in regId order and returns how many, call again after the last regId
+//for the rest. Each call is consistent on its own, not with the calls before it
+uint32_t dbRange(uint32_t deviceId, uint32_t firstReg, uint32_t lastReg, dbEntry_t *out, uint32_t max);
+//scan function, copies up to max registers from firstKey ((deviceId << 8) | regId)
+//on into out in key order and returns how many, call again after the last key
+//for the rest. A register stored before the scan started and not removed is
+//always found, whatever is written meanwhile
+uint32_t dbScan(uint32_t firstKey, dbEntry_t *out, uint32_t max);
+//journal function, set the function told about every change or NULL for none
+void dbSetJournal(dbJournal_t journal);
+//setvalue function, returns false if the database is full (never with DB_EVICT_CLOCK)
+bool dbSetValue(const dbEntry_t *newValue);
+//remove function, takes the register out and returns false if it was not there.
+//For replaying a journal, so a copy drops the registers its origin evicted
+bool dbRemove(const dbEntry_t *entry);
+//compareandset function, stores entry->value only if the register holds expected.
+//entry->value is what the register holds afterwards, DB_NOT_FOUND if it does not exist
+dbUpdate_t dbCompareAndSet(dbEntry_t *entry, uint32_t expected);
+//add function, adds delta to the register, a new one starts from 0. entry->value
+//is the value afterwards, DB_FULL if it is new and cannot be stored
+dbUpdate_t dbAdd(dbEntry_t *entry, uint32_t delta);
+//getmax function
+uint32_t dbGetMax(void);
+//getcount function (entries taken from the pool)
+uint32_t dbGetCount(void);
+//gethighwater function (most entries ever taken from the pool)
+uint32_t dbGetHighWater(void);
+//getevictions function (registers replaced to make room for new ones)
+uint32_t dbGetEvictions(void);
+//getreadretries function (lookups repeated because a write ran at the same time)
+uint32_t dbGetReadRetries(void);
+//getentrysize function (bytes of SRAM used per entry, including its share of hash slots)
+uint32_t dbGetBytesPerEntry(void);
+
+#endif
@@ -0,0 +1,191 @@
+//host benchmarks of the AWEP codec and the register database, nanoseconds per
+//command on this machine
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "awep.h"
+#include "database.h"
+
+#define BENCH_ROUNDS (2000000u)
+
+// keeps the compiler from dropping the work being timed
+static volatile uint32_t benchSink;
+
+static double benchNow(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+// benchScanf:
+// The receive handler before awep.c: strlen for every check, isxdigit, then
+// sscanf to decode and sprintf to reply. Only R and W, as it was
+static uint32_t benchScanf(const char *frame, char *reply){
+    char command = 0;
+    unsigned int deviceId = 0, regId = 0, value = 0;
+    if(strlen(frame) > 12){
+        return (uint32_t)sprintf(reply, "X illegal length");
+    }
+    if(!((strlen(frame) == 7 && frame[0] == 'R') || (strlen(frame) == 11 && frame[0] == 'W'))){
+        return (uint32_t)sprintf(reply, "X illegal command");
+    }
+    for(size_t i = 1; i < strlen(frame); i++){
+        if(!isxdigit((int)frame[i])){
+            return (uint32_t)sprintf(reply, "X illegal character");
+        }
+    }
+    if(frame[0] == 'W'){
+        sscanf(frame, "%c%4x%2x%4x", &command, &deviceId, &regId, &value);
+    }
+    else{
+        sscanf(frame, "%c%4x%2x", &command, &deviceId, &regId);
+    }
+    return (uint32_t)sprintf(reply, "A%04X%02X%04X", deviceId, regId, value);
+}
+
+// benchAwep:
+// The same with awep_decode and awep_encode_ack
+static uint32_t benchAwep(const char *frame, char *reply){
+    awep_request_t request;
+    awep_status_t status = awep_decode(frame, AWEP_MAX_LEN + 1u, &request);
+    if(status != AWEP_OK){
+        return awep_encode_error(reply, AWEP_REPLY_MAX, status, 0);
+    }
+    return awep_encode_ack(reply, AWEP_REPLY_MAX, request.deviceId, request.regId, request.value);
+}
+
+static double benchCodec(uint32_t (*codec)(const char *, char *), const char *frame){
+    char reply[32];
+    double start = benchNow();
+    for(uint32_t i = 0; i < BENCH_ROUNDS; i++){
+        benchSink += codec(frame, reply);
+    }
+    return (benchNow() - start) / BENCH_ROUNDS;
+}
+
+// The linked list the database replaced, one node per register, walked once
+// by a find and three times by a W (dbFind, dbGetCount, dbSetValue)
+typedef struct benchNode {
+    dbEntry_t entry;
+    struct benchNode *next;
+} benchNode_t;
+
+static benchNode_t *benchList;
+static benchNode_t *benchListTail;
+
+static benchNode_t *benchListFind(const dbEntry_t *find){
+    for(benchNode_t *node = benchList; node != NULL; node = node->next){
+        if(node->entry.deviceId == find->deviceId && node->entry.regId == find->regId){
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static uint32_t benchListCount(void){
+    uint32_t count = 0;
+    for(benchNode_t *node = benchList; node != NULL; node = node->next){
+        count++;
+    }
+    return count;
+}
+
+static void benchListSet(const dbEntry_t *newValue){
+    benchNode_t *found = benchListFind(newValue);
+    if(found != NULL){
+        found->entry.value = newValue->value;
+        return;
+    }
+    benchNode_t *node = calloc(1, sizeof(*node));
+    node->entry = *newValue;
+    if(benchListTail != NULL){
+        benchListTail->next = node;
+    }
+    else{
+        benchList = node;
+    }
+    benchListTail = node;
+}
+
+// benchKey:
+// The i-th register stored, spread over deviceIds and regIds
+static dbEntry_t benchKey(uint32_t i){
+    dbEntry_t entry = {(i * 7919u) & 0xFFFFu, i & 0xFFu, i & DB_VALUE_MASK};
+    return entry;
+}
+
+// benchDatabase:
+// Fill both stores to entries registers, then time finds and Ws of registers
+// picked at random among them
+static void benchDatabase(uint32_t entries){
+    static uint32_t stored;
+    for(; stored < entries; stored++){
+        dbEntry_t entry = benchKey(stored);
+        benchListSet(&entry);
+        dbSetValue(&entry);
+    }
+    uint32_t rounds = BENCH_ROUNDS / 20u;
+    uint32_t listRounds = (entries > 1000u) ? rounds / 100u : rounds;
+    uint32_t *picks = malloc(rounds * sizeof(*picks));
+    srand(entries);
+    for(uint32_t i = 0; i < rounds; i++){
+        picks[i] = (uint32_t)rand() % entries;
+    }
+
+    double start = benchNow();
+    for(uint32_t i = 0; i < listRounds; i++){
+        dbEntry_t find = benchKey(picks[i]);
+        benchSink += (benchListFind(&find) != NULL);
+    }
+    double listFind = (benchNow() - start) / listRounds;
+
+    start = benchNow();
+    for(uint32_t i = 0; i < rounds; i++){
+        dbEntry_t find = benchKey(picks[i]);
+        benchSink += (dbFind(&find) != NULL);
+    }
+    double hashFind = (benchNow() - start) / rounds;
+
+    start = benchNow();
+    for(uint32_t i = 0; i < listRounds; i++){
+        dbEntry_t write = benchKey(picks[i]);
+        write.value = i & DB_VALUE_MASK;
+        if(benchListFind(&write) != NULL || benchListCount() < DB_MAX_ENTRIES){
+            benchListSet(&write);
+        }
+    }
+    double listWrite = (benchNow() - start) / listRounds;
+
+    start = benchNow();
+    for(uint32_t i = 0; i < rounds; i++){
+        dbEntry_t write = benchKey(picks[i]);
+        write.value = i & DB_VALUE_MASK;
+        benchSink += dbSetValue(&write);
+    }
+    double hashWrite = (benchNow() - start) / rounds;
+
+    printf("  %-8u %10.1f %10.1f %10.1f %10.1f\n", (unsigned)entries,
+           listFind, hashFind, listWrite, hashWrite);
+    free(picks);
+}
+
+int main(void){
+    static const char *const frames[] = {"W12AB05BEEF", "R12AB05"};
+
+    printf("codec, ns per command\n");
+    printf("  %-12s %14s %8s\n", "frame", "sscanf/sprintf", "awep");
+    for(size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++){
+        printf("  %-12s %14.0f %8.0f\n", frames[i],
+               benchCodec(benchScanf, frames[i]), benchCodec(benchAwep, frames[i]));
+    }
+
+    dbInit();
+    printf("database of %u entries, ns per command\n", (unsigned)dbGetMax());
+    printf("  %-8s %10s %10s %10s %10s\n", "entries", "list find", "hash find", "list W", "hash W");
+    benchDatabase(10u);
+    benchDatabase(400u);
+    benchDatabase(10000u);
+    return 0;
+}
@@ -0,0 +1,184 @@
+//host load client for the AWEP server, fast enough to keep it busy over
+//loopback: N connections, each writing its own registers with up to depth
+//commands in flight, served from one poll() loop
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CLIENT_MAX_CONNECTIONS (64)
+#define CLIENT_MAX_DEPTH       (256)
+// registers each connection writes, 6 connections of them fit the default
+// 400 entry database
+#define CLIENT_REGISTERS       (64u)
+
+typedef struct {
+    int fd;
+    uint32_t sent;          // commands written
+    uint32_t answered;      // replies read
+    uint32_t errors;        // replies other than an ack
+    uint64_t sentAt[CLIENT_MAX_DEPTH];  // send time of each command in flight
+    char reply[64];         // the reply read so far
+    uint32_t replyLength;
+    int served;             // an ack came back
+    int closed;
+} client_t;
+
+static client_t clients[CLIENT_MAX_CONNECTIONS];
+static uint32_t *latencies;    // ns from send to reply
+static uint32_t latencyCount;
+
+static uint64_t clientNow(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static int clientCompare(const void *a, const void *b){
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// clientSend:
+// Top the connection up to depth commands in flight, count commands in all
+static void clientSend(client_t *client, uint32_t index, uint32_t depth, uint32_t count){
+    char frames[CLIENT_MAX_DEPTH * 12 + 1];   // and the NUL snprintf leaves
+    uint32_t length = 0;
+    uint64_t now = clientNow();
+    while(client->sent < count && client->sent - client->answered < depth){
+        length += (uint32_t)snprintf(&frames[length], sizeof(frames) - length, "W%04X%02X%04X\n",
+                                     0x1000u + index, client->sent % CLIENT_REGISTERS,
+                                     client->sent & 0xFFFFu);
+        client->sentAt[client->sent % CLIENT_MAX_DEPTH] = now;
+        client->sent++;
+    }
+    // the socket buffer takes a few hundred commands whole
+    if(length > 0 && send(client->fd, frames, length, MSG_NOSIGNAL) != (ssize_t)length){
+        client->closed = 1;
+    }
+}
+
+// clientReceive:
+// Read the NUL terminated replies that have arrived and time each one
+static void clientReceive(client_t *client){
+    char buffer[4096];
+    ssize_t received = recv(client->fd, buffer, sizeof(buffer), 0);
+    if(received <= 0){
+        client->closed = 1;
+        return;
+    }
+    uint64_t now = clientNow();
+    for(ssize_t i = 0; i < received; i++){
+        if(client->replyLength < sizeof(client->reply)){
+            client->reply[client->replyLength++] = buffer[i];
+        }
+        if(buffer[i] != '\0'){
+            continue;
+        }
+        // a client turned away is told X Server Busy and closed
+        if(client->reply[0] == 'A'){
+            client->served = 1;
+        }
+        else{
+            client->errors++;
+        }
+        client->replyLength = 0;
+        latencies[latencyCount++] = (uint32_t)(now - client->sentAt[client->answered % CLIENT_MAX_DEPTH]);
+        client->answered++;
+    }
+}
+
+static void clientUsage(const char *name){
+    fprintf(stderr, "usage: %s [-a address] [-p port] [-c connections] [-d depth] [-n commands]\n", name);
+    exit(2);
+}
+
+int main(int argc, char *argv[]){
+    const char *address = "127.0.0.1";
+    uint32_t port = 50007;
+    uint32_t connections = 1;
+    uint32_t depth = 1;
+    uint32_t count = 20000;
+    int option;
+    while((option = getopt(argc, argv, "a:p:c:d:n:")) != -1){
+        switch(option){
+        case 'a': address = optarg; break;
+        case 'p': port = (uint32_t)atoi(optarg); break;
+        case 'c': connections = (uint32_t)atoi(optarg); break;
+        case 'd': depth = (uint32_t)atoi(optarg); break;
+        case 'n': count = (uint32_t)atoi(optarg); break;
+        default: clientUsage(argv[0]);
+        }
+    }
+    if(connections < 1 || connections > CLIENT_MAX_CONNECTIONS || depth < 1 || depth > CLIENT_MAX_DEPTH || count < 1){
+        clientUsage(argv[0]);
+    }
+    latencies = malloc((size_t)connections * count * sizeof(*latencies));
+
+    struct sockaddr_in server = {.sin_family = AF_INET, .sin_port = htons((uint16_t)port)};
+    if(inet_pton(AF_INET, address, &server.sin_addr) != 1){
+        clientUsage(argv[0]);
+    }
+    for(uint32_t i = 0; i < connections; i++){
+        int one = 1;
+        clients[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(clients[i].fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if(connect(clients[i].fd, (struct sockaddr *)&server, sizeof(server)) != 0){
+            fprintf(stderr, "connect: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    uint64_t start = clientNow();
+    for(;;){
+        struct pollfd fds[CLIENT_MAX_CONNECTIONS];
+        uint32_t open = 0;
+        for(uint32_t i = 0; i < connections; i++){
+            client_t *client = &clients[i];
+            if(!client->closed && client->answered < count){
+                clientSend(client, i, depth, count);
+            }
+            fds[i].fd = (client->closed || client->answered == count) ? -1 : client->fd;
+            fds[i].events = POLLIN;
+            open += (fds[i].fd >= 0);
+        }
+        if(open == 0){
+            break;
+        }
+        if(poll(fds, connections, 5000) <= 0){
+            fprintf(stderr, "no reply for 5 s\n");
+            break;
+        }
+        for(uint32_t i = 0; i < connections; i++){
+            if(fds[i].revents != 0){
+                clientReceive(&clients[i]);
+            }
+        }
+    }
+    double elapsed = (double)(clientNow() - start) / 1e9;
+
+    uint32_t served = 0, errors = 0;
+    for(uint32_t i = 0; i < connections; i++){
+        served += (uint32_t)clients[i].served;
+        errors += clients[i].errors;
+        close(clients[i].fd);
+    }
+    qsort(latencies, latencyCount, sizeof(*latencies), clientCompare);
+    printf("connections %u, depth %u: %u served, %u turned away, %u replies, %u errors\n",
+           (unsigned)connections, (unsigned)depth, (unsigned)served, (unsigned)(connections - served),
+           (unsigned)latencyCount, (unsigned)errors);
+    if(latencyCount > 0){
+        printf("%.0f ops/s, %.1f us/op, latency p50 %.1f us, p99 %.1f us\n",
+               latencyCount / elapsed, elapsed * 1e6 / latencyCount,
+               latencies[latencyCount / 2] / 1e3, latencies[(uint64_t)latencyCount * 99u / 100u] / 1e3);
+    }
+    return 0;
+}
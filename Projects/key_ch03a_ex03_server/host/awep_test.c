@@ -0,0 +1,263 @@
+//table driven checks of the AWEP decoder and encoder, every status of both
+//protocols and the lengths and values at the edges of each field
+#include <stdio.h>
+#include <string.h>
+#include "awep.h"
+
+// One ASCII command, size is the bytes the decoder may look at (the frame
+// and its NUL unless a case cuts it short)
+typedef struct {
+    const char *frame;
+    uint32_t size;
+    awep_status_t status;
+    char command;
+    uint32_t deviceId;
+    uint32_t regId;
+    uint32_t value;
+    uint32_t expected;
+} testDecode_t;
+
+// One binary command, the frame with its length byte
+typedef struct {
+    uint8_t frame[32];
+    uint32_t size;
+    awep_status_t status;
+    char command;
+    uint32_t deviceId;
+    uint32_t regId;
+    uint32_t value;
+    uint32_t expected;
+} testBinary_t;
+
+// size of a frame and its NUL
+#define WHOLE 0xFFFFFFFFu
+
+static const testDecode_t testDecodes[] = {
+    // every command at its length, the fields at 0 and at their largest
+    {"R000000",          WHOLE, AWEP_OK, 'R', 0x0000, 0x00, 0, 0},
+    {"RFFFFFF",          WHOLE, AWEP_OK, 'R', 0xFFFF, 0xFF, 0, 0},
+    {"R12ab05",          WHOLE, AWEP_OK, 'R', 0x12AB, 0x05, 0, 0},
+    {"W12AB05BEEF",      WHOLE, AWEP_OK, 'W', 0x12AB, 0x05, 0xBEEF, 0},
+    {"WFFFFFFFFFF",      WHOLE, AWEP_OK, 'W', 0xFFFF, 0xFF, 0xFFFF, 0},
+    {"I00010200FF",      WHOLE, AWEP_OK, 'I', 0x0001, 0x02, 0x00FF, 0},
+    {"S1234",            WHOLE, AWEP_OK, 'S', 0x1234, AWEP_ALL_REGS, 0, 0},
+    {"S123456",          WHOLE, AWEP_OK, 'S', 0x1234, 0x56, 0, 0},
+    {"U1234",            WHOLE, AWEP_OK, 'U', 0x1234, AWEP_ALL_REGS, 0, 0},
+    {"U123456",          WHOLE, AWEP_OK, 'U', 0x1234, 0x56, 0, 0},
+    {"G1234",            WHOLE, AWEP_OK, 'G', 0x1234, 0x00, 0xFF, 0},
+    {"G12341020",        WHOLE, AWEP_OK, 'G', 0x1234, 0x10, 0x20, 0},
+    {"C12AB0500010002",  WHOLE, AWEP_OK, 'C', 0x12AB, 0x05, 0x0002, 0x0001},
+    {"T",                WHOLE, AWEP_OK, 'T', 0, 0, 0, 0},
+    // the bytes after size are not looked at
+    {"R12AB05junk",      7u,    AWEP_OK, 'R', 0x12AB, 0x05, 0, 0},
+    // lengths: AWEP_MAX_LEN is taken by no command, one more is too long
+    {"W12AB05BEEF00000",  WHOLE, AWEP_ERR_COMMAND, 'W', 0, 0, 0, 0},
+    {"W12AB05BEEF000000", WHOLE, AWEP_ERR_LENGTH, 'W', 0, 0, 0, 0},
+    {"R12AB05GGGGGGGGGGZ", WHOLE, AWEP_ERR_LENGTH, 'R', 0, 0, 0, 0},
+    // a command letter at a length it does not take, or no command at all
+    {"",                 WHOLE, AWEP_ERR_COMMAND, '\0', 0, 0, 0, 0},
+    {"",                 0u,    AWEP_ERR_COMMAND, '\0', 0, 0, 0, 0},
+    {"R12AB0",           WHOLE, AWEP_ERR_COMMAND, 'R', 0, 0, 0, 0},
+    {"R12AB055",         WHOLE, AWEP_ERR_COMMAND, 'R', 0, 0, 0, 0},
+    {"W12AB05BEE",       WHOLE, AWEP_ERR_COMMAND, 'W', 0, 0, 0, 0},
+    {"R12AB05BEEF",      WHOLE, AWEP_ERR_COMMAND, 'R', 0, 0, 0, 0},
+    {"W12AB05",          WHOLE, AWEP_ERR_COMMAND, 'W', 0, 0, 0, 0},
+    {"T00",              WHOLE, AWEP_ERR_COMMAND, 'T', 0, 0, 0, 0},
+    {"C12AB05BEEF",      WHOLE, AWEP_ERR_COMMAND, 'C', 0, 0, 0, 0},
+    {"Q12AB05",          WHOLE, AWEP_ERR_COMMAND, 'Q', 0, 0, 0, 0},
+    {"r12AB05",          WHOLE, AWEP_ERR_COMMAND, 'r', 0, 0, 0, 0},
+    // the length and command are checked before the characters
+    {"Q12AG05",          WHOLE, AWEP_ERR_COMMAND, 'Q', 0, 0, 0, 0},
+    {"R12AG0500000000000", WHOLE, AWEP_ERR_LENGTH, 'R', 0, 0, 0, 0},
+    // characters next to the hex digits, in every field
+    {"R/12AB0",          WHOLE, AWEP_ERR_CHARACTER, 'R', 0, 0, 0, 0},
+    {"R:12AB0",          WHOLE, AWEP_ERR_CHARACTER, 'R', 0, 0, 0, 0},
+    {"R12@B05",          WHOLE, AWEP_ERR_CHARACTER, 'R', 0, 0, 0, 0},
+    {"R12GB05",          WHOLE, AWEP_ERR_CHARACTER, 'R', 0, 0, 0, 0},
+    {"R12`B05",          WHOLE, AWEP_ERR_CHARACTER, 'R', 0, 0, 0, 0},
+    {"R12gB05",          WHOLE, AWEP_ERR_CHARACTER, 'R', 0, 0, 0, 0},
+    {"R12AB 5",          WHOLE, AWEP_ERR_CHARACTER, 'R', 0, 0, 0, 0},
+    {"W12AB05BEE\x80",   WHOLE, AWEP_ERR_CHARACTER, 'W', 0, 0, 0, 0},
+    {"C12AB050001000Z",  WHOLE, AWEP_ERR_CHARACTER, 'C', 0, 0, 0, 0},
+};
+
+static const testBinary_t testBinaries[] = {
+    {{0x04, 'R', 0x12, 0xAB, 0x05}, 5u, AWEP_OK, 'R', 0x12AB, 0x05, 0, 0},
+    {{0x04, 'R', 0xFF, 0xFF, 0xFF}, 5u, AWEP_OK, 'R', 0xFFFF, 0xFF, 0, 0},
+    {{0x06, 'W', 0x12, 0xAB, 0x05, 0xBE, 0xEF}, 7u, AWEP_OK, 'W', 0x12AB, 0x05, 0xBEEF, 0},
+    {{0x06, 'I', 0x00, 0x01, 0x02, 0xFF, 0xFF}, 7u, AWEP_OK, 'I', 0x0001, 0x02, 0xFFFF, 0},
+    {{0x03, 'S', 0x12, 0x34}, 4u, AWEP_OK, 'S', 0x1234, AWEP_ALL_REGS, 0, 0},
+    {{0x04, 'S', 0x12, 0x34, 0x56}, 5u, AWEP_OK, 'S', 0x1234, 0x56, 0, 0},
+    {{0x03, 'U', 0x12, 0x34}, 4u, AWEP_OK, 'U', 0x1234, AWEP_ALL_REGS, 0, 0},
+    {{0x03, 'G', 0x12, 0x34}, 4u, AWEP_OK, 'G', 0x1234, 0x00, 0xFF, 0},
+    {{0x05, 'G', 0x12, 0x34, 0x10, 0x20}, 6u, AWEP_OK, 'G', 0x1234, 0x10, 0x20, 0},
+    {{0x09, 'C', 0x12, 0xAB, 0x05, 0x00, 0x01, 0x00, 0x02}, 10u, AWEP_OK, 'C', 0x12AB, 0x05, 0x0002, 0x0001},
+    {{0x01, 'T'}, 2u, AWEP_OK, 'T', 0, 0, 0, 0},
+    // the length byte has to match the frame, and no frame is shorter than a T
+    {{0x00}, 1u, AWEP_ERR_LENGTH, '\0', 0, 0, 0, 0},
+    {{0x1E}, 1u, AWEP_ERR_LENGTH, '\0', 0, 0, 0, 0},
+    {{0x04, 'R', 0x12, 0xAB}, 4u, AWEP_ERR_LENGTH, 'R', 0, 0, 0, 0},
+    {{0x02, 'R', 0x12}, 3u, AWEP_ERR_LENGTH, 'R', 0, 0, 0, 0},
+    // a command at a length it does not take
+    {{0x01, 'R'}, 2u, AWEP_ERR_COMMAND, 'R', 0, 0, 0, 0},
+    {{0x04, 'W', 0x12, 0xAB, 0x05}, 5u, AWEP_ERR_COMMAND, 'W', 0, 0, 0, 0},
+    {{0x06, 'R', 0x12, 0xAB, 0x05, 0xBE, 0xEF}, 7u, AWEP_ERR_COMMAND, 'R', 0, 0, 0, 0},
+    {{0x03, 'R', 0x12, 0x34}, 4u, AWEP_ERR_COMMAND, 'R', 0, 0, 0, 0},
+    {{0x04, 'Q', 0x12, 0xAB, 0x05}, 5u, AWEP_ERR_COMMAND, 'Q', 0, 0, 0, 0},
+    {{0x07, 'C', 0x12, 0xAB, 0x05, 0x00, 0x01, 0x00}, 8u, AWEP_ERR_COMMAND, 'C', 0, 0, 0, 0},
+};
+
+// ASCII error replies, by status
+static const char *const testErrors[] = {
+    [AWEP_OK]              = "X",
+    [AWEP_ERR_LENGTH]      = "X illegal length",
+    [AWEP_ERR_COMMAND]     = "X illegal command",
+    [AWEP_ERR_CHARACTER]   = "X illegal character",
+    [AWEP_ERR_NOT_FOUND]   = "X Not Found",
+    [AWEP_ERR_FULL]        = "X Database Full 400",
+    [AWEP_ERR_WATCH_LIMIT] = "X Too Many Watches",
+    [AWEP_ERR_MISMATCH]    = "X Mismatch 0190",
+    [AWEP_ERR_READ_ONLY]   = "X Read Only",
+    [AWEP_ERR_THROTTLED]   = "X Throttled",
+    [AWEP_ERR_BUSY]        = "X Server Busy",
+};
+
+static unsigned testFailures;
+static unsigned testChecks;
+
+// testCheck:
+// Count a check and print the case that failed it
+static void testCheck(int passed, const char *what, const char *name){
+    testChecks++;
+    if(!passed){
+        testFailures++;
+        printf("FAIL %s: %s\n", what, name);
+    }
+}
+
+static void testRequest(const awep_request_t *request, char command, uint32_t deviceId,
+                        uint32_t regId, uint32_t value, uint32_t expected, const char *name){
+    testCheck(request->command == command, "command", name);
+    testCheck(request->deviceId == deviceId, "deviceId", name);
+    testCheck(request->regId == regId, "regId", name);
+    testCheck(request->value == value, "value", name);
+    testCheck(request->expected == expected, "expected", name);
+}
+
+static void testDecode(void){
+    for(size_t i = 0; i < sizeof(testDecodes) / sizeof(testDecodes[0]); i++){
+        const testDecode_t *test = &testDecodes[i];
+        uint32_t size = (test->size == WHOLE) ? (uint32_t)strlen(test->frame) + 1u : test->size;
+        awep_request_t request;
+        awep_status_t status = awep_decode(test->frame, size, &request);
+        testCheck(status == test->status, "decode status", test->frame);
+        if(status == AWEP_OK){
+            testRequest(&request, test->command, test->deviceId, test->regId,
+                        test->value, test->expected, test->frame);
+        }
+        else{
+            testCheck(request.command == test->command, "command", test->frame);
+        }
+    }
+}
+
+static void testDecodeBinary(void){
+    for(size_t i = 0; i < sizeof(testBinaries) / sizeof(testBinaries[0]); i++){
+        const testBinary_t *test = &testBinaries[i];
+        char name[64];
+        snprintf(name, sizeof(name), "binary %02X '%c' of %u bytes",
+                 test->frame[0], (test->size > 1u) ? test->frame[1] : ' ', (unsigned)test->size);
+        awep_request_t request;
+        awep_status_t status = awep_decode_binary(test->frame, test->size, &request);
+        testCheck(status == test->status, "decode status", name);
+        testCheck(request.length == test->size, "length", name);
+        if(status == AWEP_OK){
+            testRequest(&request, test->command, test->deviceId, test->regId,
+                        test->value, test->expected, name);
+        }
+    }
+}
+
+// testIsBinary:
+// Every possible first byte, the binary ones are the lengths 1 to
+// AWEP_BINARY_MAX_LEN but for CR and LF
+static void testIsBinary(void){
+    for(uint32_t c = 0; c < 256u; c++){
+        bool binary = (c >= 1u && c <= AWEP_BINARY_MAX_LEN && c != '\r' && c != '\n');
+        char name[16];
+        snprintf(name, sizeof(name), "byte %02X", (unsigned)c);
+        testCheck(awep_is_binary((char)c) == binary, "is binary", name);
+    }
+}
+
+static void testEncode(void){
+    char buffer[AWEP_REPLY_MAX];
+    uint8_t binary[AWEP_REPLY_MAX];
+
+    for(uint32_t status = AWEP_OK; status <= AWEP_ERR_BUSY; status++){
+        uint32_t value = (status == AWEP_ERR_FULL) ? 400u : 0x190u;
+        const char *reply = testErrors[status];
+        uint32_t length = awep_encode_error(buffer, sizeof(buffer), (awep_status_t)status, value);
+        testCheck(length == strlen(reply) && strcmp(buffer, reply) == 0, "error reply", reply);
+
+        // the binary reply carries a value only for OK, FULL and MISMATCH
+        bool valued = (status == AWEP_OK || status == AWEP_ERR_FULL || status == AWEP_ERR_MISMATCH);
+        length = awep_encode_binary_reply(binary, sizeof(binary), (awep_status_t)status, value);
+        testCheck(length == (valued ? 4u : 2u) && binary[0] == length - 1u && binary[1] == status &&
+                  (!valued || (binary[2] == (uint8_t)(value >> 8) && binary[3] == (uint8_t)value)),
+                  "binary reply", reply);
+        // and never past the buffer
+        testCheck(awep_encode_binary_reply(binary, valued ? 3u : 1u, (awep_status_t)status, value) == 0,
+                  "binary reply too small", reply);
+    }
+    // the longest reply fits AWEP_REPLY_MAX with its NUL
+    testCheck(awep_encode_error(buffer, sizeof(buffer), AWEP_ERR_FULL, 65535u) + 1u == AWEP_REPLY_MAX &&
+              strcmp(buffer, "X Database Full 65535") == 0, "error reply", "X Database Full 65535");
+
+    testCheck(awep_encode_ack(buffer, sizeof(buffer), 0x12AB, 0x05, 0xBEEF) == 11u &&
+              strcmp(buffer, "A12AB05BEEF") == 0, "ack", "A12AB05BEEF");
+    testCheck(awep_encode_ack(buffer, sizeof(buffer), 0, 0, 0) == 11u &&
+              strcmp(buffer, "A0000000000") == 0, "ack", "A0000000000");
+    testCheck(awep_encode_notify(buffer, sizeof(buffer), 0xFFFF, 0xFF, 0xFFFF) == 11u &&
+              strcmp(buffer, "NFFFFFFFFFF") == 0, "notify", "NFFFFFFFFFF");
+    testCheck(awep_encode_watch_ack(buffer, sizeof(buffer), 0x1234, AWEP_ALL_REGS) == 5u &&
+              strcmp(buffer, "A1234") == 0, "watch ack", "A1234");
+    testCheck(awep_encode_watch_ack(buffer, sizeof(buffer), 0x1234, 0x56) == 7u &&
+              strcmp(buffer, "A123456") == 0, "watch ack", "A123456");
+    testCheck(awep_encode_range_end(buffer, sizeof(buffer), 0x1234, 0x100) == 9u &&
+              strcmp(buffer, "E12340100") == 0, "range end", "E12340100");
+    testCheck(awep_encode_stat(buffer, sizeof(buffer), 0x1F, 0xDEADBEEF) == 11u &&
+              strcmp(buffer, "T1FDEADBEEF") == 0, "stat", "T1FDEADBEEF");
+
+    // a buffer too small is cut short but always NUL terminated
+    testCheck(awep_encode_ack(buffer, 6u, 0x12AB, 0x05, 0xBEEF) == 5u &&
+              strcmp(buffer, "A12AB") == 0, "ack cut short", "A12AB");
+    testCheck(awep_encode_error(buffer, 3u, AWEP_ERR_NOT_FOUND, 0) == 2u &&
+              strcmp(buffer, "X ") == 0, "error cut short", "X ");
+    testCheck(awep_encode_ack(buffer, 0u, 0x12AB, 0x05, 0xBEEF) == 0u, "ack into nothing", "size 0");
+
+    static const uint8_t notify[] = {0x06, 'N', 0x12, 0xAB, 0x05, 0xBE, 0xEF};
+    testCheck(awep_encode_binary_notify(binary, sizeof(binary), 0x12AB, 0x05, 0xBEEF) == sizeof(notify) &&
+              memcmp(binary, notify, sizeof(notify)) == 0, "binary notify", "06 N");
+    testCheck(awep_encode_binary_notify(binary, sizeof(notify) - 1u, 0x12AB, 0x05, 0xBEEF) == 0,
+              "binary notify too small", "06 N");
+    static const uint8_t record[] = {0x04, 'A', 0x05, 0xBE, 0xEF};
+    testCheck(awep_encode_binary_record(binary, sizeof(binary), 0x05, 0xBEEF) == sizeof(record) &&
+              memcmp(binary, record, sizeof(record)) == 0, "binary record", "04 A");
+    testCheck(awep_encode_binary_record(binary, sizeof(record) - 1u, 0x05, 0xBEEF) == 0,
+              "binary record too small", "04 A");
+    static const uint8_t stat[] = {0x06, 'T', 0x1F, 0xDE, 0xAD, 0xBE, 0xEF};
+    testCheck(awep_encode_binary_stat(binary, sizeof(binary), 0x1F, 0xDEADBEEF) == sizeof(stat) &&
+              memcmp(binary, stat, sizeof(stat)) == 0, "binary stat", "06 T");
+    testCheck(awep_encode_binary_stat(binary, sizeof(stat) - 1u, 0x1F, 0xDEADBEEF) == 0,
+              "binary stat too small", "06 T");
+}
+
+int main(void){
+    testDecode();
+    testDecodeBinary();
+    testIsBinary();
+    testEncode();
+    printf("%u checks, %u failed\n", testChecks, testFailures);
+    return (testFailures == 0) ? 0 : 1;
+}
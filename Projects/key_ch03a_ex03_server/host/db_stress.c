@@ -0,0 +1,118 @@
+//stress test of the register database shared between threads: writers keep
+//replacing registers while readers look them up without a lock. Every value
+//carries a checksum of its key, so a torn or wrong read is caught. Built with
+//CLOCK eviction and more keys than entries, so writes also evict and move
+//probe runs under the readers.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "database.h"
+
+// registers written, twice what the database holds
+#define STRESS_KEYS    (2u * DB_MAX_ENTRIES)
+#define STRESS_THREADS (16)
+
+typedef struct {
+    unsigned seed;
+    bool writer;
+    uint64_t operations;
+    uint64_t bad;
+} stressThread_t;
+
+static volatile bool stressRunning;
+// the one lock every access takes in the comparison runs, NULL for none
+static pthread_mutex_t *stressLock;
+static pthread_mutex_t stressGlobalLock = PTHREAD_MUTEX_INITIALIZER;
+
+// stressKey:
+// The i-th register, spread over deviceIds and regIds
+static dbEntry_t stressKey(uint32_t i){
+    dbEntry_t entry = {0x1000u + i / 64u, (i * 37u) & 0xFFu, 0};
+    return entry;
+}
+
+// stressCheck:
+// Low byte of every value stored for a register
+static uint32_t stressCheck(const dbEntry_t *entry){
+    return (((entry->deviceId << 8) | entry->regId) * 2654435761u) >> 24;
+}
+
+static void *stressRun(void *argument){
+    stressThread_t *thread = argument;
+    uint32_t serial = 0;
+    while(stressRunning){
+        dbEntry_t entry = stressKey((uint32_t)rand_r(&thread->seed) % STRESS_KEYS);
+        if(stressLock != NULL){
+            pthread_mutex_lock(stressLock);
+        }
+        if(thread->writer){
+            entry.value = ((serial++ & 0xFFu) << 8) | stressCheck(&entry);
+            dbSetValue(&entry);
+        }
+        else if(dbFind(&entry) != NULL && (entry.value & 0xFFu) != stressCheck(&entry)){
+            thread->bad++;
+        }
+        if(stressLock != NULL){
+            pthread_mutex_unlock(stressLock);
+        }
+        thread->operations++;
+    }
+    return NULL;
+}
+
+// stressCase:
+// Run writers and readers for seconds, print the reads a second and what went
+// wrong. Returns the bad reads
+static uint64_t stressCase(const char *title, uint32_t writers, uint32_t readers, bool locked, double seconds){
+    pthread_t threads[STRESS_THREADS];
+    stressThread_t state[STRESS_THREADS] = {0};
+    uint32_t count = writers + readers;
+    uint32_t retries = dbGetReadRetries();
+    uint32_t evictions = dbGetEvictions();
+
+    stressLock = locked ? &stressGlobalLock : NULL;
+    stressRunning = true;
+    for(uint32_t i = 0; i < count; i++){
+        state[i].seed = i + 1u;
+        state[i].writer = (i < writers);
+        pthread_create(&threads[i], NULL, stressRun, &state[i]);
+    }
+    struct timespec wait = {(time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9)};
+    nanosleep(&wait, NULL);
+    stressRunning = false;
+
+    uint64_t reads = 0, writes = 0, bad = 0;
+    for(uint32_t i = 0; i < count; i++){
+        pthread_join(threads[i], NULL);
+        *(state[i].writer ? &writes : &reads) += state[i].operations;
+        bad += state[i].bad;
+    }
+    printf("  %-28s %6.1fM reads/s %6.2fM writes/s %8u evictions %6u retries %4llu bad\n", title,
+           reads / seconds / 1e6, writes / seconds / 1e6, (unsigned)(dbGetEvictions() - evictions),
+           (unsigned)(dbGetReadRetries() - retries), (unsigned long long)bad);
+    return bad;
+}
+
+int main(int argc, char *argv[]){
+    double seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+    uint64_t bad = 0;
+
+    dbInit();
+    for(uint32_t i = 0; i < STRESS_KEYS; i++){
+        dbEntry_t entry = stressKey(i);
+        entry.value = stressCheck(&entry);
+        dbSetValue(&entry);
+    }
+    printf("%u registers over %u entries, %.1f s a case\n", (unsigned)STRESS_KEYS, (unsigned)dbGetMax(), seconds);
+    bad += stressCase("2 writers, 6 readers", 2, 6, false, seconds);
+    bad += stressCase("2 writers, 6 readers, 1 lock", 2, 6, true, seconds);
+    bad += stressCase("4 readers", 0, 4, false, seconds);
+    bad += stressCase("4 readers, 1 lock", 0, 4, true, seconds);
+    for(uint32_t run = 1; run <= 5; run++){
+        char title[32];
+        snprintf(title, sizeof(title), "2 writers, 6 readers, run %u", (unsigned)run);
+        bad += stressCase(title, 2, 6, false, seconds);
+    }
+    return (bad == 0) ? 0 : 1;
+}
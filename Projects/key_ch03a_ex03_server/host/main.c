@@ -0,0 +1,425 @@
+//AWEP server on BSD sockets and pthreads, to measure and profile the request
+//handling of the board without a board. Same protocol, same port
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include "tcp_server.h"
+#include "awep.h"
+#include "awep_conn.h"
+#include "awep_server.h"
+#include "awep_idle.h"
+#include "awep_limit.h"
+#include "awep_persist.h"
+#include "awep_repl.h"
+#include "storage.h"
+
+// Register storage directory unless one is given after the port
+#define HOST_STORE_DIRECTORY "awep_store"
+
+// Listening socket, UDP socket and one per client
+#define HOST_MAX_SOCKETS (AWEP_MAX_CONNECTIONS + 2u)
+
+// Set by SIGUSR1, the host's user button, SIGUSR2 and SIGINT
+static volatile sig_atomic_t hostPrintStats;
+static volatile sig_atomic_t hostPromote;
+static volatile sig_atomic_t hostStop;
+
+// Replication listener of a primary, on the AWEP port + 1, and the primary a
+// standby follows
+static int hostReplListener = -1;
+static const char *hostPrimaryHost;
+static const char *hostPrimaryPort;
+
+// hostSocket:
+// Client sockets are kept in the connection table as fd + 1, a NULL socket
+// marks a free entry and 0 is a valid fd
+static void *hostSocket(int fd){
+    return (void *)(intptr_t)(fd + 1);
+}
+
+static int hostFd(void *socket){
+    return (int)(intptr_t)socket - 1;
+}
+
+static void hostSignal(int signal){
+    if(signal == SIGUSR1){
+        hostPrintStats = 1;
+    }
+    else if(signal == SIGUSR2){
+        hostPromote = 1;
+    }
+    else{
+        hostStop = 1;
+    }
+}
+
+bool awep_port_send(void *socket, const char *data, uint32_t length){
+    int fd = hostFd(socket);
+    while(length > 0){
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if(sent < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            printf("send failed: %s\n", strerror(errno));
+            return false;
+        }
+        data += sent;
+        length -= (uint32_t)sent;
+    }
+    return true;
+}
+
+// awep_port_timer:
+// Nanoseconds, wrapping every 4.3 seconds, far longer than any command
+uint32_t awep_port_timer(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec);
+}
+
+uint32_t awep_port_timer_micros(uint32_t span){
+    return span / 1000u;
+}
+
+// awep_port_close:
+// From whichever thread released the last hold on a closed client, the main
+// thread or a worker
+void awep_port_close(void *socket){
+    close(hostFd(socket));
+}
+
+// hostLimit:
+// A rate limit from the environment as <rate>/<burst> commands, the burst
+// defaulting to a tenth of a second's worth. Left alone when the variable is
+// not set, an unset limit is off on the host
+static void hostLimit(const char *name, uint32_t *rate, uint32_t *burst){
+    const char *text = getenv(name);
+    char *end;
+    if(text == NULL){
+        return;
+    }
+    *rate = (uint32_t)strtoul(text, &end, 10);
+    *burst = (*end == '/') ? (uint32_t)strtoul(end + 1, NULL, 10) : *rate / 10u;
+}
+
+// hostListen:
+// Listening socket on every address, -1 on failure
+static int hostListen(uint16_t port){
+    struct sockaddr_in address;
+    int reuse = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0){
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if(bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+       listen(fd, TCP_SERVER_MAX_PENDING_CONNECTIONS) != 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// awep_port_repl_accept:
+// The replication task blocks here until a standby connects
+void *awep_port_repl_accept(void){
+    int noDelay = 1;
+    int fd = accept(hostReplListener, NULL, NULL);
+    if(fd < 0){
+        if(errno != EINTR){
+            printf("Failed to accept a standby: %s\n", strerror(errno));
+            vTaskDelay(AWEP_IDLE_SLOT_TICKS);
+        }
+        return NULL;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return hostSocket(fd);
+}
+
+void *awep_port_repl_connect(void){
+    struct addrinfo hints;
+    struct addrinfo *found;
+    int noDelay = 1;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(hostPrimaryHost, hostPrimaryPort, &hints, &found) != 0){
+        return NULL;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd >= 0 && connect(fd, found->ai_addr, found->ai_addrlen) != 0){
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(found);
+    if(fd < 0){
+        return NULL;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return hostSocket(fd);
+}
+
+int32_t awep_port_repl_receive(void *socket, char *data, uint32_t length, uint32_t ticks){
+    struct pollfd fd = {.fd = hostFd(socket), .events = POLLIN};
+    int ready = poll(&fd, 1, (int)ticks);
+    if(ready <= 0){
+        return (ready < 0 && errno != EINTR) ? -1 : 0;
+    }
+    ssize_t received = recv(fd.fd, data, length, 0);
+    if(received < 0 && errno == EINTR){
+        return 0;
+    }
+    return (received > 0) ? (int32_t)received : -1;
+}
+
+// hostBindUdp:
+// UDP socket on the same port number as the listener, -1 on failure
+static int hostBindUdp(uint16_t port){
+    struct sockaddr_in address;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd < 0){
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if(bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// hostDatagram:
+// Answer one UDP request. The buffer holds a byte more than the longest
+// datagram so a longer one still shows up as too long
+static void hostDatagram(int fd){
+    char datagram[AWEP_UDP_DATAGRAM_MAX + 1];
+    char reply[AWEP_UDP_REPLY_MAX];
+    struct sockaddr_in peer;
+    socklen_t peerLength = sizeof(peer);
+    ssize_t received = recvfrom(fd, datagram, sizeof(datagram), MSG_TRUNC,
+                                (struct sockaddr *)&peer, &peerLength);
+    if(received < 0){
+        if(errno != EINTR){
+            printf("recvfrom failed: %s\n", strerror(errno));
+        }
+        return;
+    }
+    uint32_t length = awep_server_datagram(peer.sin_addr.s_addr, ntohs(peer.sin_port),
+                                           datagram, (uint32_t)received, reply);
+    if(length != 0 &&
+       sendto(fd, reply, length, 0, (struct sockaddr *)&peer, peerLength) < 0){
+        printf("sendto failed: %s\n", strerror(errno));
+    }
+}
+
+// hostAccept:
+// Take a new client, or turn it away when the connection table is full
+static void hostAccept(int listener){
+    struct sockaddr_in peer;
+    socklen_t peerLength = sizeof(peer);
+    int noDelay = 1;
+    int fd = accept(listener, (struct sockaddr *)&peer, &peerLength);
+    if(fd < 0){
+        printf("Failed to accept incoming client connection: %s\n", strerror(errno));
+        return;
+    }
+    // the board's lwIP sends each reply batch straight away too
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    // s_addr is in network order, the same layout as the lwIP address
+    if(awep_server_accept(hostSocket(fd), peer.sin_addr.s_addr) != NULL){
+        printf("Incoming TCP connection accepted, %d of %d clients\n",
+                (int)awep_conn_count(), (int)AWEP_MAX_CONNECTIONS);
+    }
+    else{
+        printf("Connection table full, turned the new connection away\n");
+        close(fd);
+    }
+}
+
+// hostReceive:
+// Read what a client sent into its framer, or close it once it has gone. Its
+// socket is closed with the last hold on it
+static void hostReceive(awep_conn_t *conn){
+    char *space;
+    int fd = hostFd(conn->socket);
+    uint32_t spaceLength = awep_framer_space(&conn->framer, &space);
+    ssize_t received = recv(fd, space, spaceLength, 0);
+    if(received > 0){
+        awep_server_receive(conn, (uint32_t)received);
+        return;
+    }
+    if(received < 0 && errno == EINTR){
+        return;
+    }
+    awep_server_close(conn);
+    printf("TCP Client disconnected!\n");
+}
+
+int main(int argc, char *argv[]){
+    struct pollfd fds[HOST_MAX_SOCKETS];
+    awep_conn_t *conns[HOST_MAX_SOCKETS];
+    uint16_t port = (argc > 1) ? (uint16_t)atoi(argv[1]) : TCP_SERVER_PORT;
+    const char *store = (argc > 2) ? argv[2] : HOST_STORE_DIRECTORY;
+    bool standby = (argc > 3);
+    struct sigaction action;
+    sigset_t signals;
+
+    // the workers print too, keep whole lines together when redirected
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = hostSignal;
+    sigaction(SIGUSR1, &action, NULL);
+    sigaction(SIGUSR2, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // the workers start with the signals blocked, so they always interrupt the poll
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    uint32_t clientRate = AWEP_LIMIT_CLIENT_RATE, clientBurst = AWEP_LIMIT_CLIENT_BURST;
+    uint32_t globalRate = AWEP_LIMIT_GLOBAL_RATE, globalBurst = AWEP_LIMIT_GLOBAL_BURST;
+    hostLimit("AWEP_CLIENT_LIMIT", &clientRate, &clientBurst);
+    hostLimit("AWEP_GLOBAL_LIMIT", &globalRate, &globalBurst);
+    awep_limit_set(clientRate, clientBurst, globalRate, globalBurst);
+    // without it the server still runs, from RAM only like a board with no flash
+    host_storage_open(store);
+    bool started = awep_server_start();
+    if(started && standby){
+        // host:port of the primary's replication listener
+        static char primary[256];
+        snprintf(primary, sizeof(primary), "%s", argv[3]);
+        char *colon = strrchr(primary, ':');
+        if(colon == NULL){
+            printf("The primary is given as host:port\n");
+            return EXIT_FAILURE;
+        }
+        *colon = '\0';
+        hostPrimaryHost = primary;
+        hostPrimaryPort = colon + 1;
+    }
+    // a standby listens too, for when it is promoted
+    hostReplListener = hostListen((uint16_t)(port + 1u));
+    if(hostReplListener < 0){
+        printf("Failed to listen for a standby on port %d: %s\n", (int)port + 1, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    started = started && awep_repl_start(standby);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+    if(!started){
+        return EXIT_FAILURE;
+    }
+    int listener = hostListen(port);
+    if(listener < 0){
+        printf("Failed to listen on port %d: %s\n", (int)port, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    int udp = hostBindUdp(port);
+    if(udp < 0){
+        printf("Failed to bind UDP port %d: %s\n", (int)port, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    printf("===============================================================\n");
+    printf("Listening for incoming TCP client connection on Port: %d\n", (int)port);
+    printf("Answering AWEP datagrams on UDP Port: %d\n", (int)port);
+    printf("Replication on TCP Port: %d\n", (int)port + 1);
+    printf("kill -USR1 %d dumps the statistics", (int)getpid());
+    printf(standby ? ", kill -USR2 %d promotes it\n\n" : "\n\n", (int)getpid());
+
+    while(!hostStop){
+        nfds_t count = 0;
+        fds[count].fd = listener;
+        fds[count].events = POLLIN;
+        conns[count++] = NULL;
+        fds[count].fd = udp;
+        fds[count].events = POLLIN;
+        conns[count++] = NULL;
+        // wake for the next slot of the idle timer wheel at the latest
+        uint32_t timeout = AWEP_IDLE_SLOT_TICKS;
+        // each client polled is held until its events are handled
+        for(uint32_t i = 0; i < AWEP_MAX_CONNECTIONS; i++){
+            awep_conn_t *conn = awep_conn_get_at(i);
+            if(conn != NULL){
+                // a client over its rate limit is not read until it has a token again
+                uint32_t wait = awep_server_hold(conn);
+                if(wait != 0 && wait < timeout){
+                    timeout = wait;
+                }
+                fds[count].fd = hostFd(conn->socket);
+                fds[count].events = (wait == 0) ? POLLIN : 0;
+                conns[count++] = conn;
+            }
+        }
+
+        if(poll(fds, count, (int)timeout) < 0){
+            if(errno != EINTR){
+                printf("poll failed: %s\n", strerror(errno));
+                break;
+            }
+        }
+        else{
+            for(nfds_t i = 0; i < count; i++){
+                if(fds[i].revents == 0){
+                    continue;
+                }
+                if(fds[i].fd == listener){
+                    hostAccept(listener);
+                }
+                else if(fds[i].fd == udp){
+                    hostDatagram(udp);
+                }
+                else{
+                    hostReceive(conns[i]);
+                }
+            }
+        }
+        for(nfds_t i = 0; i < count; i++){
+            if(conns[i] != NULL){
+                awep_server_release(conns[i]);
+            }
+        }
+
+        if(hostPrintStats){
+            hostPrintStats = 0;
+            awep_server_print_stats();
+        }
+        if(hostPromote){
+            hostPromote = 0;
+            awep_repl_promote();
+        }
+        awep_server_reap();
+        awep_persist_service();
+    }
+
+    // keep the writes of the last slot
+    awep_persist_service();
+    awep_server_print_stats();
+    close(udp);
+    close(listener);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,21 @@
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+// The part of the FreeRTOS API the AWEP server uses, on pthreads. Ticks are
+// milliseconds, the board runs configTICK_RATE_HZ at 1000 too
+
+#include <stdint.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE         ((BaseType_t)0)
+#define pdTRUE          ((BaseType_t)1)
+#define pdPASS          (pdTRUE)
+#define pdFAIL          (pdFALSE)
+#define portMAX_DELAY   ((TickType_t)0xFFFFFFFFu)
+#define configTICK_RATE_HZ  (1000u)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif
@@ -0,0 +1,247 @@
+//FreeRTOS tasks, notifications, queues and mutexes for the host build, on pthreads
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
+struct hostQueue {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    char *items;
+    uint32_t itemSize;
+    uint32_t length;
+    uint32_t head;
+    uint32_t count;
+};
+
+// Byte a task's stack is filled with before it starts, as FreeRTOS does with
+// configCHECK_FOR_STACK_OVERFLOW, so the part it never reached can be found
+#define HOST_STACK_FILL (0xA5u)
+
+// A task's thread gets HOST_STACK_SCALE times the bytes the board would give it,
+// words of 4 bytes, and never less than HOST_STACK_MIN. Frames are bigger on
+// the host, so its high water marks are an upper bound for the board's
+#define HOST_STACK_SCALE (4u)
+#define HOST_STACK_MIN   (256u * 1024u)
+
+// A task lives as long as the process, its handle is this
+typedef struct {
+    TaskFunction_t code;
+    void *parameters;
+    pthread_mutex_t mutex;
+    pthread_cond_t notified;
+    uint32_t notifications;
+    uint32_t stackDepth;        // words the board would give the task
+    uint8_t *stack;
+    uint8_t *stackTop;          // where the task function's stack starts
+} hostTask_t;
+
+static __thread hostTask_t *hostCurrentTask;
+
+static void *hostTaskRun(void *arg){
+    hostTask_t *task = arg;
+    uint8_t top;
+    hostCurrentTask = task;
+    __atomic_store_n(&task->stackTop, &top, __ATOMIC_RELEASE);
+    task->code(task->parameters);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *created){
+    pthread_t thread;
+    hostTask_t *task = malloc(sizeof(*task));
+    if(task == NULL){
+        return pdFAIL;
+    }
+    task->code = code;
+    task->parameters = parameters;
+    pthread_mutex_init(&task->mutex, NULL);
+    pthread_cond_init(&task->notified, NULL);
+    task->notifications = 0;
+    task->stackDepth = stackDepth;
+    task->stackTop = NULL;
+
+    pthread_attr_t attributes;
+    size_t size = stackDepth * 4u * HOST_STACK_SCALE;
+    if(size < HOST_STACK_MIN){
+        size = HOST_STACK_MIN;
+    }
+    task->stack = malloc(size);
+    if(task->stack == NULL){
+        free(task);
+        return pdFAIL;
+    }
+    memset(task->stack, HOST_STACK_FILL, size);
+    pthread_attr_init(&attributes);
+    pthread_attr_setstack(&attributes, task->stack, size);
+    if(pthread_create(&thread, &attributes, hostTaskRun, task) != 0){
+        pthread_attr_destroy(&attributes);
+        free(task->stack);
+        free(task);
+        return pdFAIL;
+    }
+    pthread_attr_destroy(&attributes);
+    pthread_detach(thread);
+    if(created != NULL){
+        *created = task;
+    }
+    return pdPASS;
+}
+
+// uxTaskGetStackHighWaterMark:
+// Words of 4 bytes, as on the board, of the stack the task has never used
+// below its depth. The bytes under the task function that still hold the fill
+// were never reached
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t handle){
+    hostTask_t *task = (handle != NULL) ? handle : hostCurrentTask;
+    uint8_t *top = __atomic_load_n(&task->stackTop, __ATOMIC_ACQUIRE);
+    if(top == NULL){
+        return task->stackDepth;
+    }
+    uint8_t *lowest = task->stack;
+    while(lowest < top && *lowest == HOST_STACK_FILL){
+        lowest++;
+    }
+    uint32_t used = (uint32_t)((top - lowest + 3) / 4);
+    return (used < task->stackDepth) ? task->stackDepth - used : 0;
+}
+
+TickType_t xTaskGetTickCount(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t)((uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u);
+}
+
+void vTaskDelay(TickType_t ticks){
+    struct timespec delay = {.tv_sec = ticks / 1000u, .tv_nsec = (long)(ticks % 1000u) * 1000000L};
+    nanosleep(&delay, NULL);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle){
+    hostTask_t *task = handle;
+    pthread_mutex_lock(&task->mutex);
+    task->notifications++;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->mutex);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t wait){
+    hostTask_t *task = hostCurrentTask;
+    struct timespec until;
+    uint32_t taken;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += wait / 1000u;
+    until.tv_nsec += (long)(wait % 1000u) * 1000000L;
+    if(until.tv_nsec >= 1000000000L){
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&task->mutex);
+    while(task->notifications == 0 && wait != 0){
+        if(wait == portMAX_DELAY){
+            pthread_cond_wait(&task->notified, &task->mutex);
+        }
+        else if(pthread_cond_timedwait(&task->notified, &task->mutex, &until) != 0){
+            break;
+        }
+    }
+    taken = task->notifications;
+    if(taken != 0){
+        task->notifications = clearOnExit ? 0 : taken - 1u;
+    }
+    pthread_mutex_unlock(&task->mutex);
+    return taken;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize){
+    struct hostQueue *queue = calloc(1, sizeof(*queue));
+    if(queue == NULL){
+        return NULL;
+    }
+    queue->items = malloc(length * itemSize);
+    if(queue->items == NULL){
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->itemSize = (uint32_t)itemSize;
+    queue->length = (uint32_t)length;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait){
+    pthread_mutex_lock(&queue->mutex);
+    while(queue->count == queue->length){
+        if(wait == 0){
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+    }
+    uint32_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(&queue->items[tail * queue->itemSize], item, queue->itemSize);
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+// hostQueueTake:
+// Copy out the oldest item, removing it unless peeking
+static BaseType_t hostQueueTake(QueueHandle_t queue, void *item, TickType_t wait, bool remove){
+    pthread_mutex_lock(&queue->mutex);
+    while(queue->count == 0){
+        if(wait == 0){
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+    }
+    memcpy(item, &queue->items[queue->head * queue->itemSize], queue->itemSize);
+    if(remove){
+        queue->head = (queue->head + 1u) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait){
+    return hostQueueTake(queue, item, wait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait){
+    return hostQueueTake(queue, item, wait, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue){
+    pthread_mutex_lock(&queue->mutex);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer){
+    pthread_mutex_init(&buffer->mutex, NULL);
+    return buffer;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait){
+    pthread_mutex_lock(&semaphore->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore){
+    pthread_mutex_unlock(&semaphore->mutex);
+    return pdTRUE;
+}
@@ -0,0 +1,23 @@
+#ifndef HOST_TASK_H_
+#define HOST_TASK_H_
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+//start a detached thread on a stack filled so its use can be measured, the
+//priority is ignored
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *created);
+//4 byte words of the stack depth the task has never used, NULL for the caller
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+//milliseconds since the first call
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+//task notifications used as a counting semaphore, ulTaskNotifyTake only from a
+//thread started by xTaskCreate
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t wait);
+
+#endif
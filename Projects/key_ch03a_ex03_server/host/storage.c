@@ -0,0 +1,72 @@
+//register storage of the host build, one file per region. The sizes are far
+//above the board's flash so a 10000 register database can be restored too
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "awep_persist.h"
+#include "storage.h"
+
+#ifndef HOST_STORAGE_SNAPSHOT_SIZE
+#define HOST_STORAGE_SNAPSHOT_SIZE  (256u * 1024u)
+#endif
+#ifndef HOST_STORAGE_LOG_SIZE
+#define HOST_STORAGE_LOG_SIZE       (1024u * 1024u)
+#endif
+
+static const char *const hostRegionNames[AWEP_REGION_COUNT] = {
+    [AWEP_REGION_SNAPSHOT_0] = "snapshot0",
+    [AWEP_REGION_SNAPSHOT_1] = "snapshot1",
+    [AWEP_REGION_LOG_0]      = "log0",
+    [AWEP_REGION_LOG_1]      = "log1",
+};
+
+static int hostRegionFds[AWEP_REGION_COUNT] = {-1, -1, -1, -1};
+
+bool host_storage_open(const char *directory){
+    char path[256];
+    if(mkdir(directory, 0777) != 0 && errno != EEXIST){
+        printf("Cannot create %s: %s\n", directory, strerror(errno));
+        return false;
+    }
+    for(uint32_t i = 0; i < AWEP_REGION_COUNT; i++){
+        snprintf(path, sizeof(path), "%s/%s", directory, hostRegionNames[i]);
+        hostRegionFds[i] = open(path, O_RDWR | O_CREAT, 0666);
+        if(hostRegionFds[i] < 0){
+            printf("Cannot open %s: %s\n", path, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t awep_port_storage_size(awep_region_t region){
+    return (region < AWEP_REGION_LOG_0) ? HOST_STORAGE_SNAPSHOT_SIZE : HOST_STORAGE_LOG_SIZE;
+}
+
+// awep_port_storage_read:
+// Past the end of the file reads as zeroes, like erased flash on the board
+bool awep_port_storage_read(awep_region_t region, uint32_t offset, void *data, uint32_t length){
+    if(hostRegionFds[region] < 0 || offset + length > awep_port_storage_size(region)){
+        return false;
+    }
+    ssize_t got = pread(hostRegionFds[region], data, length, offset);
+    if(got < 0){
+        return false;
+    }
+    memset((char *)data + got, 0, length - (uint32_t)got);
+    return true;
+}
+
+bool awep_port_storage_write(awep_region_t region, uint32_t offset, const void *data, uint32_t length){
+    if(hostRegionFds[region] < 0 || offset + length > awep_port_storage_size(region)){
+        return false;
+    }
+    return pwrite(hostRegionFds[region], data, length, offset) == (ssize_t)length;
+}
+
+bool awep_port_storage_erase(awep_region_t region){
+    return hostRegionFds[region] >= 0 && ftruncate(hostRegionFds[region], 0) == 0;
+}
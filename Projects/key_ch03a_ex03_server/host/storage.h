@@ -0,0 +1,9 @@
+#ifndef STORAGE_H_
+#define STORAGE_H_
+
+#include <stdbool.h>
+
+//keep the register storage regions as files in directory, created if missing
+bool host_storage_open(const char *directory);
+
+#endif
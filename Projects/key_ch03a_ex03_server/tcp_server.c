@@ -68,8 +68,24 @@
 /* Standard C header files */
 #include <inttypes.h>
 
-/* Linked list */
-#include "linkedList.h"
+/* Table of connected clients */
+#include "awep_conn.h"
+
+/* AWEP request handling */
+#include "awep.h"
+#include "awep_server.h"
+
+/* Idle timer wheel, for the slot length */
+#include "awep_idle.h"
+
+/* Register snapshot and write log in flash */
+#include "awep_persist.h"
+
+/* Replication to a standby */
+#include "awep_repl.h"
+
+/* lwIP configuration, for the TCP connection limit */
+#include "lwipopts.h"
 
 /* mDNS */
 #include "mdns.h"
@@ -77,6 +93,18 @@
 /*******************************************************************************
 * Macros
 ********************************************************************************/
+/* Every client holds a TCP PCB for as long as it is connected, and so does
+ * every connection waiting to be accepted, the one being turned away and the
+ * replication connection. */
+#if (AWEP_MAX_CONNECTIONS + TCP_SERVER_MAX_PENDING_CONNECTIONS + 2 > MEMP_NUM_TCP_PCB)
+#error "AWEP_MAX_CONNECTIONS and the pending connections must fit in MEMP_NUM_TCP_PCB"
+#endif
+
+/* Smallest receive timeout of the replication socket, 0 would wait forever */
+#define REPL_MIN_RECV_TIMEOUT_MS (1u)
+
+/* Interrupt priority of the user button that dumps the statistics */
+#define USER_BTN_INTR_PRIORITY (5)
 
 /*******************************************************************************
 * Function Prototypes
@@ -85,17 +113,22 @@ static cy_rslt_t create_tcp_server_socket(void);
 static cy_rslt_t tcp_connection_handler(cy_socket_t socket_handle, void *arg);
 static cy_rslt_t tcp_receive_msg_handler(cy_socket_t socket_handle, void *arg);
 static cy_rslt_t tcp_disconnection_handler(cy_socket_t socket_handle, void *arg);
+static cy_rslt_t create_udp_server_socket(void);
+static cy_rslt_t udp_receive_msg_handler(cy_socket_t socket_handle, void *arg);
+static void isr_button_press(void *callback_arg, cyhal_gpio_event_t event);
 static cy_rslt_t connect_to_wifi_ap(void);
 
 /*******************************************************************************
 * Global Variables
 ********************************************************************************/
 /* Secure socket variables. */
-cy_socket_sockaddr_t tcp_server_addr, peer_addr;
-cy_socket_t server_handle, client_handle;
+cy_socket_sockaddr_t tcp_server_addr;
+cy_socket_t server_handle;
+cy_socket_t udp_server_handle;
+cy_socket_t repl_server_handle;
 
-/* Size of the peer socket address. */
-uint32_t peer_addr_len;
+/* Task to wake when the user button is pressed, created in main.c */
+extern TaskHandle_t server_task_handle;
 
 /*******************************************************************************
  * Function Name: tcp_server_task
@@ -131,13 +164,39 @@ void tcp_server_task(void *arg)
     }
     printf("Secure Socket initialized\n");
 
+    /* Time each command, and the restore of the registers, with the cycle
+     * counter. */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    /* Start the register database, restore it from flash and start the
+     * workers that run the commands the clients send. */
+    if(!awep_server_start())
+    {
+        CY_ASSERT(0);
+    }
+
+    /* Stream the register writes to a standby, or follow the primary. */
+    if(!awep_repl_start(TCP_SERVER_IS_STANDBY))
+    {
+        CY_ASSERT(0);
+    }
+
+    /* The user button dumps the statistics to the console, or promotes a
+     * standby to primary. */
+    cyhal_gpio_callback_data_t cb_data = {.callback = isr_button_press, .callback_arg = NULL};
+    cyhal_gpio_init(CYBSP_USER_BTN, CYHAL_GPIO_DIR_INPUT, CYHAL_GPIO_DRIVE_PULLUP, CYBSP_BTN_OFF);
+    cyhal_gpio_register_callback(CYBSP_USER_BTN, &cb_data);
+    cyhal_gpio_enable_event(CYBSP_USER_BTN, CYHAL_GPIO_IRQ_FALL, USER_BTN_INTR_PRIORITY, true);
+
     /* Start mDNS responder */
 	err_t error;
 	mdns_resp_init();
 	/* IP of my device */
 	struct netif *myNetif;
 	myNetif = cy_network_get_nw_interface(CY_NETWORK_WIFI_STA_INTERFACE,0);
-	error = mdns_resp_add_netif(myNetif, "awep", 100);
+	error = mdns_resp_add_netif(myNetif, TCP_SERVER_IS_STANDBY ? "awep-standby" : "awep", 100);
 	if(error == ERR_OK){
 		printf("mDNS responder initialized successfully.\n");
 	}
@@ -165,8 +224,34 @@ void tcp_server_task(void *arg)
                 tcp_server_addr.port);
     }
 
+    /* Answer single AWEP commands sent as UDP datagrams. */
+    result = create_udp_server_socket();
+    if (result != CY_RSLT_SUCCESS)
+    {
+        printf("Failed to create UDP socket! Error code: 0x%08"PRIx32"\n", (uint32_t)result);
+        CY_ASSERT(0);
+    }
+    printf("Answering AWEP datagrams on UDP Port: %d\n\n", UDP_SERVER_PORT);
+
     while(true)
     {
+        /* Wait for a button press or the next slot of the idle timer wheel,
+         * the clients are served by the callbacks and the workers. */
+        if(ulTaskNotifyTake(pdTRUE, AWEP_IDLE_SLOT_TICKS) != 0)
+        {
+            if(awep_repl_is_standby())
+            {
+                awep_repl_promote();
+            }
+            else
+            {
+                awep_server_print_stats();
+            }
+        }
+        awep_server_reap();
+
+        /* Write the register writes of the last slot to flash. */
+        awep_persist_service();
     }
  }
 
@@ -329,6 +414,53 @@ static cy_rslt_t create_tcp_server_socket(void)
     return result;
 }
 
+ /*******************************************************************************
+ * Function Name: create_udp_server_socket
+ *******************************************************************************
+ * Summary:
+ *  Function to create the UDP socket AWEP datagrams are answered on, bound to
+ *  the server's address, and register its receive callback.
+ *
+ *******************************************************************************/
+static cy_rslt_t create_udp_server_socket(void)
+{
+    cy_rslt_t result;
+    cy_socket_sockaddr_t udp_server_addr = tcp_server_addr;
+    cy_socket_opt_callback_t udp_receive_option;
+
+    /* Create a UDP socket */
+    result = cy_socket_create(CY_SOCKET_DOMAIN_AF_INET, CY_SOCKET_TYPE_DGRAM,
+                              CY_SOCKET_IPPROTO_UDP, &udp_server_handle);
+    if(result != CY_RSLT_SUCCESS)
+    {
+        printf("Failed to create UDP socket! Error code: 0x%08"PRIx32"\n", (uint32_t)result);
+        return result;
+    }
+
+    /* Register the callback function to handle datagrams from a UDP client. */
+    udp_receive_option.callback = udp_receive_msg_handler;
+    udp_receive_option.arg = NULL;
+
+    result = cy_socket_setsockopt(udp_server_handle, CY_SOCKET_SOL_SOCKET,
+                                  CY_SOCKET_SO_RECEIVE_CALLBACK,
+                                  &udp_receive_option, sizeof(cy_socket_opt_callback_t));
+    if(result != CY_RSLT_SUCCESS)
+    {
+        printf("Set socket option: CY_SOCKET_SO_RECEIVE_CALLBACK failed\n");
+        return result;
+    }
+
+    /* Bind the UDP socket to the server IP address and the UDP port. */
+    udp_server_addr.port = UDP_SERVER_PORT;
+    result = cy_socket_bind(udp_server_handle, &udp_server_addr, sizeof(udp_server_addr));
+    if(result != CY_RSLT_SUCCESS)
+    {
+        printf("Failed to bind to UDP socket! Error code: 0x%08"PRIx32"\n", (uint32_t)result);
+    }
+
+    return result;
+}
+
  /*******************************************************************************
  * Function Name: tcp_connection_handler
  *******************************************************************************
@@ -346,13 +478,27 @@ static cy_rslt_t create_tcp_server_socket(void)
 static cy_rslt_t tcp_connection_handler(cy_socket_t socket_handle, void *arg)
 {
 	cy_rslt_t result;
+	cy_socket_t client_handle;
+	cy_socket_sockaddr_t peer_addr;
+	uint32_t peer_addr_len = sizeof(peer_addr);
 
 	/* Accept new incoming connection from a TCP client.*/
 	result = cy_socket_accept(socket_handle, &peer_addr, &peer_addr_len,
 							  &client_handle);
 	if(result == CY_RSLT_SUCCESS)
 	{
-		printf("Incoming TCP connection accepted\n");
+		/* Give the client its own framer, reply queue and statistics. */
+		if(awep_server_accept(client_handle, peer_addr.ip_address.ip.v4) != NULL)
+		{
+			printf("Incoming TCP connection accepted, %d of %d clients\n",
+					(int)awep_conn_count(), (int)AWEP_MAX_CONNECTIONS);
+		}
+		else
+		{
+			printf("Connection table full, turned the new connection away\n");
+			cy_socket_disconnect(client_handle, 0);
+			cy_socket_delete(client_handle);
+		}
 	}
 	else
 	{
@@ -365,53 +511,239 @@ static cy_rslt_t tcp_connection_handler(cy_socket_t socket_handle, void *arg)
 }
 
 /*******************************************************************************
-* Function Name: sendAck
+* Function Name: awep_port_send
 *******************************************************************************
 * Summary:
-* Function to send acknowledgement to tcp client.
+* Send queued replies to a tcp client, called from a worker task.
 *
 * Parameters:
-* char *message: message to send
-* cy_socket_t socket_handle: Connection handle for the TCP client socket
+* void *socket: cy_socket_t of the client
+* const char *data: Replies to send
+* uint32_t length: Bytes to send
 *
 * Return:
-*  void
+*  bool: true if the replies were sent
 *
 *******************************************************************************/
-void sendAck(char *message, cy_socket_t socket_handle){
+bool awep_port_send(void *socket, const char *data, uint32_t length){
 
 	cy_rslt_t result;
 	uint32_t bytes_sent;
 
-	/* Send the command to TCP server. */
-	result = cy_socket_send(socket_handle, message, MAX_TCP_DATA_PACKET_LENGTH, CY_SOCKET_FLAGS_NONE, &bytes_sent);
-	if(result == CY_RSLT_SUCCESS ){
-		printf("ack sent: %s\n", message);
+	/* Send the replies to the TCP client. */
+	result = cy_socket_send(socket, data, length, CY_SOCKET_FLAGS_NONE, &bytes_sent);
+	if(result != CY_RSLT_SUCCESS){
+		printf("cy_socket_send failed. Error: %d\n", (int)result);
 	}
-	else{
-		printf("Failed to send ack to client. Error: %d\n", (int)result);
-		if(result == CY_RSLT_MODULE_SECURE_SOCKETS_CLOSED){
-			/* Disconnect the socket. */
-			result = cy_socket_disconnect(socket_handle, 0);
-			if(result != CY_RSLT_SUCCESS){
-				printf("Disconnect Failed!\n");
-				CY_ASSERT(0);
-			}
-			/* Delete the client socket. */
-			result = cy_socket_delete(socket_handle);
-			if(result != CY_RSLT_SUCCESS){
-				printf("Socket Delete Failed!\n");
-				CY_ASSERT(0);
-			}
-		}
+	return result == CY_RSLT_SUCCESS;
+}
+
+/*******************************************************************************
+* Function Name: awep_port_close
+*******************************************************************************
+* Summary:
+* Disconnect and delete the socket of a closed client once nothing holds it,
+* called from a callback, a worker task or tcp_server_task.
+*
+* Parameters:
+* void *socket: cy_socket_t of the client
+*
+* Return:
+*  void
+*
+*******************************************************************************/
+void awep_port_close(void *socket){
+
+	if(cy_socket_disconnect(socket, 0) != CY_RSLT_SUCCESS){
+		printf("Disconnect Failed!\n");
+	}
+	if(cy_socket_delete(socket) != CY_RSLT_SUCCESS){
+		printf("Socket Delete Failed!\n");
 	}
 }
 
+ /*******************************************************************************
+ * Function Name: awep_port_repl_accept
+ *******************************************************************************
+ * Summary:
+ *  Wait for a standby to connect to TCP_SERVER_REPL_PORT, called from the
+ *  replication task. The listener has no callbacks, the accept blocks for up
+ *  to its receive timeout.
+ *
+ * Return:
+ *  void *: cy_socket_t of the standby, NULL if none connected
+ *
+ *******************************************************************************/
+void *awep_port_repl_accept(void)
+{
+    cy_rslt_t result;
+    cy_socket_t socket;
+    cy_socket_sockaddr_t peer_addr;
+    uint32_t peer_addr_len = sizeof(peer_addr);
+    cy_socket_sockaddr_t repl_addr = {
+        .ip_address.version = CY_SOCKET_IP_VER_V4,
+        .ip_address.ip.v4 = tcp_server_addr.ip_address.ip.v4,
+        .port = TCP_SERVER_REPL_PORT
+    };
+
+    if(repl_server_handle == NULL)
+    {
+        result = cy_socket_create(CY_SOCKET_DOMAIN_AF_INET, CY_SOCKET_TYPE_STREAM,
+                                  CY_SOCKET_IPPROTO_TCP, &repl_server_handle);
+        if(result == CY_RSLT_SUCCESS)
+        {
+            result = cy_socket_bind(repl_server_handle, &repl_addr, sizeof(repl_addr));
+        }
+        if(result == CY_RSLT_SUCCESS)
+        {
+            result = cy_socket_listen(repl_server_handle, 1);
+        }
+        if(result != CY_RSLT_SUCCESS)
+        {
+            printf("Failed to listen for a standby! Error code: 0x%08"PRIx32"\n", (uint32_t)result);
+            if(repl_server_handle != NULL)
+            {
+                cy_socket_delete(repl_server_handle);
+                repl_server_handle = NULL;
+            }
+            vTaskDelay(AWEP_IDLE_SLOT_TICKS);
+            return NULL;
+        }
+    }
+    result = cy_socket_accept(repl_server_handle, &peer_addr, &peer_addr_len, &socket);
+    return (result == CY_RSLT_SUCCESS) ? socket : NULL;
+}
+
+ /*******************************************************************************
+ * Function Name: awep_port_repl_connect
+ *******************************************************************************
+ * Summary:
+ *  Connect to the replication port of TCP_SERVER_REPL_PRIMARY, called from
+ *  the replication task of a standby.
+ *
+ * Return:
+ *  void *: cy_socket_t of the connection, NULL on failure
+ *
+ *******************************************************************************/
+void *awep_port_repl_connect(void)
+{
+    cy_rslt_t result;
+    cy_socket_t socket;
+    cy_socket_sockaddr_t primary_addr = {.port = TCP_SERVER_REPL_PORT};
+
+    result = cy_socket_gethostbyname(TCP_SERVER_REPL_PRIMARY, CY_SOCKET_IP_VER_V4, &primary_addr.ip_address);
+    if(result != CY_RSLT_SUCCESS)
+    {
+        return NULL;
+    }
+    result = cy_socket_create(CY_SOCKET_DOMAIN_AF_INET, CY_SOCKET_TYPE_STREAM,
+                              CY_SOCKET_IPPROTO_TCP, &socket);
+    if(result != CY_RSLT_SUCCESS)
+    {
+        return NULL;
+    }
+    result = cy_socket_connect(socket, &primary_addr, sizeof(primary_addr));
+    if(result != CY_RSLT_SUCCESS)
+    {
+        cy_socket_delete(socket);
+        return NULL;
+    }
+    return socket;
+}
+
+ /*******************************************************************************
+ * Function Name: awep_port_repl_receive
+ *******************************************************************************
+ * Summary:
+ *  Receive from the replication connection, waiting at most ticks. A timeout
+ *  of 0 would wait forever on lwIP, the shortest wait is
+ *  REPL_MIN_RECV_TIMEOUT_MS.
+ *
+ * Parameters:
+ * void *socket: cy_socket_t of the connection
+ * char *data: Buffer for what arrives
+ * uint32_t length: Size of the buffer
+ * uint32_t ticks: Longest wait
+ *
+ * Return:
+ *  int32_t: Bytes received, 0 if none came in time, -1 once the connection is gone
+ *
+ *******************************************************************************/
+int32_t awep_port_repl_receive(void *socket, char *data, uint32_t length, uint32_t ticks)
+{
+    cy_rslt_t result;
+    uint32_t bytes_received = 0;
+    uint32_t timeout = (ticks * portTICK_PERIOD_MS > REPL_MIN_RECV_TIMEOUT_MS) ?
+                       ticks * portTICK_PERIOD_MS : REPL_MIN_RECV_TIMEOUT_MS;
+
+    result = cy_socket_setsockopt(socket, CY_SOCKET_SOL_SOCKET, CY_SOCKET_SO_RCVTIMEO,
+                                  &timeout, sizeof(timeout));
+    if(result == CY_RSLT_SUCCESS)
+    {
+        result = cy_socket_recv(socket, data, length, CY_SOCKET_FLAGS_NONE, &bytes_received);
+    }
+    if(result == CY_RSLT_MODULE_SECURE_SOCKETS_TIMEOUT)
+    {
+        return 0;
+    }
+    return (result == CY_RSLT_SUCCESS) ? (int32_t)bytes_received : -1;
+}
+
+ /*******************************************************************************
+ * Function Name: awep_port_timer
+ *******************************************************************************
+ * Summary:
+ *  The DWT cycle counter, started by tcp_server_task.
+ *
+ *******************************************************************************/
+uint32_t awep_port_timer(void)
+{
+    return DWT->CYCCNT;
+}
+
+ /*******************************************************************************
+ * Function Name: awep_port_timer_micros
+ *******************************************************************************
+ * Summary:
+ *  Convert a span of the DWT cycle counter to microseconds.
+ *
+ *******************************************************************************/
+uint32_t awep_port_timer_micros(uint32_t span)
+{
+    return span / (SystemCoreClock / 1000000u);
+}
+
+ /*******************************************************************************
+ * Function Name: isr_button_press
+ *******************************************************************************
+ * Summary:
+ *  GPIO interrupt service routine, wakes the server task to dump the
+ *  statistics.
+ *
+ * Parameters:
+ *  void *callback_arg : pointer to variable passed to the ISR
+ *  cyhal_gpio_event_t event : GPIO event type
+ *
+ * Return:
+ *  None
+ *
+ *******************************************************************************/
+static void isr_button_press(void *callback_arg, cyhal_gpio_event_t event)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    vTaskNotifyGiveFromISR(server_task_handle, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
  /*******************************************************************************
  * Function Name: tcp_receive_msg_handler
  *******************************************************************************
  * Summary:
- *  Callback function to handle incoming TCP client messages.
+ *  Callback function to handle incoming TCP client messages. The bytes go
+ *  through the stream framer so every complete command in the segment is
+ *  handled and a partial command waits for the rest of it. The commands are
+ *  only queued here, the worker tasks run them and send the replies.
  *
  * Parameters:
  * cy_socket_t socket_handle: Connection handle for the TCP client socket
@@ -423,112 +755,83 @@ void sendAck(char *message, cy_socket_t socket_handle){
  *******************************************************************************/
 static cy_rslt_t tcp_receive_msg_handler(cy_socket_t socket_handle, void *arg)
 {
-	char message_buffer[MAX_TCP_RECV_BUFFER_SIZE];
-	    cy_rslt_t result;
-
-	    // linked list to store connection information in
-		static dbEntry_t head = {
-			.next = NULL,
-			.deviceId = 0,
-			.regId = 0
-		};
-	    dbEntry_t receive;
-	    char commandId;
-
-	    /* Variable to store number of bytes received from TCP client. */
-	    uint32_t bytes_received = 0;
-	    result = cy_socket_recv(socket_handle, message_buffer, MAX_TCP_RECV_BUFFER_SIZE,
-	                            CY_SOCKET_FLAGS_NONE, &bytes_received);
-	    char returnMessage[MAX_TCP_RECV_BUFFER_SIZE];
-
-	    //create char* containing message so strlen() can be used to find length
-	    char *messageString = &message_buffer[0];
-
-	    if(result == CY_RSLT_SUCCESS){
-	        printf("Message from TCP Client: %s\n", messageString);
-
-	        // to many characters, reject
-	        if(strlen(messageString) > 12){
-	        	printf("illegal length\n");
-				snprintf(returnMessage, MAX_TCP_RECV_BUFFER_SIZE , "X illegal length");
-				sendAck(returnMessage, socket_handle);
-				return result;
-			}
-
-	        // Check that it is the correct length and has a legal command
-	        if(!((strlen(messageString) == 7 && message_buffer[0] == 'R') || (strlen(messageString) == 11 && message_buffer[0] == 'W'))){
-	        	printf("illegal command\n");
-	        	snprintf(returnMessage, MAX_TCP_RECV_BUFFER_SIZE, "X illegal command");
-	        	sendAck(returnMessage, socket_handle);
-	        	return result;
-	        }
-
-	        // All of the bytes must be a ASCII hex digit from 1->end of string
-	        for(int i = 1; i < strlen(messageString); i++){
-	        	if(!isxdigit((int)message_buffer[i])){
-	        		printf("illegal character\n");
-	        		snprintf(returnMessage, MAX_TCP_RECV_BUFFER_SIZE, "X illegal character");
-	        		sendAck(returnMessage, socket_handle);
-	        		return result;
-	        	}
-	        }
-
-	        // Write command
-	        if(message_buffer[0] == 'W'){
-	        	printf("write");
-	        	//parse the string
-	        	sscanf((const char*)message_buffer,"%c%4x%2x%4x", (char *)&commandId, (int*)&receive.deviceId, (int*)&receive.regId, (int*)&receive.value);
-				receive.next = NULL;
-	        	//See if the device is already in the database, or if theres room to add it
-	        	if((dbFind(&head, &receive) != NULL) || (dbGetCount(&head) <= dbGetMax())){
-	        		sprintf(returnMessage,"A%04X%02X%04X",(unsigned int)receive.deviceId,(unsigned int)receive.regId,(unsigned int)receive.value);
-	        		dbEntry_t *newDB = malloc(sizeof(dbEntry_t)); // make a new entry to put in the database
-	        		memcpy(newDB,&receive,sizeof(dbEntry_t)); // copy the received data into the new entry
-	        		dbSetValue(&head, newDB); // save it.
-	        		sendAck(returnMessage, socket_handle);
-	        		return result;
-	        	}
-	        	else{
-	        		sprintf(returnMessage,"X Database Full %d",(int)dbGetCount(&head));
-	        		sendAck(returnMessage, socket_handle);
-	        		return result;
-	        	}
-	        }
-	        if(message_buffer[0] == 'R'){
-	        	//read
-				sscanf((const char *)message_buffer,"%c%4x%2x",(char *)&commandId,( int *)&receive.deviceId,( int *)&receive.regId);
-				dbEntry_t *foundValue = dbFind(&head, &receive); // look through the database to find a previous write of the deviceId/regId
-				if(foundValue){
-					sprintf(returnMessage,"A%04X%02X%04X",(unsigned int)foundValue->deviceId,(unsigned int)foundValue->regId,(unsigned int)foundValue->value);
-					sendAck(returnMessage, socket_handle);
-					return result;
-				}
-				else{
-					sprintf(returnMessage,"X Not Found");
-					sendAck(returnMessage, socket_handle);
-					return result;
-				}
-			}
-	    }
-	    else{
-	        printf("Failed to receive message from the TCP client. Error: %d\n",
-	              (int)result);
-	        if(result == CY_RSLT_MODULE_SECURE_SOCKETS_CLOSED){
-	            /* Disconnect the socket. */
-	            result = cy_socket_disconnect(socket_handle, 0);
-	            if(result != CY_RSLT_SUCCESS){
-					printf("Disconnect Failed!\n");
-					CY_ASSERT(0);
-				}
-				/* Delete the client socket. */
-				result = cy_socket_delete(socket_handle);
-				if(result != CY_RSLT_SUCCESS){
-					printf("Socket Delete Failed!\n");
-					CY_ASSERT(0);
-				}
-	        }
-	    }
-	    return result;
+    char *space;
+    cy_rslt_t result;
+
+    /* Client the message came from, held until it is handled. */
+    awep_conn_t *conn = awep_conn_get(socket_handle);
+    if(conn == NULL){
+        printf("Message from a client that is not in the connection table\n");
+        return CY_RSLT_MODULE_SECURE_SOCKETS_INVALID_SOCKET;
+    }
+
+    /* Variable to store number of bytes received from TCP client. */
+    uint32_t bytes_received = 0;
+    /* Receive straight into the free space of the framer. */
+    uint32_t space_length = awep_framer_space(&conn->framer, &space);
+    result = cy_socket_recv(socket_handle, space, space_length,
+                            CY_SOCKET_FLAGS_NONE, &bytes_received);
+
+    if(result == CY_RSLT_SUCCESS){
+        awep_server_receive(conn, bytes_received);
+    }
+    else{
+        printf("Failed to receive message from the TCP client. Error: %d\n",
+              (int)result);
+        if(result == CY_RSLT_MODULE_SECURE_SOCKETS_CLOSED){
+            /* The socket is deleted once the workers are done with the client. */
+            awep_server_close(conn);
+        }
+    }
+    awep_server_release(conn);
+    return result;
+}
+
+ /*******************************************************************************
+ * Function Name: udp_receive_msg_handler
+ *******************************************************************************
+ * Summary:
+ *  Callback function to handle AWEP datagrams. Each carries one command, which
+ *  is run right away and answered to the address it came from. There is no
+ *  connection to set up or tear down, a retransmission is answered from the
+ *  reply cache.
+ *
+ * Parameters:
+ * cy_socket_t socket_handle: Handle of the UDP server socket
+ *  void *args : Parameter passed on to the function (unused)
+ *
+ * Return:
+ *  cy_result result: Result of the operation
+ *
+ *******************************************************************************/
+static cy_rslt_t udp_receive_msg_handler(cy_socket_t socket_handle, void *arg)
+{
+    /* A byte more than the longest datagram, so a longer one shows up as too long. */
+    char datagram[AWEP_UDP_DATAGRAM_MAX + 1];
+    char reply[AWEP_UDP_REPLY_MAX];
+    cy_socket_sockaddr_t peer_addr;
+    uint32_t peer_addr_len = sizeof(peer_addr);
+    uint32_t bytes_received = 0;
+    uint32_t bytes_sent;
+    cy_rslt_t result;
+
+    result = cy_socket_recvfrom(socket_handle, datagram, sizeof(datagram), CY_SOCKET_FLAGS_NONE,
+                                &peer_addr, &peer_addr_len, &bytes_received);
+    if(result != CY_RSLT_SUCCESS){
+        printf("Failed to receive a datagram. Error: %d\n", (int)result);
+        return result;
+    }
+
+    uint32_t reply_length = awep_server_datagram(peer_addr.ip_address.ip.v4, (uint16_t)peer_addr.port,
+                                                 datagram, bytes_received, reply);
+    if(reply_length != 0){
+        result = cy_socket_sendto(socket_handle, reply, reply_length, CY_SOCKET_FLAGS_NONE,
+                                  &peer_addr, peer_addr_len, &bytes_sent);
+        if(result != CY_RSLT_SUCCESS){
+            printf("cy_socket_sendto failed. Error: %d\n", (int)result);
+        }
+    }
+    return result;
 }
 
  /*******************************************************************************
@@ -547,27 +850,22 @@ static cy_rslt_t tcp_receive_msg_handler(cy_socket_t socket_handle, void *arg)
  *******************************************************************************/
 static cy_rslt_t tcp_disconnection_handler(cy_socket_t socket_handle, void *arg)
 {
-    cy_rslt_t result;
-
-    /* Disconnect the TCP client. */
-    result = cy_socket_disconnect(socket_handle, 0);
-    if(result != CY_RSLT_SUCCESS){
-    	printf("Disconnect Failed!\n");
-    	CY_ASSERT(0);
+    /* Already closed by the receive callback or the reaper. */
+    awep_conn_t *conn = awep_conn_get(socket_handle);
+    if(conn == NULL){
+        return CY_RSLT_SUCCESS;
     }
-    /* Delete the client socket. */
-	result = cy_socket_delete(socket_handle);
-	if(result != CY_RSLT_SUCCESS){
-		printf("Socket Delete Failed!\n");
-		CY_ASSERT(0);
-	}
 
+    /* The socket is disconnected and deleted with the last hold on the
+     * client, a worker may still be answering it. */
+    awep_server_close(conn);
+    awep_server_release(conn);
     printf("TCP Client disconnected! Please reconnect the TCP Client\n");
     printf("===============================================================\n");
     printf("Listening for incoming TCP client connection on Port: %d\n\n",
             tcp_server_addr.port);
 
-    return result;
+    return CY_RSLT_SUCCESS;
 }
 
 /* [] END OF FILE */
@@ -71,11 +71,21 @@
 
 /* TCP server related macros. */
 #define TCP_SERVER_PORT                           (50007)
-#define TCP_SERVER_MAX_PENDING_CONNECTIONS        (5u)
+#define TCP_SERVER_MAX_PENDING_CONNECTIONS        (3u)
 #define TCP_SERVER_RECV_TIMEOUT_MS                (2000u)
 #define MAX_TCP_RECV_BUFFER_SIZE                  (20u)
 #define MAX_TCP_DATA_PACKET_LENGTH				  (20u)
 
+/* AWEP datagrams are answered on the same port number over UDP. */
+#define UDP_SERVER_PORT                           (50007)
+
+/* A standby connects to its primary on this port. Set TCP_SERVER_REPL_PRIMARY
+ * to the address of the primary to make this board its standby, it then
+ * advertises itself as awep-standby.local. Leave it empty for a primary. */
+#define TCP_SERVER_REPL_PORT                      (50008)
+#define TCP_SERVER_REPL_PRIMARY                   ""
+#define TCP_SERVER_IS_STANDBY                     (sizeof(TCP_SERVER_REPL_PRIMARY) > 1u)
+
 /*******************************************************************************
 * Function Prototypes
 ********************************************************************************/
@@ -0,0 +1,133 @@
+#ifndef AWEP_H_
+#define AWEP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// AWEP commands are an ASCII command letter followed by hex digits:
+// R<deviceId:4><regId:2> and W<deviceId:4><regId:2><value:4>
+#define AWEP_READ_LEN       (7u)
+#define AWEP_WRITE_LEN      (11u)
+// S<deviceId:4><regId:2> watches a register and S<deviceId:4> every register of
+// a device, U with the same fields stops watching. A W accepted from another
+// client is then pushed unasked as N<deviceId:4><regId:2><value:4>
+#define AWEP_WATCH_DEVICE_LEN   (5u)
+#define AWEP_NOTIFY_LEN         (11u)
+// regId of a watch that covers the whole device, above any 8 bit regId
+#define AWEP_ALL_REGS           (0x100u)
+// G<deviceId:4> reads every register of a device and G<deviceId:4><firstReg:2>
+// <lastReg:2> a span of them. Each register found comes back as an ack, in
+// regId order, and E<deviceId:4><count:4> ends the reply
+#define AWEP_RANGE_LEN          (9u)
+// C<deviceId:4><regId:2><expected:4><value:4> stores value only if the register
+// holds expected, otherwise the reply is "X Mismatch <current:4>".
+// I<deviceId:4><regId:2><delta:4> adds delta, FFFF being -1, to the register
+// and the ack carries the result
+#define AWEP_CAS_LEN        (15u)
+// T alone reads the server statistics, one T<index:2><value:8> record per
+// counter in index order, ended by E0000<count:4>
+#define AWEP_STATS_LEN      (1u)
+// Anything longer than this is rejected as "X illegal length"
+#define AWEP_MAX_LEN        (16u)
+// Longest reply or notification of either protocol, NUL included
+// ("X Database Full 65535")
+#define AWEP_REPLY_MAX      (22u)
+
+// Binary commands are a length byte (the bytes after it), the command letter as
+// opcode and the fields packed big endian:
+// 04 'R' <deviceId:2> <regId:1> and 06 'W' <deviceId:2> <regId:1> <value:2>,
+// 03 'S' <deviceId:2> or 04 'S' <deviceId:2> <regId:1>, the same for 'U',
+// 03 'G' <deviceId:2> or 05 'G' <deviceId:2> <firstReg:1> <lastReg:1>,
+// 09 'C' <deviceId:2> <regId:1> <expected:2> <value:2>, 06 'I' like a W and 01 'T'
+// Replies come back in command order as 03 <status> <value:2>, where the value
+// is the count for AWEP_ERR_FULL, the current value for AWEP_ERR_MISMATCH and
+// the watches held for S and U, or
+// 01 <status> for the other errors. Notifications are 06 'N' <deviceId:2>
+// <regId:1> <value:2>, no status byte is ever 'N'. A G answers each register
+// as 04 'A' <regId:1> <value:2> before its reply, whose value is the count, and
+// a T each counter as 06 'T' <index:1> <value:4> the same way
+#define AWEP_BINARY_STATS_LEN   (2u)
+#define AWEP_BINARY_READ_LEN    (5u)
+#define AWEP_BINARY_RANGE_LEN   (6u)
+#define AWEP_BINARY_CAS_LEN     (10u)
+#define AWEP_BINARY_WRITE_LEN   (7u)
+#define AWEP_BINARY_WATCH_DEVICE_LEN (4u)
+#define AWEP_BINARY_NOTIFY_LEN  (7u)
+#define AWEP_BINARY_STAT_LEN    (7u)
+#define AWEP_BINARY_REPLY_MAX   (4u)
+// A connection is binary when its first byte is a length up to this. CR and LF
+// are left to ASCII, so no binary command may be 10 or 13 bytes long
+#define AWEP_BINARY_MAX_LEN     (0x1Fu)
+
+// Over UDP a datagram is <requestId:2> followed by one ASCII or binary command,
+// the ID big endian and the command told apart by its first byte as on TCP.
+// The reply datagram is the same ID followed by the reply. Only R, W, C and I
+// are taken, the commands answered with more than one reply are rejected as
+// "X illegal command". A client retransmits with the same ID until it gets a
+// reply, and the server answers a repeated ID from its reply cache instead of
+// running the command twice
+#define AWEP_UDP_ID_LEN         (2u)
+// Longest datagram taken, anything longer is rejected as "X illegal length"
+#define AWEP_UDP_DATAGRAM_MAX   (AWEP_UDP_ID_LEN + AWEP_MAX_LEN)
+#define AWEP_UDP_REPLY_MAX      (AWEP_UDP_ID_LEN + AWEP_REPLY_MAX)
+
+// Result of decoding a command, the errors map to the "X ..." replies
+typedef enum {
+    AWEP_OK = 0,
+    AWEP_ERR_LENGTH,
+    AWEP_ERR_COMMAND,
+    AWEP_ERR_CHARACTER,
+    AWEP_ERR_NOT_FOUND,
+    AWEP_ERR_FULL,
+    AWEP_ERR_WATCH_LIMIT,
+    AWEP_ERR_MISMATCH,
+    // A write sent to a standby, only its primary writes to it
+    AWEP_ERR_READ_ONLY,
+    // The client, or all clients together, sent more commands than the rate
+    // limit allows and the command was not run
+    AWEP_ERR_THROTTLED,
+    // Sent in ASCII to a connection turned away because the server is full,
+    // before the client has said which protocol it speaks
+    AWEP_ERR_BUSY
+} awep_status_t;
+
+// A decoded command
+typedef struct {
+    char command;       // 'R', 'W', 'S', 'U', 'G', 'C', 'I' or 'T'
+    uint32_t length;    // characters in the frame before the NUL, or binary frame bytes
+    uint32_t deviceId;
+    uint32_t regId;     // AWEP_ALL_REGS for a whole device watch, the first regId of a G
+    uint32_t value;     // W and C, the delta of an I or the last regId of a G
+    uint32_t expected;  // C only
+} awep_request_t;
+
+//validate and decode one command in a single pass over at most size bytes
+awep_status_t awep_decode(const char *frame, uint32_t size, awep_request_t *request);
+//true if the first byte of a connection starts a binary command
+bool awep_is_binary(char first);
+//validate and decode one length prefixed binary command of size bytes
+awep_status_t awep_decode_binary(const uint8_t *frame, uint32_t size, awep_request_t *request);
+//write the binary reply for status, value is the register value, the AWEP_ERR_FULL
+//count or the AWEP_ERR_MISMATCH current value
+uint32_t awep_encode_binary_reply(uint8_t *buffer, uint32_t size, awep_status_t status, uint32_t value);
+//write "A<deviceId><regId><value>", returns the length without the NUL
+uint32_t awep_encode_ack(char *buffer, uint32_t size, uint32_t deviceId, uint32_t regId, uint32_t value);
+//write "A<deviceId>[<regId>]" for an S or U, returns the length without the NUL
+uint32_t awep_encode_watch_ack(char *buffer, uint32_t size, uint32_t deviceId, uint32_t regId);
+//write "N<deviceId><regId><value>", returns the length without the NUL
+uint32_t awep_encode_notify(char *buffer, uint32_t size, uint32_t deviceId, uint32_t regId, uint32_t value);
+//write the binary notification, returns its length or 0 if it does not fit
+uint32_t awep_encode_binary_notify(uint8_t *buffer, uint32_t size, uint32_t deviceId, uint32_t regId, uint32_t value);
+//write "E<deviceId><count>" after the acks of a G, returns the length without the NUL
+uint32_t awep_encode_range_end(char *buffer, uint32_t size, uint32_t deviceId, uint32_t count);
+//write one binary register record of a G, returns its length or 0 if it does not fit
+uint32_t awep_encode_binary_record(uint8_t *buffer, uint32_t size, uint32_t regId, uint32_t value);
+//write "T<index><value>" for one statistics counter, returns the length without the NUL
+uint32_t awep_encode_stat(char *buffer, uint32_t size, uint32_t index, uint32_t value);
+//write one binary statistics record of a T, returns its length or 0 if it does not fit
+uint32_t awep_encode_binary_stat(uint8_t *buffer, uint32_t size, uint32_t index, uint32_t value);
+//write the "X ..." reply for an error, value is appended as the count for
+//AWEP_ERR_FULL and as the current value for AWEP_ERR_MISMATCH
+uint32_t awep_encode_error(char *buffer, uint32_t size, awep_status_t status, uint32_t value);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef AWEP_FRAMER_H_
+#define AWEP_FRAMER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Bytes buffered per connection, large enough to take a whole TCP segment
+// of pipelined commands in one receive
+#ifndef AWEP_FRAMER_SIZE
+#define AWEP_FRAMER_SIZE (1600u)
+#endif
+
+// Splits a TCP byte stream into AWEP commands. An ASCII command ends at a NUL,
+// CR or LF and a binary command carries its length, so several commands can
+// arrive in one segment and one command can be split across segments. The
+// first byte of the connection decides which of the two it speaks.
+typedef struct {
+    char buffer[AWEP_FRAMER_SIZE];
+    uint32_t head;      // next byte to frame
+    uint32_t tail;      // next byte to receive into
+    bool discarding;    // dropping the rest of an overlong command
+    uint32_t skipping;  // bytes of an overlong binary command still to drop
+    bool detected;      // the first byte has been seen
+    bool binary;        // the connection speaks binary AWEP
+} awep_framer_t;
+
+//empty the framer, call it when a connection is accepted
+void awep_framer_init(awep_framer_t *framer);
+//get the free space to receive into, returns its length
+uint32_t awep_framer_space(awep_framer_t *framer, char **space);
+//add length bytes received into the space from awep_framer_space
+void awep_framer_commit(awep_framer_t *framer, uint32_t length);
+//copy the next complete command into frame, false if there is none yet. ASCII
+//commands are NUL terminated, binary ones are copied whole with their length byte
+bool awep_framer_next(awep_framer_t *framer, char *frame, uint32_t size, uint32_t *length);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef AWEP_IDLE_H_
+#define AWEP_IDLE_H_
+
+#include <stdint.h>
+#include "awep_conn.h"
+
+// Idle timeouts are kept on a timer wheel of AWEP_IDLE_SLOTS slots of
+// AWEP_IDLE_SLOT_TICKS each. Touching a connection and expiring a slot are
+// both O(1), and a connection is reaped up to one slot after its timeout.
+// Timeouts longer than a turn of the wheel stay on their slot for more turns
+#ifndef AWEP_IDLE_SLOT_TICKS
+#define AWEP_IDLE_SLOT_TICKS (1000u)
+#endif
+#define AWEP_IDLE_SLOTS      (64u)
+
+//empty the wheel, before any connection is accepted
+void awep_idle_init(uint32_t now);
+//start timing a newly opened connection, timeout is in ticks
+void awep_idle_start(uint32_t index, uint32_t now, uint32_t timeout);
+//restart the timeout of a connection that was heard from
+void awep_idle_touch(uint32_t index, uint32_t now);
+//stop timing a closed connection
+void awep_idle_stop(uint32_t index);
+//take out every connection whose timeout has passed, expired holds up to
+//AWEP_MAX_CONNECTIONS indexes. Returns how many there are
+uint32_t awep_idle_expire(uint32_t now, uint8_t *expired);
+
+#endif
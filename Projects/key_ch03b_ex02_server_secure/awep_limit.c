@@ -0,0 +1,144 @@
+//token buckets that rate limit the commands of each client and of the server,
+//taken on the receive path as each command is framed, before it is queued
+//or run, and for each UDP datagram
+#include <stdio.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include "awep_limit.h"
+
+// A bucket counts in 1/configTICK_RATE_HZ of a token, so each tick adds the
+// rate and a command takes configTICK_RATE_HZ
+typedef struct {
+    uint32_t credit;
+    uint32_t refilled;  // tick count the credit was last brought up to
+} awepBucket_t;
+
+// One bucket for each connection entry and the shared one
+static awepBucket_t awepLimitClient[AWEP_MAX_CONNECTIONS];
+static awepBucket_t awepLimitGlobal;
+
+static uint32_t awepClientRate = AWEP_LIMIT_CLIENT_RATE;
+static uint32_t awepClientBurst = AWEP_LIMIT_CLIENT_BURST;
+static uint32_t awepGlobalRate = AWEP_LIMIT_GLOBAL_RATE;
+static uint32_t awepGlobalBurst = AWEP_LIMIT_GLOBAL_BURST;
+
+static SemaphoreHandle_t awepLimitLock;
+static StaticSemaphore_t awepLimitLockBuffer;
+
+// awepRefill:
+// Add the credit of the ticks since the last refill, up to the burst. A bucket
+// that has been idle long enough to fill is simply filled, so the product
+// never overflows. Called with the lock held
+static void awepRefill(awepBucket_t *bucket, uint32_t rate, uint32_t burst, uint32_t now){
+    uint32_t full = burst * configTICK_RATE_HZ;
+    uint32_t elapsed = now - bucket->refilled;
+
+    bucket->refilled = now;
+    if(elapsed >= (full - bucket->credit) / rate + 1u){
+        bucket->credit = full;
+    }
+    else{
+        bucket->credit += elapsed * rate;
+    }
+}
+
+// awepShortfall:
+// Ticks until a bucket holds a whole token again. Called with the lock held
+static uint32_t awepShortfall(awepBucket_t *bucket, uint32_t rate, uint32_t burst, uint32_t now){
+    awepRefill(bucket, rate, burst, now);
+    if(bucket->credit >= configTICK_RATE_HZ){
+        return 0;
+    }
+    return (configTICK_RATE_HZ - bucket->credit + rate - 1u) / rate;
+}
+
+void awep_limit_set(uint32_t clientRate, uint32_t clientBurst,
+                    uint32_t globalRate, uint32_t globalBurst){
+    // a bucket that cannot hold one command would turn everything away
+    awepClientRate = clientRate;
+    awepClientBurst = (clientBurst != 0) ? clientBurst : 1u;
+    awepGlobalRate = globalRate;
+    awepGlobalBurst = (globalBurst != 0) ? globalBurst : 1u;
+}
+
+void awep_limit_init(uint32_t now){
+    if(awepLimitLock == NULL){
+        awepLimitLock = xSemaphoreCreateMutexStatic(&awepLimitLockBuffer);
+    }
+    awepLimitGlobal.credit = awepGlobalBurst * configTICK_RATE_HZ;
+    awepLimitGlobal.refilled = now;
+}
+
+void awep_limit_start(uint32_t index, uint32_t now){
+    xSemaphoreTake(awepLimitLock, portMAX_DELAY);
+    awepLimitClient[index].credit = awepClientBurst * configTICK_RATE_HZ;
+    awepLimitClient[index].refilled = now;
+    xSemaphoreGive(awepLimitLock);
+}
+
+bool awep_limit_take(uint32_t index, uint32_t now){
+    awepBucket_t *client = (index < AWEP_MAX_CONNECTIONS && awepClientRate != 0) ? &awepLimitClient[index] : NULL;
+    awepBucket_t *global = (awepGlobalRate != 0) ? &awepLimitGlobal : NULL;
+    bool taken = true;
+
+    if(client == NULL && global == NULL){
+        return true;
+    }
+    xSemaphoreTake(awepLimitLock, portMAX_DELAY);
+    if(client != NULL){
+        awepRefill(client, awepClientRate, awepClientBurst, now);
+        taken = client->credit >= configTICK_RATE_HZ;
+    }
+    if(taken && global != NULL){
+        awepRefill(global, awepGlobalRate, awepGlobalBurst, now);
+        taken = global->credit >= configTICK_RATE_HZ;
+    }
+    if(taken){
+        if(client != NULL){
+            client->credit -= configTICK_RATE_HZ;
+        }
+        if(global != NULL){
+            global->credit -= configTICK_RATE_HZ;
+        }
+    }
+    xSemaphoreGive(awepLimitLock);
+    return taken;
+}
+
+// awep_limit_wait:
+// A command needs a token from both buckets, so the wait is the longer of
+// their two shortfalls
+uint32_t awep_limit_wait(uint32_t index, uint32_t now){
+    uint32_t wait = 0;
+
+    if(index >= AWEP_MAX_CONNECTIONS || (awepClientRate == 0 && awepGlobalRate == 0)){
+        return 0;
+    }
+    xSemaphoreTake(awepLimitLock, portMAX_DELAY);
+    if(awepClientRate != 0){
+        wait = awepShortfall(&awepLimitClient[index], awepClientRate, awepClientBurst, now);
+    }
+    if(awepGlobalRate != 0){
+        uint32_t global = awepShortfall(&awepLimitGlobal, awepGlobalRate, awepGlobalBurst, now);
+        if(global > wait){
+            wait = global;
+        }
+    }
+    xSemaphoreGive(awepLimitLock);
+    return wait;
+}
+
+void awep_limit_print(void){
+    if(awepClientRate != 0){
+        printf("Commands per client: %d a second, bursts of %d\n", (int)awepClientRate, (int)awepClientBurst);
+    }
+    else{
+        printf("Commands per client: unlimited\n");
+    }
+    if(awepGlobalRate != 0){
+        printf("Commands in all: %d a second, bursts of %d\n", (int)awepGlobalRate, (int)awepGlobalBurst);
+    }
+    else{
+        printf("Commands in all: unlimited\n");
+    }
+}
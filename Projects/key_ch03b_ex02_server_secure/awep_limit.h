@@ -0,0 +1,52 @@
+#ifndef AWEP_LIMIT_H_
+#define AWEP_LIMIT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "awep_conn.h"
+
+// Every command a client sends takes a token from a bucket of its own and one
+// from a bucket shared by all clients and UDP. A bucket holds up to its burst
+// of tokens and refills at its rate in commands per second. A command that
+// finds either bucket empty is not run, it is answered "X Throttled" and
+// counted, and the client's next commands are only let through as tokens come
+// back. A rate of 0 leaves that bucket out, and both are left out unless the
+// build or awep_limit_set gives them a rate
+#ifndef AWEP_LIMIT_CLIENT_RATE
+#define AWEP_LIMIT_CLIENT_RATE  (0u)
+#endif
+#ifndef AWEP_LIMIT_CLIENT_BURST
+#define AWEP_LIMIT_CLIENT_BURST (32u)
+#endif
+#ifndef AWEP_LIMIT_GLOBAL_RATE
+#define AWEP_LIMIT_GLOBAL_RATE  (0u)
+#endif
+#ifndef AWEP_LIMIT_GLOBAL_BURST
+#define AWEP_LIMIT_GLOBAL_BURST (128u)
+#endif
+
+// Bucket of a UDP peer, which only takes from the shared bucket
+#define AWEP_LIMIT_NO_CLIENT    (AWEP_MAX_CONNECTIONS)
+
+//set the limits, before the server starts. The defaults are the
+//AWEP_LIMIT_ macros
+void awep_limit_set(uint32_t clientRate, uint32_t clientBurst,
+                    uint32_t globalRate, uint32_t globalBurst);
+//fill the shared bucket, before any connection is accepted
+void awep_limit_init(uint32_t now);
+//fill the bucket of a newly opened connection
+void awep_limit_start(uint32_t index, uint32_t now);
+//take a token for a command from the connection at index, or from
+//AWEP_LIMIT_NO_CLIENT, and from the shared bucket. False if either is empty,
+//then neither is taken from
+bool awep_limit_take(uint32_t index, uint32_t now);
+//ticks until the connection at index and the shared bucket both have a token
+//again, 0 if they have. A
+//port that can hold off reading a client does so for that long, the commands
+//of a client that keeps sending then wait in its socket instead of costing a
+//reply each
+uint32_t awep_limit_wait(uint32_t index, uint32_t now);
+//print the limits in force to the console
+void awep_limit_print(void);
+
+#endif
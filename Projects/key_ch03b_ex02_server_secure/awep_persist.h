@@ -0,0 +1,67 @@
+#ifndef AWEP_PERSIST_H_
+#define AWEP_PERSIST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "database.h"
+
+// The register database is kept across resets as a compacted snapshot plus an
+// append-only log of every write since. Each log record is the register's
+// value after the write, so replaying the log over any snapshot taken after it
+// started gives the same database. The log alternates between two regions: the
+// server switches to the other one, writes a snapshot that covers everything
+// before the switch, then erases the old log. A reset at any point leaves a
+// valid snapshot and the logs that follow it.
+
+// Log records are gathered in a page of this many bytes and written out when
+// it fills up or every AWEP_IDLE_SLOT_TICKS, whichever comes first. Writes
+// accepted in the last slot before a power loss can be lost
+#ifndef AWEP_PERSIST_PAGE_SIZE
+#define AWEP_PERSIST_PAGE_SIZE (512u)
+#endif
+
+// A new snapshot is taken once the active log is this many percent full
+#ifndef AWEP_PERSIST_COMPACT_PERCENT
+#define AWEP_PERSIST_COMPACT_PERCENT (50u)
+#endif
+
+// Storage regions, each erased on its own. Two snapshot slots so the last good
+// snapshot survives a reset while the next one is written
+typedef enum {
+    AWEP_REGION_SNAPSHOT_0 = 0,
+    AWEP_REGION_SNAPSHOT_1,
+    AWEP_REGION_LOG_0,
+    AWEP_REGION_LOG_1,
+    AWEP_REGION_COUNT
+} awep_region_t;
+
+// What the last restore found and how long it took
+typedef struct {
+    uint32_t snapshotRecords;
+    uint32_t logRecords;
+    uint32_t generation;    // of the snapshot restored, 0 if there was none
+    uint32_t micros;
+} awep_persist_restore_t;
+
+//rebuild the register database from storage, call after dbInit and before any
+//client is served
+bool awep_persist_start(awep_persist_restore_t *restore);
+//log one register write or removal, the database journal once
+//awep_persist_start is done
+void awep_persist_journal(const dbEntry_t *entry, bool removed);
+//write the log records gathered so far and take a snapshot once the log is
+//getting full, called every AWEP_IDLE_SLOT_TICKS from the server task
+void awep_persist_service(void);
+
+// Provided by the port, internal flash on the board and files on the host
+
+//bytes a region holds
+uint32_t awep_port_storage_size(awep_region_t region);
+//read bytes of a region, false if they are not there
+bool awep_port_storage_read(awep_region_t region, uint32_t offset, void *data, uint32_t length);
+//write bytes of a region, rewriting what was there
+bool awep_port_storage_write(awep_region_t region, uint32_t offset, const void *data, uint32_t length);
+//erase a region, nothing in it reads as a valid header or record afterwards
+bool awep_port_storage_erase(awep_region_t region);
+
+#endif
@@ -0,0 +1,441 @@
+//primary/standby replication of the register database
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+#include "database.h"
+#include "awep_stats.h"
+#include "awep_idle.h"
+#include "awep_server.h"
+#include "awep_repl.h"
+
+// One numbered write, or removal of an evicted register, with the timer when
+// the database applied it
+typedef struct {
+    uint16_t deviceId;
+    uint8_t regId;
+    bool removed;
+    uint16_t value;
+    uint32_t appliedAt;
+} awep_repl_write_t;
+
+// The history is guarded by awepReplLock, which the journal takes with the
+// database write lock held. The task never calls into the database holding it
+static SemaphoreHandle_t awepReplLock;
+static StaticSemaphore_t awepReplLockBuffer;
+static awep_repl_write_t awepReplHistory[AWEP_REPL_HISTORY];
+static uint32_t awepReplNext = 1;   // sequence number of the next write, 0 is none
+static uint32_t awepReplRunId;      // tells this run of the primary from the last one
+static TaskHandle_t awepReplTask;
+static volatile bool awepReplStandby;
+static volatile bool awepReplStreaming;     // a standby is connected, writes wake the task
+
+// What a standby has applied, kept across reconnects
+static uint32_t awepReplFollowedRun;    // 0 until a full copy is complete
+static uint32_t awepReplApplied;
+
+static void awepPut32(char *bytes, uint32_t value){
+    bytes[0] = (char)(value >> 24);
+    bytes[1] = (char)(value >> 16);
+    bytes[2] = (char)(value >> 8);
+    bytes[3] = (char)value;
+}
+
+static uint32_t awepGet32(const char *bytes){
+    const uint8_t *u = (const uint8_t *)bytes;
+    return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | u[3];
+}
+
+static void awepPutRecord(char *record, bool removed, uint32_t deviceId, uint32_t regId, uint32_t value){
+    record[0] = removed ? 'D' : 'W';
+    record[1] = (char)(deviceId >> 8);
+    record[2] = (char)deviceId;
+    record[3] = (char)regId;
+    record[4] = (char)(value >> 8);
+    record[5] = (char)value;
+}
+
+// awepOldest:
+// First write still in the history. Called with the lock held
+static uint32_t awepOldest(void){
+    return (awepReplNext > AWEP_REPL_HISTORY) ? awepReplNext - AWEP_REPL_HISTORY : 1u;
+}
+
+void awep_repl_journal(const dbEntry_t *entry, bool removed){
+    if(awepReplLock == NULL){
+        return;
+    }
+    xSemaphoreTake(awepReplLock, portMAX_DELAY);
+    awep_repl_write_t *write = &awepReplHistory[awepReplNext % AWEP_REPL_HISTORY];
+    write->deviceId = (uint16_t)entry->deviceId;
+    write->regId = (uint8_t)entry->regId;
+    write->removed = removed;
+    write->value = (uint16_t)entry->value;
+    write->appliedAt = awep_port_timer();
+    awepReplNext++;
+    xSemaphoreGive(awepReplLock);
+    if(awepReplStreaming){
+        xTaskNotifyGive(awepReplTask);
+    }
+}
+
+// awepReceiveAll:
+// Wait up to a slot for exactly length bytes, false if they did not come
+static bool awepReceiveAll(void *socket, char *data, uint32_t length){
+    while(length > 0){
+        int32_t received = awep_port_repl_receive(socket, data, length, AWEP_IDLE_SLOT_TICKS);
+        if(received <= 0){
+            return false;
+        }
+        data += received;
+        length -= (uint32_t)received;
+    }
+    return true;
+}
+
+// awepCopy:
+// Send every register to the standby, then the writes from the returned
+// sequence number on complete it. Like a snapshot, whatever the scan catches
+// half way is put right by the writes that follow. 0 if a send failed
+static uint32_t awepCopy(void *socket){
+    dbEntry_t entries[AWEP_REPL_BATCH];
+    char frame[AWEP_REPL_FRAME_MAX];
+    uint32_t key = 0;
+    uint32_t found;
+
+    xSemaphoreTake(awepReplLock, portMAX_DELAY);
+    uint32_t start = awepReplNext;
+    uint32_t runId = awepReplRunId;
+    xSemaphoreGive(awepReplLock);
+
+    frame[0] = 'S';
+    awepPut32(&frame[1], runId);
+    awepPut32(&frame[5], start);
+    if(!awep_port_send(socket, frame, 9u)){
+        return 0;
+    }
+    do{
+        found = dbScan(key, entries, AWEP_REPL_BATCH);
+        if(found == 0){
+            break;
+        }
+        frame[0] = 'Y';
+        frame[1] = (char)found;
+        for(uint32_t i = 0; i < found; i++){
+            awepPutRecord(&frame[2u + i * AWEP_REPL_RECORD_LEN], false,
+                          entries[i].deviceId, entries[i].regId, entries[i].value);
+        }
+        if(!awep_port_send(socket, frame, 2u + found * AWEP_REPL_RECORD_LEN)){
+            return 0;
+        }
+        key = ((entries[found - 1u].deviceId << 8) | entries[found - 1u].regId) + 1u;
+    }while(found == AWEP_REPL_BATCH);
+    frame[0] = 'E';
+    if(!awep_port_send(socket, frame, 1u)){
+        return 0;
+    }
+    awep_stats_add(AWEP_STAT_REPL_COPIES, 1u);
+    return start;
+}
+
+// awepAcked:
+// The standby has applied everything up to seq. The lag is how long ago the
+// database applied that write here, for a write sent in a batch that is still
+// in the history. The ack of a copy says nothing about lag
+static void awepAcked(uint32_t seq, uint32_t firstSent){
+    uint32_t lag = 0;
+    bool timed = false;
+
+    xSemaphoreTake(awepReplLock, portMAX_DELAY);
+    if(seq >= firstSent && seq >= awepOldest() && seq < awepReplNext){
+        lag = awep_port_timer_micros(awep_port_timer() - awepReplHistory[seq % AWEP_REPL_HISTORY].appliedAt);
+        timed = true;
+    }
+    uint32_t behind = awepReplNext - 1u - seq;
+    xSemaphoreGive(awepReplLock);
+
+    awep_stats_set(AWEP_STAT_REPL_BEHIND, behind);
+    if(timed){
+        awep_stats_set(AWEP_STAT_REPL_LAG_US, lag);
+        if(lag > awep_stats_get(AWEP_STAT_REPL_LAG_MAX)){
+            awep_stats_set(AWEP_STAT_REPL_LAG_MAX, lag);
+        }
+    }
+}
+
+// awepServe:
+// Bring a standby up to date, then send it every write in batches as they
+// come. Acks are read after each batch and while waiting for one. The
+// standby is dropped if it falls out of the history, it gets a copy when it
+// connects again
+static void awepServe(void *socket){
+    char hello[9];
+    char frame[AWEP_REPL_FRAME_MAX];
+    char acks[5u * 8u];
+    uint32_t ackHeld = 0;
+    uint32_t send;
+    uint32_t firstSent;
+    uint32_t acked;
+
+    if(!awepReceiveAll(socket, hello, sizeof(hello)) || hello[0] != 'H'){
+        return;
+    }
+    uint32_t runId = awepGet32(&hello[1]);
+    acked = awepGet32(&hello[5]);
+    xSemaphoreTake(awepReplLock, portMAX_DELAY);
+    bool resume = (runId == awepReplRunId && acked + 1u >= awepOldest() && acked < awepReplNext);
+    awepReplStreaming = true;
+    xSemaphoreGive(awepReplLock);
+    if(resume){
+        send = acked + 1u;
+        printf("Standby resumed after write %d\n", (int)acked);
+    }
+    else{
+        send = awepCopy(socket);
+        if(send == 0){
+            awepReplStreaming = false;
+            return;
+        }
+        acked = send - 1u;
+        printf("Standby sent every register, writes follow from %d\n", (int)send);
+    }
+    firstSent = send;
+
+    for(;;){
+        uint32_t count = 0;
+
+        xSemaphoreTake(awepReplLock, portMAX_DELAY);
+        bool lost = (send < awepOldest());
+        while(!lost && count < AWEP_REPL_BATCH && send + count < awepReplNext){
+            const awep_repl_write_t *write = &awepReplHistory[(send + count) % AWEP_REPL_HISTORY];
+            awepPutRecord(&frame[AWEP_REPL_BATCH_HEADER + count * AWEP_REPL_RECORD_LEN], write->removed,
+                          write->deviceId, write->regId, write->value);
+            count++;
+        }
+        xSemaphoreGive(awepReplLock);
+        if(lost){
+            printf("Standby fell more than %d writes behind\n", (int)AWEP_REPL_HISTORY);
+            break;
+        }
+        if(count != 0){
+            frame[0] = 'B';
+            awepPut32(&frame[1], send);
+            frame[5] = (char)count;
+            if(!awep_port_send(socket, frame, AWEP_REPL_BATCH_HEADER + count * AWEP_REPL_RECORD_LEN)){
+                break;
+            }
+            send += count;
+            awep_stats_add(AWEP_STAT_REPL_SENT, count);
+        }
+        else{
+            // nothing to send, wait for a write or, with writes outstanding, a little for their ack
+            ulTaskNotifyTake(pdTRUE, (acked + 1u < send) ? AWEP_REPL_ACK_TICKS : AWEP_IDLE_SLOT_TICKS);
+        }
+
+        int32_t received = awep_port_repl_receive(socket, &acks[ackHeld], sizeof(acks) - ackHeld, 0);
+        if(received < 0){
+            break;
+        }
+        ackHeld += (uint32_t)received;
+        if(ackHeld >= 5u){
+            // only the newest ack matters
+            uint32_t last = (ackHeld / 5u - 1u) * 5u;
+            if(acks[last] != 'A'){
+                break;
+            }
+            acked = awepGet32(&acks[last + 1u]);
+            awepAcked(acked, firstSent);
+            ackHeld -= last + 5u;
+            memmove(acks, &acks[last + 5u], ackHeld);
+        }
+    }
+    awepReplStreaming = false;
+}
+
+// awepApply:
+// Store or remove the registers of a 'Y' or 'B' frame. The standby only drops
+// a register when the primary did, so a full table evicts the same ones on
+// both. False for a record that is neither
+static bool awepApply(const char *records, uint32_t count){
+    for(uint32_t i = 0; i < count; i++){
+        const uint8_t *record = (const uint8_t *)&records[i * AWEP_REPL_RECORD_LEN];
+        dbEntry_t entry = {
+            .deviceId = ((uint32_t)record[1] << 8) | record[2],
+            .regId = record[3],
+            .value = ((uint32_t)record[4] << 8) | record[5]
+        };
+        if(record[0] == 'D'){
+            dbRemove(&entry);
+        }
+        else if(record[0] == 'W'){
+            dbSetValue(&entry);
+        }
+        else{
+            return false;
+        }
+    }
+    return true;
+}
+
+// awepFollow:
+// Apply what the primary sends until the connection goes or the standby is
+// promoted. Frames are taken whole out of the buffer, a partial one waits for
+// the rest
+static void awepFollow(void *socket){
+    char buffer[2u * AWEP_REPL_FRAME_MAX];
+    char frame[9];
+    uint32_t held = 0;
+    uint32_t copyRun = 0;
+    uint32_t copyStart = 0;
+
+    frame[0] = 'H';
+    awepPut32(&frame[1], awepReplFollowedRun);
+    awepPut32(&frame[5], awepReplApplied);
+    if(!awep_port_send(socket, frame, sizeof(frame))){
+        return;
+    }
+    while(awepReplStandby){
+        int32_t received = awep_port_repl_receive(socket, &buffer[held], sizeof(buffer) - held, AWEP_IDLE_SLOT_TICKS);
+        if(received < 0){
+            return;
+        }
+        held += (uint32_t)received;
+
+        uint32_t applied = awepReplApplied;
+        uint32_t used = 0;
+        while(used < held){
+            const char *at = &buffer[used];
+            uint32_t header = (at[0] == 'S') ? 9u : (at[0] == 'E') ? 1u :
+                              (at[0] == 'Y') ? 2u : (at[0] == 'B') ? AWEP_REPL_BATCH_HEADER : 0;
+            if(header == 0){
+                printf("Replication stream out of step\n");
+                return;
+            }
+            if(held - used < header){
+                break;
+            }
+            uint32_t count = (at[0] == 'Y') ? (uint8_t)at[1] : (at[0] == 'B') ? (uint8_t)at[5] : 0;
+            if(count > AWEP_REPL_BATCH){
+                printf("Replication stream out of step\n");
+                return;
+            }
+            uint32_t length = header + count * AWEP_REPL_RECORD_LEN;
+            if(held - used < length){
+                break;
+            }
+            if(at[0] == 'S'){
+                // until the copy is complete a reconnect has to start it over
+                awepReplFollowedRun = 0;
+                copyRun = awepGet32(&at[1]);
+                copyStart = awepGet32(&at[5]);
+            }
+            else if(at[0] == 'Y'){
+                if(!awepApply(&at[2], count)){
+                    printf("Replication stream out of step\n");
+                    return;
+                }
+            }
+            else if(at[0] == 'E'){
+                awepReplFollowedRun = copyRun;
+                awepReplApplied = copyStart - 1u;
+                awep_stats_add(AWEP_STAT_REPL_COPIES, 1u);
+                printf("Copied every register from the primary\n");
+            }
+            else{
+                uint32_t seq = awepGet32(&at[1]);
+                if(awepReplFollowedRun == 0 || seq > awepReplApplied + 1u){
+                    printf("Replication stream out of step\n");
+                    return;
+                }
+                // a batch sent again after a reconnect may start with writes already applied
+                uint32_t skip = awepReplApplied + 1u - seq;
+                if(skip < count){
+                    if(!awepApply(&at[AWEP_REPL_BATCH_HEADER + skip * AWEP_REPL_RECORD_LEN], count - skip)){
+                        printf("Replication stream out of step\n");
+                        return;
+                    }
+                    awepReplApplied = seq + count - 1u;
+                    awep_stats_add(AWEP_STAT_REPL_APPLIED, count - skip);
+                }
+            }
+            used += length;
+        }
+        held -= used;
+        memmove(buffer, &buffer[used], held);
+
+        if(awepReplApplied != applied && awepReplFollowedRun != 0){
+            frame[0] = 'A';
+            awepPut32(&frame[1], awepReplApplied);
+            if(!awep_port_send(socket, frame, 5u)){
+                return;
+            }
+        }
+    }
+}
+
+// awepReplRun:
+// The replication task, following the primary while a standby and serving
+// standbys one at a time once a primary
+static void awepReplRun(void *arg){
+    for(;;){
+        if(awepReplStandby){
+            void *socket = awep_port_repl_connect();
+            if(socket == NULL){
+                vTaskDelay(AWEP_IDLE_SLOT_TICKS);
+                continue;
+            }
+            printf("Following the primary\n");
+            awepFollow(socket);
+            awep_port_close(socket);
+            if(awepReplStandby){
+                printf("Lost the primary, reconnecting\n");
+            }
+        }
+        else{
+            void *socket = awep_port_repl_accept();
+            if(socket == NULL){
+                continue;
+            }
+            printf("Standby connected\n");
+            awepServe(socket);
+            awep_port_close(socket);
+            printf("Standby disconnected\n");
+        }
+    }
+}
+
+uint32_t awep_repl_stack_free(void){
+    return (awepReplTask != NULL) ? (uint32_t)uxTaskGetStackHighWaterMark(awepReplTask) : 0u;
+}
+
+bool awep_repl_start(bool standby){
+    awepReplLock = xSemaphoreCreateMutexStatic(&awepReplLockBuffer);
+    awepReplRunId = (awep_port_timer() ^ xTaskGetTickCount()) | 1u;
+    awepReplStandby = standby;
+    if(xTaskCreate(awepReplRun, "AWEP replication", AWEP_REPL_STACK_SIZE, NULL,
+                   AWEP_REPL_PRIORITY, &awepReplTask) != pdPASS){
+        printf("Failed to start the replication task\n");
+        return false;
+    }
+    printf("Replication: %s\n", standby ? "standby, client writes are turned away" : "primary");
+    return true;
+}
+
+bool awep_repl_is_standby(void){
+    return awepReplStandby;
+}
+
+// awep_repl_promote:
+// A new run ID, so a standby of the old primary gets a full copy from this one
+void awep_repl_promote(void){
+    if(!awepReplStandby){
+        return;
+    }
+    xSemaphoreTake(awepReplLock, portMAX_DELAY);
+    awepReplRunId = (awep_port_timer() ^ xTaskGetTickCount()) | 1u;
+    xSemaphoreGive(awepReplLock);
+    awepReplStandby = false;
+    printf("Promoted to primary after write %d of the old one\n", (int)awepReplApplied);
+}
@@ -0,0 +1,925 @@
+//AWEP request handling, shared by the board and the host builds. Everything
+//platform specific goes through the awep_port_ functions
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include "database.h"
+#include "awep.h"
+#include "awep_pipeline.h"
+#include "awep_stats.h"
+#include "awep_idle.h"
+#include "awep_limit.h"
+#include "awep_udp.h"
+#include "awep_persist.h"
+#include "awep_repl.h"
+#include "awep_server.h"
+
+// Every command and reply is echoed to the console unless this is 0, the host
+// build turns it off to benchmark
+#ifndef AWEP_SERVER_LOG_COMMANDS
+#define AWEP_SERVER_LOG_COMMANDS (1)
+#endif
+
+#if AWEP_SERVER_LOG_COMMANDS
+#define AWEP_SERVER_LOG(...) printf(__VA_ARGS__)
+#else
+#define AWEP_SERVER_LOG(...) do{}while(0)
+#endif
+
+// Clients with commands held back in their framer for want of tokens, by
+// connection index. Only the receive path touches it
+static bool awepHeldBack[AWEP_MAX_CONNECTIONS];
+
+/*******************************************************************************
+* Function Prototypes
+********************************************************************************/
+static void frame_commands(awep_conn_t *conn);
+static uint32_t handle_command(awep_conn_t *conn, char *frame, uint32_t length, bool throttled);
+static awep_status_t run_request(awep_conn_t *conn, const awep_request_t *request,
+                                 dbEntry_t *receive, uint32_t *value);
+static uint32_t encode_reply(char *buffer, bool binary, const awep_request_t *request,
+                             awep_status_t status, const dbEntry_t *receive, uint32_t value);
+static void queue_reply(awep_conn_t *conn, uint32_t length);
+static uint32_t read_range(awep_conn_t *conn, const awep_request_t *request);
+static uint32_t read_stats(awep_conn_t *conn);
+static void refresh_stats(void);
+static void notify_watchers(awep_conn_t *writer, const dbEntry_t *entry);
+static void handle_job(awep_job_t *job);
+static void flush_replies(awep_conn_t *conn);
+static void journal_write(const dbEntry_t *entry, bool removed);
+
+ /*******************************************************************************
+ * Function Name: awep_server_start
+ *******************************************************************************
+ * Summary:
+ *  Set up the register database, restore it from storage and start the
+ *  workers that run the commands the clients send. Without storage the server
+ *  still runs, it just forgets every register on reset.
+ *
+ * Return:
+ *  bool: false if the workers could not be started
+ *
+ *******************************************************************************/
+bool awep_server_start(void)
+{
+    awep_persist_restore_t restore;
+
+    dbInit();
+    awep_conn_init();
+    awep_idle_init(xTaskGetTickCount());
+    awep_limit_init(xTaskGetTickCount());
+    awep_udp_init();
+    printf("Register database: %d entries, %d bytes per entry\n",
+            (int)dbGetMax(), (int)dbGetBytesPerEntry());
+    if(awep_persist_start(&restore)){
+        printf("Restored %d registers from snapshot %d and %d logged writes in %d us\n",
+                (int)restore.snapshotRecords, (int)restore.generation,
+                (int)restore.logRecords, (int)restore.micros);
+    }
+    else{
+        printf("Register storage unavailable, registers are not kept across resets\n");
+    }
+    dbSetJournal(journal_write);
+
+    if(!awep_pipeline_start(handle_job, flush_replies, awep_server_release)){
+        printf("Failed to start the AWEP workers\n");
+        return false;
+    }
+    printf("AWEP workers: %d, %d commands queued each\n", (int)AWEP_WORKERS, (int)AWEP_QUEUE_DEPTH);
+    printf("Idle clients closed after %d ticks\n", (int)AWEP_SERVER_IDLE_TICKS);
+    awep_limit_print();
+    return true;
+}
+
+ /*******************************************************************************
+ * Function Name: awep_server_accept
+ *******************************************************************************
+ * Summary:
+ *  Give a newly accepted socket a connection entry, start its idle timeout and
+ *  fill its rate limit bucket.
+ *  A client over the AWEP_MAX_CONNECTIONS limit is told "X Server Busy" and
+ *  is not served, the port closes its socket.
+ *
+ * Parameters:
+ * void *socket: Socket of the client
+ * uint32_t peerAddress: IPv4 address of the client
+ *
+ * Return:
+ *  awep_conn_t *: Entry of the client, NULL if it was turned away
+ *
+ *******************************************************************************/
+awep_conn_t *awep_server_accept(void *socket, uint32_t peerAddress)
+{
+    char reply[AWEP_REPLY_MAX];
+    uint32_t now = xTaskGetTickCount();
+    awep_conn_t *conn = awep_conn_open(socket, peerAddress, now);
+
+    if(conn != NULL){
+        awep_idle_start(awep_conn_index(conn), now, AWEP_SERVER_IDLE_TICKS);
+        awep_limit_start(awep_conn_index(conn), now);
+        awepHeldBack[awep_conn_index(conn)] = false;
+        return conn;
+    }
+    // ASCII, a binary client still sees a reply it can tell is not a length
+    uint32_t length = awep_encode_error(reply, sizeof(reply), AWEP_ERR_BUSY, 0) + 1u;
+    if(awep_port_send(socket, reply, length)){
+        awep_stats_add(AWEP_STAT_BYTES_OUT, length);
+    }
+    awep_stats_add(AWEP_STAT_REJECTED, 1u);
+    return NULL;
+}
+
+ /*******************************************************************************
+ * Function Name: awep_server_close
+ *******************************************************************************
+ * Summary:
+ *  Close a client the caller holds, after its socket was closed or it went
+ *  idle. Its idle timeout is stopped and what it did is printed, but the
+ *  entry and the socket stay until the last hold on them is released, the
+ *  workers may still have its commands queued.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client to close, NULL if it had no entry
+ *
+ * Return:
+ *  bool: true for the first close of the client, false if it was closed already
+ *
+ *******************************************************************************/
+bool awep_server_close(awep_conn_t *conn)
+{
+    if(conn == NULL || !awep_conn_close(conn)){
+        return false;
+    }
+    awep_idle_stop(awep_conn_index(conn));
+    awep_server_print_client(conn);
+    return true;
+}
+
+ /*******************************************************************************
+ * Function Name: awep_server_release
+ *******************************************************************************
+ * Summary:
+ *  Release a hold on a client. The last hold on a closed client frees its
+ *  entry and has the port delete its socket, from whichever task that is.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client held by awep_conn_get or a queued job
+ *
+ * Return:
+ *  void
+ *
+ *******************************************************************************/
+void awep_server_release(awep_conn_t *conn)
+{
+    void *socket = awep_conn_put(conn);
+
+    if(socket != NULL){
+        awep_port_close(socket);
+    }
+}
+
+ /*******************************************************************************
+ * Function Name: awep_server_reap
+ *******************************************************************************
+ * Summary:
+ *  Close every client whose idle timeout has passed. Only the slots of the
+ *  timer wheel the tick count has moved past are looked at, not every client.
+ *  A client heard from since its slot was taken out is timed again instead.
+ *
+ *******************************************************************************/
+void awep_server_reap(void)
+{
+    uint8_t expired[AWEP_MAX_CONNECTIONS];
+    uint32_t now = xTaskGetTickCount();
+    uint32_t count = awep_idle_expire(now, expired);
+
+    for(uint32_t i = 0; i < count; i++){
+        awep_conn_t *conn = awep_conn_get_at(expired[i]);
+        if(conn == NULL){
+            continue;
+        }
+        uint32_t idle = now - conn->lastActivity;
+        if(idle < AWEP_SERVER_IDLE_TICKS){
+            awep_idle_start(expired[i], conn->lastActivity, AWEP_SERVER_IDLE_TICKS);
+        }
+        else{
+            printf("Closing a client idle for %d ticks\n", (int)idle);
+            awep_stats_add(AWEP_STAT_REAPED, 1u);
+            awep_server_close(conn);
+        }
+        awep_server_release(conn);
+    }
+}
+
+ /*******************************************************************************
+ * Function Name: awep_server_receive
+ *******************************************************************************
+ * Summary:
+ *  Take bytes the port received into the client's framer. Every complete
+ *  command is queued for the workers and a partial command waits for the rest
+ *  of it. Commands held back by the rate limit stay in the framer until
+ *  awep_server_hold lets them through.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client the bytes came from
+ * uint32_t length: Bytes received into the framer's free space
+ *
+ * Return:
+ *  void
+ *
+ *******************************************************************************/
+void awep_server_receive(awep_conn_t *conn, uint32_t length)
+{
+    conn->bytesReceived += length;
+    conn->lastActivity = xTaskGetTickCount();
+    awep_idle_touch(awep_conn_index(conn), conn->lastActivity);
+    awep_stats_add(AWEP_STAT_BYTES_IN, length);
+    awep_framer_commit(&conn->framer, length);
+    if(!awepHeldBack[awep_conn_index(conn)]){
+        frame_commands(conn);
+    }
+}
+
+ /*******************************************************************************
+ * Function Name: awep_server_hold
+ *******************************************************************************
+ * Summary:
+ *  Tell the port how long to hold off reading a client that ran out of
+ *  tokens. Once it has one again the commands waiting in its framer are
+ *  queued, and should they run it out again the port waits a tick more
+ *  rather than read into a framer that may be full.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client the port is about to read
+ *
+ * Return:
+ *  uint32_t: Ticks to wait before reading it, 0 to read it now
+ *
+ *******************************************************************************/
+uint32_t awep_server_hold(awep_conn_t *conn)
+{
+    uint32_t index = awep_conn_index(conn);
+    uint32_t wait = awep_limit_wait(index, xTaskGetTickCount());
+
+    if(wait == 0 && awepHeldBack[index]){
+        frame_commands(conn);
+    }
+    if(!awepHeldBack[index]){
+        return wait;
+    }
+    return (wait != 0) ? wait : 1u;
+}
+
+ /*******************************************************************************
+ * Function Name: frame_commands
+ *******************************************************************************
+ * Summary:
+ *  Queue every complete command in the client's framer, each taking a token
+ *  from the rate limit. A command that finds none is queued to be answered
+ *  "X Throttled". With AWEP_SERVER_HOLD_READS the rest are then held back,
+ *  they would only be turned away too.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client whose framer is read
+ *
+ *******************************************************************************/
+static void frame_commands(awep_conn_t *conn)
+{
+    char frame[AWEP_JOB_FRAME_MAX + 1];
+    uint32_t frame_length;
+    uint32_t index = awep_conn_index(conn);
+
+    awepHeldBack[index] = false;
+    while(awep_framer_next(&conn->framer, frame, sizeof(frame), &frame_length)){
+        bool throttled = !awep_limit_take(index, xTaskGetTickCount());
+        conn->commands++;
+        awep_pipeline_submit(conn, frame, frame_length, throttled);
+        if(throttled && AWEP_SERVER_HOLD_READS){
+            awepHeldBack[index] = true;
+            return;
+        }
+    }
+}
+
+ /*******************************************************************************
+ * Function Name: awep_server_datagram
+ *******************************************************************************
+ * Summary:
+ *  Run the one command of a UDP datagram and write the reply datagram. There
+ *  is no connection, so the command runs right here in the receive path rather
+ *  than on a worker. A request ID the peer sent last time is a retransmission
+ *  and gets the reply it had before, a W or I lost on the way back is not
+ *  applied twice.
+ *
+ * Parameters:
+ * uint32_t peerAddress: IPv4 address of the client
+ * uint16_t peerPort: UDP port of the client
+ * const char *datagram: Request ID and command
+ * uint32_t length: Length of the datagram
+ * char *reply: Room for AWEP_UDP_REPLY_MAX bytes
+ *
+ * Return:
+ *  uint32_t: Length of the reply datagram, 0 if there is nothing to send
+ *
+ *******************************************************************************/
+uint32_t awep_server_datagram(uint32_t peerAddress, uint16_t peerPort,
+                              const char *datagram, uint32_t length, char *reply)
+{
+    char frame[AWEP_UDP_DATAGRAM_MAX + 1];
+    awep_request_t request;
+    awep_status_t status;
+    dbEntry_t receive;
+    uint32_t value = 0;
+    uint32_t frameLength = 0;
+    uint32_t replyLength;
+    bool binary;
+
+    awep_stats_add(AWEP_STAT_DATAGRAMS, 1u);
+    awep_stats_add(AWEP_STAT_BYTES_IN, length);
+    // too short to say which request it is, there is no one to answer
+    if(length <= AWEP_UDP_ID_LEN){
+        return 0;
+    }
+    uint16_t requestId = (uint16_t)(((uint8_t)datagram[0] << 8) | (uint8_t)datagram[1]);
+    const char *cached = awep_udp_lookup(peerAddress, peerPort, requestId, &replyLength);
+    if(cached != NULL){
+        awep_stats_add(AWEP_STAT_RETRANSMITS, 1u);
+        memcpy(reply, cached, replyLength);
+        awep_stats_add(AWEP_STAT_BYTES_OUT, replyLength);
+        return replyLength;
+    }
+
+    uint32_t start = awep_port_timer();
+    datagram += AWEP_UDP_ID_LEN;
+    length -= AWEP_UDP_ID_LEN;
+    binary = awep_is_binary(datagram[0]);
+    if(length > AWEP_UDP_DATAGRAM_MAX - AWEP_UDP_ID_LEN){
+        // decoded only for the command letter of the statistics
+        request.command = datagram[binary ? 1 : 0];
+        status = AWEP_ERR_LENGTH;
+    }
+    else if(binary){
+        memcpy(frame, datagram, length);
+        frameLength = length;
+        status = awep_decode_binary((const uint8_t *)frame, frameLength, &request);
+    }
+    else{
+        // the terminator a TCP command needs is optional here
+        while(frameLength < length && datagram[frameLength] != '\0' &&
+              datagram[frameLength] != '\r' && datagram[frameLength] != '\n'){
+            frame[frameLength] = datagram[frameLength];
+            frameLength++;
+        }
+        frame[frameLength] = '\0';
+        AWEP_SERVER_LOG("Datagram from UDP Client: %s\n", frame);
+        status = awep_decode(frame, frameLength, &request);
+    }
+
+    // the commands that answer with more than one reply need a connection
+    if(status == AWEP_OK && request.command != 'R' && request.command != 'W' &&
+       request.command != 'C' && request.command != 'I'){
+        status = AWEP_ERR_COMMAND;
+    }
+    if(status == AWEP_OK && !awep_limit_take(AWEP_LIMIT_NO_CLIENT, xTaskGetTickCount())){
+        status = AWEP_ERR_THROTTLED;
+    }
+    if(status == AWEP_OK){
+        status = run_request(NULL, &request, &receive, &value);
+    }
+    awep_stats_request(&request, status);
+    replyLength = AWEP_UDP_ID_LEN + encode_reply(reply + AWEP_UDP_ID_LEN, binary, &request, status, &receive, value);
+    reply[0] = (char)(requestId >> 8);
+    reply[1] = (char)requestId;
+    awep_stats_service(awep_port_timer_micros(awep_port_timer() - start));
+
+    // a throttled command did not run, a retransmission of it may
+    if(status != AWEP_ERR_THROTTLED){
+        awep_udp_store(peerAddress, peerPort, requestId, reply, replyLength, xTaskGetTickCount());
+    }
+    awep_stats_add(AWEP_STAT_BYTES_OUT, replyLength);
+    return replyLength;
+}
+
+ /*******************************************************************************
+ * Function Name: awep_server_print_client
+ *******************************************************************************
+ * Summary:
+ *  Print what a client did, and the reply and worker totals so far, when it
+ *  is closed.
+ *
+ * Parameters:
+ * const awep_conn_t *conn: Client that disconnected, NULL if it had no entry
+ *
+ * Return:
+ *  void
+ *
+ *******************************************************************************/
+void awep_server_print_client(const awep_conn_t *conn)
+{
+    if(conn != NULL){
+        printf("Client %d.%d.%d.%d: %d commands, %d bytes received\n",
+                (uint8_t)conn->peerAddress, (uint8_t)(conn->peerAddress >> 8),
+                (uint8_t)(conn->peerAddress >> 16), (uint8_t)(conn->peerAddress >> 24),
+                (int)conn->commands, (int)conn->bytesReceived);
+    }
+    const awep_writer_stats_t *stats = awep_writer_get_stats();
+    printf("Replies sent: %d in %d sends, %d bytes\n",
+            (int)stats->replies, (int)stats->sends, (int)stats->bytesSent);
+    awep_pipeline_stats_t pipeline;
+    awep_pipeline_get_stats(&pipeline);
+    if(pipeline.jobs != 0){
+        printf("Workers: %d commands, queue depth max %d, queue full %d times\n",
+                (int)pipeline.jobs, (int)pipeline.maxDepth, (int)pipeline.queueFull);
+        printf("Ticks per command: queued %d (max %d), run %d, send %d\n",
+                (int)(pipeline.waitTicks / pipeline.jobs), (int)pipeline.maxWaitTicks,
+                (int)(pipeline.serviceTicks / pipeline.jobs), (int)(pipeline.flushTicks / pipeline.jobs));
+    }
+    if(pipeline.notifications != 0 || pipeline.notifyDropped != 0){
+        printf("Notifications: %d sent, %d dropped, ticks from write to send %d (max %d)\n",
+                (int)pipeline.notifications, (int)pipeline.notifyDropped,
+                (int)(pipeline.notifyTicks / (pipeline.notifications ? pipeline.notifications : 1u)),
+                (int)pipeline.maxNotifyTicks);
+    }
+}
+
+
+/*******************************************************************************
+* Function Name: sendAck
+*******************************************************************************
+* Summary:
+* Function to send acknowledgements to tcp client, from a worker task. Every
+* reply queued in the writer goes out in one send, each only as long as it
+* needs to be.
+*
+* Parameters:
+* awep_conn_t *conn: Client whose queued replies are sent
+*
+* Return:
+*  bool: true if the replies were sent
+*
+*******************************************************************************/
+static bool sendAck(awep_conn_t *conn){
+
+	awep_writer_t *writer = &conn->writer;
+
+	/* Send the replies through the port. */
+	if(awep_port_send(conn->socket, writer->buffer, writer->length)){
+		awep_stats_add(AWEP_STAT_BYTES_OUT, writer->length);
+		awep_writer_sent(writer);
+		return true;
+	}
+	/* The port's receive and disconnection handling owns the socket, a closed
+	 * client is cleaned up there. */
+	awep_writer_init(writer);
+	printf("Failed to send ack to client\n");
+	return false;
+}
+
+ /*******************************************************************************
+ * Function Name: handle_command
+ *******************************************************************************
+ * Summary:
+ *  Decode one AWEP command, run it against the register database or the
+ *  client's watches and encode the reply on the client's writer, NUL
+ *  terminated for ASCII. The reply is left for the caller to commit, a range
+ *  read queues its registers ahead of it.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client the command came from
+ * char *frame: Command from the stream framer
+ * uint32_t length: Length of the command
+ * bool throttled: The command is over the rate limit and is not run
+ *
+ * Return:
+ *  uint32_t: Length of the reply
+ *
+ *******************************************************************************/
+static uint32_t handle_command(awep_conn_t *conn, char *frame, uint32_t length, bool throttled)
+{
+    bool binary = conn->framer.binary;
+    dbEntry_t receive;
+    awep_request_t request;
+    awep_status_t status;
+    // register value, the entry count when the database is full or the registers a G found
+    uint32_t value = 0;
+
+    if(binary){
+        status = awep_decode_binary((const uint8_t *)frame, length, &request);
+    }
+    else{
+        AWEP_SERVER_LOG("Message from TCP Client: %s\n", frame);
+        // Check the length, the command and that the rest are ASCII hex digits
+        status = awep_decode(frame, length, &request);
+    }
+
+    // Over its rate limit the command is answered but not run
+    if(status == AWEP_OK && throttled){
+        status = AWEP_ERR_THROTTLED;
+    }
+    if(status == AWEP_OK){
+        status = run_request(conn, &request, &receive, &value);
+    }
+
+    awep_stats_request(&request, status);
+    return encode_reply(awep_writer_space(&conn->writer), binary, &request, status, &receive, value);
+}
+
+ /*******************************************************************************
+ * Function Name: run_request
+ *******************************************************************************
+ * Summary:
+ *  Run a decoded command against the register database or the client's
+ *  watches.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client the command came from, NULL for a datagram, which
+ *                    never carries a watch, range or statistics read
+ * const awep_request_t *request: Decoded command
+ * dbEntry_t *receive: Register the command is for, with its value afterwards
+ * uint32_t *value: Value for the reply, the register value, the entry count
+ *                  when the database is full or the registers a G found
+ *
+ * Return:
+ *  awep_status_t: Outcome of the command
+ *
+ *******************************************************************************/
+static awep_status_t run_request(awep_conn_t *conn, const awep_request_t *request,
+                                 dbEntry_t *receive, uint32_t *value)
+{
+    awep_status_t status = AWEP_OK;
+
+    receive->deviceId = request->deviceId;
+    receive->regId = request->regId;
+    receive->value = request->value;
+
+    // A standby only takes writes from its primary
+    if(awep_repl_is_standby() &&
+       (request->command == 'W' || request->command == 'C' || request->command == 'I')){
+        return AWEP_ERR_READ_ONLY;
+    }
+    // Watch commands, the reply carries the number of watches the client holds
+    if(request->command == 'S' || request->command == 'U'){
+        status = awep_conn_watch(conn, request->deviceId, request->regId, request->command == 'S');
+        *value = conn->watches.count;
+    }
+    // Write command
+    else if(request->command == 'W'){
+        //Save it, this fails only if the device is new and there is no room to add it
+        if(dbSetValue(receive)){
+            *value = receive->value;
+            notify_watchers(conn, receive);
+        }
+        else{
+            status = AWEP_ERR_FULL;
+            *value = dbGetCount();
+        }
+    }
+    // Compare and swap, the reply carries the current value when it does not match
+    else if(request->command == 'C'){
+        dbUpdate_t update = dbCompareAndSet(receive, request->expected);
+        *value = receive->value;
+        if(update == DB_MISMATCH){
+            status = AWEP_ERR_MISMATCH;
+        }
+        else if(update == DB_NOT_FOUND){
+            status = AWEP_ERR_NOT_FOUND;
+        }
+        else{
+            notify_watchers(conn, receive);
+        }
+    }
+    // Increment, the ack carries the value after the add
+    else if(request->command == 'I'){
+        if(dbAdd(receive, request->value) == DB_UPDATED){
+            *value = receive->value;
+            notify_watchers(conn, receive);
+        }
+        else{
+            status = AWEP_ERR_FULL;
+            *value = dbGetCount();
+        }
+    }
+    // Range read, every register found is queued ahead of the reply
+    else if(request->command == 'G'){
+        *value = read_range(conn, request);
+    }
+    // Statistics, every counter is queued ahead of the reply
+    else if(request->command == 'T'){
+        *value = read_stats(conn);
+    }
+    //read, look through the database to find a previous write of the deviceId/regId
+    else if(dbFind(receive)){
+        *value = receive->value;
+    }
+    else{
+        status = AWEP_ERR_NOT_FOUND;
+    }
+    return status;
+}
+
+ /*******************************************************************************
+ * Function Name: encode_reply
+ *******************************************************************************
+ * Summary:
+ *  Encode the reply to a command, NUL terminated for ASCII.
+ *
+ * Parameters:
+ * char *buffer: Room for AWEP_REPLY_MAX bytes
+ * bool binary: The command was binary
+ * const awep_request_t *request: Decoded command
+ * awep_status_t status: Outcome of the command
+ * const dbEntry_t *receive: Register the command was for, used for an ack
+ * uint32_t value: Value for the reply, see run_request
+ *
+ * Return:
+ *  uint32_t: Length of the reply
+ *
+ *******************************************************************************/
+static uint32_t encode_reply(char *buffer, bool binary, const awep_request_t *request,
+                             awep_status_t status, const dbEntry_t *receive, uint32_t value)
+{
+    uint32_t replyLength;
+
+    if(binary){
+        AWEP_SERVER_LOG("Binary command %c: status %d\n", request->command, (int)status);
+        return awep_encode_binary_reply((uint8_t *)buffer, AWEP_REPLY_MAX, status, value);
+    }
+
+    if(status == AWEP_OK && (request->command == 'G' || request->command == 'T')){
+        replyLength = awep_encode_range_end(buffer, AWEP_REPLY_MAX, request->deviceId, value);
+    }
+    else if(status == AWEP_OK && (request->command == 'S' || request->command == 'U')){
+        replyLength = awep_encode_watch_ack(buffer, AWEP_REPLY_MAX, request->deviceId, request->regId);
+    }
+    else if(status == AWEP_OK){
+        replyLength = awep_encode_ack(buffer, AWEP_REPLY_MAX, receive->deviceId, receive->regId, value);
+    }
+    else{
+        replyLength = awep_encode_error(buffer, AWEP_REPLY_MAX, status, value);
+    }
+    AWEP_SERVER_LOG("ack: %s\n", buffer);
+    return replyLength + 1u;
+}
+
+ /*******************************************************************************
+ * Function Name: queue_reply
+ *******************************************************************************
+ * Summary:
+ *  Commit a reply encoded on the client's writer. The replies are sent early
+ *  once AWEP_SERVER_MAX_BATCH of them are waiting or the writer is full.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client the reply is for
+ * uint32_t length: Length of the reply
+ *
+ * Return:
+ *  void
+ *
+ *******************************************************************************/
+static void queue_reply(awep_conn_t *conn, uint32_t length)
+{
+    awep_writer_commit(&conn->writer, length);
+    if(conn->writer.count == AWEP_SERVER_MAX_BATCH || awep_writer_full(&conn->writer)){
+        sendAck(conn);
+    }
+}
+
+ /*******************************************************************************
+ * Function Name: read_range
+ *******************************************************************************
+ * Summary:
+ *  Queue every register of a G, in regId order, reading AWEP_SERVER_MAX_BATCH
+ *  of them from the ordered index at a time.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client the command came from
+ * const awep_request_t *request: Device, first regId and last regId (value)
+ *
+ * Return:
+ *  uint32_t: Number of registers queued
+ *
+ *******************************************************************************/
+static uint32_t read_range(awep_conn_t *conn, const awep_request_t *request)
+{
+    dbEntry_t entries[AWEP_SERVER_MAX_BATCH];
+    uint32_t firstReg = request->regId;
+    uint32_t count = 0;
+    uint32_t found;
+
+    while(firstReg <= request->value){
+        found = dbRange(request->deviceId, firstReg, request->value, entries, AWEP_SERVER_MAX_BATCH);
+        for(uint32_t i = 0; i < found; i++){
+            char *space = awep_writer_space(&conn->writer);
+            if(conn->framer.binary){
+                queue_reply(conn, awep_encode_binary_record((uint8_t *)space, AWEP_REPLY_MAX,
+                                                            entries[i].regId, entries[i].value));
+            }
+            else{
+                queue_reply(conn, awep_encode_ack(space, AWEP_REPLY_MAX, entries[i].deviceId,
+                                                  entries[i].regId, entries[i].value) + 1u);
+            }
+        }
+        count += found;
+        if(found < AWEP_SERVER_MAX_BATCH){
+            break;
+        }
+        firstReg = entries[found - 1u].regId + 1u;
+    }
+    return count;
+}
+
+ /*******************************************************************************
+ * Function Name: read_stats
+ *******************************************************************************
+ * Summary:
+ *  Queue every statistics counter of a T, in index order.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client the command came from
+ *
+ * Return:
+ *  uint32_t: Number of counters queued
+ *
+ *******************************************************************************/
+static uint32_t read_stats(awep_conn_t *conn)
+{
+    refresh_stats();
+    for(uint32_t i = 0; i < AWEP_STAT_COUNT; i++){
+        char *space = awep_writer_space(&conn->writer);
+        uint32_t value = awep_stats_get((awep_stat_t)i);
+        if(conn->framer.binary){
+            queue_reply(conn, awep_encode_binary_stat((uint8_t *)space, AWEP_REPLY_MAX, i, value));
+        }
+        else{
+            queue_reply(conn, awep_encode_stat(space, AWEP_REPLY_MAX, i, value) + 1u);
+        }
+    }
+    return AWEP_STAT_COUNT;
+}
+
+ /*******************************************************************************
+ * Function Name: refresh_stats
+ *******************************************************************************
+ * Summary:
+ *  Set the gauges, the connections and the register database occupancy, to
+ *  their current values.
+ *
+ *******************************************************************************/
+static void refresh_stats(void)
+{
+    awep_stats_set(AWEP_STAT_CONNECTIONS, awep_conn_count());
+    awep_stats_set(AWEP_STAT_DB_COUNT, dbGetCount());
+    awep_stats_set(AWEP_STAT_DB_HIGH_WATER, dbGetHighWater());
+    awep_stats_set(AWEP_STAT_DB_MAX, dbGetMax());
+    awep_stats_set(AWEP_STAT_DB_EVICTIONS, dbGetEvictions());
+}
+
+ /*******************************************************************************
+ * Function Name: awep_server_print_stats
+ *******************************************************************************
+ * Summary:
+ *  Dump every statistics counter to the console, the histogram as the range
+ *  of microseconds each bucket covers, then the stack the worker and
+ *  replication tasks have never used, what their stack sizes are set from.
+ *
+ *******************************************************************************/
+void awep_server_print_stats(void)
+{
+    refresh_stats();
+    printf("===============================================================\n");
+    for(uint32_t i = 0; i < AWEP_STAT_SERVICE_HISTOGRAM; i++){
+        printf("%-20s %lu\n", awep_stats_name((awep_stat_t)i),
+                (unsigned long)awep_stats_get((awep_stat_t)i));
+    }
+    for(uint32_t i = 0; i < AWEP_STATS_BUCKETS; i++){
+        uint32_t low = (i == 0) ? 0u : (1u << (i - 1u));
+        unsigned long count = (unsigned long)awep_stats_get((awep_stat_t)(AWEP_STAT_SERVICE_HISTOGRAM + i));
+        if(i == AWEP_STATS_BUCKETS - 1u){
+            // the last bucket has no upper end
+            printf("%-10s %5lu+     %lu\n", awep_stats_name(AWEP_STAT_SERVICE_HISTOGRAM), (unsigned long)low, count);
+        }
+        else{
+            printf("%-10s %5lu-%-5lu%lu\n", awep_stats_name(AWEP_STAT_SERVICE_HISTOGRAM), (unsigned long)low,
+                    (unsigned long)((1u << i) - 1u), count);
+        }
+    }
+    awep_pipeline_stats_t pipeline;
+    awep_pipeline_get_stats(&pipeline);
+    printf("stack words never used: workers %lu of %lu",
+            (unsigned long)pipeline.stackFree, (unsigned long)AWEP_WORKER_STACK_SIZE);
+    // the secure server does not start replication
+    if(awep_repl_stack_free() != 0){
+        printf(", replication %lu of %lu",
+                (unsigned long)awep_repl_stack_free(), (unsigned long)AWEP_REPL_STACK_SIZE);
+    }
+    printf("\n");
+    printf("===============================================================\n");
+}
+
+ /*******************************************************************************
+ * Function Name: notify_watchers
+ *******************************************************************************
+ * Summary:
+ *  Queue a notification of an accepted write for every other client watching
+ *  the register. Each goes through the worker that owns the client, so it is
+ *  sent in order with that client's replies. The watchers are held while
+ *  they are notified, this runs on a worker or the UDP callback and any of
+ *  them may be closing meanwhile.
+ *
+ * Parameters:
+ * awep_conn_t *writer: Client that sent the W, it already gets the ack
+ * const dbEntry_t *entry: Register written and its new value
+ *
+ * Return:
+ *  void
+ *
+ *******************************************************************************/
+static void notify_watchers(awep_conn_t *writer, const dbEntry_t *entry)
+{
+    awep_conn_t *watchers[AWEP_MAX_CONNECTIONS];
+    uint32_t count = awep_conn_watchers(writer, entry->deviceId, entry->regId, watchers);
+
+    for(uint32_t i = 0; i < count; i++){
+        awep_pipeline_notify(watchers[i], entry->deviceId, entry->regId, entry->value);
+        awep_server_release(watchers[i]);
+    }
+}
+
+ /*******************************************************************************
+ * Function Name: handle_job
+ *******************************************************************************
+ * Summary:
+ *  Run one queued command, or encode one notification, on a worker task and
+ *  queue the result.
+ *
+ * Parameters:
+ * awep_job_t *job: Command or notification and the client it is for
+ *
+ * Return:
+ *  void
+ *
+ *******************************************************************************/
+static void handle_job(awep_job_t *job)
+{
+    awep_conn_t *conn = job->conn;
+    char *space = awep_writer_space(&conn->writer);
+    uint32_t length;
+
+    if(job->kind == AWEP_JOB_COMMAND){
+        uint32_t start = awep_port_timer();
+        length = handle_command(conn, job->frame, job->length, job->throttled);
+        awep_stats_service(awep_port_timer_micros(awep_port_timer() - start));
+    }
+    else if(conn->framer.binary){
+        length = awep_encode_binary_notify((uint8_t *)space, AWEP_REPLY_MAX,
+                                           job->deviceId, job->regId, job->value);
+    }
+    else{
+        length = awep_encode_notify(space, AWEP_REPLY_MAX, job->deviceId, job->regId, job->value) + 1u;
+    }
+    queue_reply(conn, length);
+}
+
+ /*******************************************************************************
+ * Function Name: flush_replies
+ *******************************************************************************
+ * Summary:
+ *  Send the replies a worker has queued for a client once it has no more of
+ *  that client's commands waiting.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client to send to
+ *
+ * Return:
+ *  void
+ *
+ *******************************************************************************/
+static void flush_replies(awep_conn_t *conn)
+{
+    if(conn->writer.count != 0){
+        sendAck(conn);
+    }
+}
+
+ /*******************************************************************************
+ * Function Name: journal_write
+ *******************************************************************************
+ * Summary:
+ *  The database journal, every register write goes to the write log and to
+ *  the standby in the order the database applied them. So does every register
+ *  evicted, or a restart or the standby would bring it back.
+ *
+ * Parameters:
+ * const dbEntry_t *entry: Register written and its new value
+ * bool removed: The register was taken out instead
+ *
+ * Return:
+ *  void
+ *
+ *******************************************************************************/
+static void journal_write(const dbEntry_t *entry, bool removed)
+{
+    awep_persist_journal(entry, removed);
+    awep_repl_journal(entry, removed);
+}
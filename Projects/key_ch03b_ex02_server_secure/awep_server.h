@@ -0,0 +1,69 @@
+#ifndef AWEP_SERVER_H_
+#define AWEP_SERVER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "awep_conn.h"
+
+// Most replies to pipelined commands coalesced into one send
+#ifndef AWEP_SERVER_MAX_BATCH
+#define AWEP_SERVER_MAX_BATCH (16u)
+#endif
+
+// A port that can hold off reading a client, the host's poll loop, sets this
+// to 1 and asks awep_server_hold before every read. Commands past the one that
+// ran out of tokens then stay in the framer and the socket until the client
+// has tokens again. Otherwise each of them is answered "X Throttled"
+#ifndef AWEP_SERVER_HOLD_READS
+#define AWEP_SERVER_HOLD_READS (0)
+#endif
+
+// Ticks a client may stay silent before it is disconnected
+#ifndef AWEP_SERVER_IDLE_TICKS
+#define AWEP_SERVER_IDLE_TICKS (60000u)
+#endif
+
+//set up the register database, restore it from storage and start the workers
+bool awep_server_start(void);
+//give a newly accepted socket a connection entry. When the table is full the
+//client gets "X Server Busy" in ASCII, as it has not said which protocol it
+//speaks, and NULL is returned for the port to close the socket
+awep_conn_t *awep_server_accept(void *socket, uint32_t peerAddress);
+//close a client the caller holds, once its socket has closed. conn may be
+//NULL. False if it was closed already
+bool awep_server_close(awep_conn_t *conn);
+//release a hold from awep_conn_get, the last one on a closed client deletes
+//its socket through awep_port_close
+void awep_server_release(awep_conn_t *conn);
+//close every client that has been idle for AWEP_SERVER_IDLE_TICKS, called
+//at least every AWEP_IDLE_SLOT_TICKS from the task that owns the listener
+void awep_server_reap(void);
+//frame and queue the commands in length bytes received into conn's framer
+void awep_server_receive(awep_conn_t *conn, uint32_t length);
+//ticks to hold off reading conn, 0 to read it now. Once the client has a
+//token again the commands held back in its framer are queued first. Only for
+//AWEP_SERVER_HOLD_READS
+uint32_t awep_server_hold(awep_conn_t *conn);
+//run the command of a UDP datagram from a peer and write the reply datagram into
+//reply, AWEP_UDP_REPLY_MAX bytes. A retransmitted request ID gets the reply it
+//had before without running again. Returns the reply length, 0 for none
+uint32_t awep_server_datagram(uint32_t peerAddress, uint16_t peerPort,
+                              const char *datagram, uint32_t length, char *reply);
+//print what a client did when it disconnects, conn may be NULL
+void awep_server_print_client(const awep_conn_t *conn);
+//dump every statistics counter to the console
+void awep_server_print_stats(void);
+
+// Provided by the port, tcp_server.c on the board
+
+//send length bytes to the client's socket, false if the send failed
+bool awep_port_send(void *socket, const char *data, uint32_t length);
+//disconnect and delete a socket. For a client it is called with the last
+//hold released, from a callback, a worker or the reaper
+void awep_port_close(void *socket);
+//free running timer for the service time histogram
+uint32_t awep_port_timer(void);
+//microseconds in a span of awep_port_timer
+uint32_t awep_port_timer_micros(uint32_t span);
+
+#endif
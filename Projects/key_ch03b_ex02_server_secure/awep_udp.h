@@ -0,0 +1,24 @@
+#ifndef AWEP_UDP_H_
+#define AWEP_UDP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "awep.h"
+
+// UDP peers whose last reply is kept to answer a retransmission. A peer has one
+// request outstanding at a time, so its last reply is the only one it can ask
+// for again. The least recently heard from peer gives up its entry
+#ifndef AWEP_UDP_PEERS
+#define AWEP_UDP_PEERS (8u)
+#endif
+
+//empty the reply cache, before the UDP socket is opened
+void awep_udp_init(void);
+//the reply already sent for a peer's request, NULL if the request is new. Only
+//called from the one task that receives the datagrams, so it takes no lock
+const char *awep_udp_lookup(uint32_t address, uint16_t port, uint16_t requestId, uint32_t *length);
+//keep the reply sent for a peer's request, length is at most AWEP_UDP_REPLY_MAX
+void awep_udp_store(uint32_t address, uint16_t port, uint16_t requestId,
+                    const char *reply, uint32_t length, uint32_t now);
+
+#endif
@@ -54,22 +54,41 @@
 #include "cy_wcm_error.h"
 
 /* Standard C header file */
-#include <stdlib.h>
 #include <string.h>
 
 /* TCP server task header file. */
 #include "tcp_server.h"
 
-/* Linked list */
-#include "linkedList.h"
+/* Table of connected clients */
+#include "awep_conn.h"
 
-/* isxdigit() */
-#include <ctype.h>
+/* AWEP request handling */
+#include "awep_server.h"
+
+/* Idle timer wheel, for the slot length */
+#include "awep_idle.h"
+
+/* Register snapshot and write log in flash */
+#include "awep_persist.h"
+
+/* Replication hooks of the shared sources, unused here */
+#include "awep_repl.h"
+
+/* lwIP configuration, for the TCP connection limit */
+#include "lwipopts.h"
 
 /* mDNS */
 #include "mdns.h"
 #include "cy_network_mw_core.h"
 
+/* Every client holds a TCP PCB for as long as it is connected, and so does
+ * every connection waiting to be accepted and the one being turned away. */
+#if (AWEP_MAX_CONNECTIONS + TCP_SERVER_MAX_PENDING_CONNECTIONS + 1 > MEMP_NUM_TCP_PCB)
+#error "AWEP_MAX_CONNECTIONS and the pending connections must fit in MEMP_NUM_TCP_PCB"
+#endif
+
+/* Interrupt priority of the user button that dumps the statistics */
+#define USER_BTN_INTR_PRIORITY (5)
 
 /*******************************************************************************
 * Function Prototypes
@@ -79,16 +98,17 @@ cy_rslt_t connect_to_wifi_ap(void);
 cy_rslt_t tcp_connection_handler(cy_socket_t socket_handle, void *arg);
 cy_rslt_t tcp_receive_msg_handler(cy_socket_t socket_handle, void *arg);
 cy_rslt_t tcp_disconnection_handler(cy_socket_t socket_handle, void *arg);
+static void isr_button_press(void *callback_arg, cyhal_gpio_event_t event);
 
 /*******************************************************************************
 * Global Variables
 ********************************************************************************/
 /* Secure socket variables. */
-cy_socket_sockaddr_t tcp_server_addr, peer_addr;
-cy_socket_t server_handle, client_handle;
+cy_socket_sockaddr_t tcp_server_addr;
+cy_socket_t server_handle;
 
-/* Size of the peer socket address. */
-uint32_t peer_addr_len;
+/* Task to wake when the user button is pressed, created in main.c */
+extern TaskHandle_t server_task_handle;
 
 /* Flags to track the LED state. */
 bool led_state = CYBSP_LED_STATE_OFF;
@@ -136,6 +156,25 @@ void tcp_server_task(void *arg)
     }
     printf("Secure Socket initialized\n");
 
+    /* Time each command, and the restore of the registers, with the cycle
+     * counter. */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    /* Start the register database, restore it from flash and start the
+     * workers that run the commands the clients send. */
+    if(!awep_server_start())
+    {
+        CY_ASSERT(0);
+    }
+
+    /* The user button dumps the statistics to the console. */
+    cyhal_gpio_callback_data_t cb_data = {.callback = isr_button_press, .callback_arg = NULL};
+    cyhal_gpio_init(CYBSP_USER_BTN, CYHAL_GPIO_DIR_INPUT, CYHAL_GPIO_DRIVE_PULLUP, CYBSP_BTN_OFF);
+    cyhal_gpio_register_callback(CYBSP_USER_BTN, &cb_data);
+    cyhal_gpio_enable_event(CYBSP_USER_BTN, CYHAL_GPIO_IRQ_FALL, USER_BTN_INTR_PRIORITY, true);
+
     /* Start mDNS responder */
 	err_t error;
 	mdns_resp_init();
@@ -196,6 +235,16 @@ void tcp_server_task(void *arg)
 
     while(true)
     {
+        /* Wait for a button press or the next slot of the idle timer wheel,
+         * the clients are served by the callbacks and the workers. */
+        if(ulTaskNotifyTake(pdTRUE, AWEP_IDLE_SLOT_TICKS) != 0)
+        {
+            awep_server_print_stats();
+        }
+        awep_server_reap();
+
+        /* Write the register writes of the last slot to flash. */
+        awep_persist_service();
     }
  }
 
@@ -389,13 +438,27 @@ cy_rslt_t create_tcp_server_socket(void)
 cy_rslt_t tcp_connection_handler(cy_socket_t socket_handle, void *arg)
 {
     cy_rslt_t result;
+    cy_socket_t client_handle;
+    cy_socket_sockaddr_t peer_addr;
+    uint32_t peer_addr_len = sizeof(peer_addr);
 
     /* Accept new incoming connection from a TCP client.*/
     result = cy_socket_accept(socket_handle, &peer_addr, &peer_addr_len,
                               &client_handle);
     if(result == CY_RSLT_SUCCESS)
     {
-        printf("Incoming TCP connection accepted\n");
+        /* Give the client its own framer, reply queue and statistics. */
+        if(awep_server_accept(client_handle, peer_addr.ip_address.ip.v4) != NULL)
+        {
+            printf("Incoming TCP connection accepted, %d of %d clients\n",
+                    (int)awep_conn_count(), (int)AWEP_MAX_CONNECTIONS);
+        }
+        else
+        {
+            printf("Connection table full, turned the new connection away\n");
+            cy_socket_disconnect(client_handle, 0);
+            cy_socket_delete(client_handle);
+        }
     }
     else
     {
@@ -408,54 +471,137 @@ cy_rslt_t tcp_connection_handler(cy_socket_t socket_handle, void *arg)
     return result;
 }
 /*******************************************************************************
-* Function Name: sendAck
+* Function Name: awep_port_send
 *******************************************************************************
 * Summary:
-* Function to send acknowledgement to tcp client.
+* Send queued replies to a tcp client, called from a worker task.
 *
 * Parameters:
-* char *message: message to send
-* cy_socket_t socket_handle: Connection handle for the TCP client socket
+* void *socket: cy_socket_t of the client
+* const char *data: Replies to send
+* uint32_t length: Bytes to send
 *
 * Return:
-*  void
+*  bool: true if the replies were sent
 *
 *******************************************************************************/
-void sendAck(char *message, cy_socket_t socket_handle){
+bool awep_port_send(void *socket, const char *data, uint32_t length){
 
 	cy_rslt_t result;
 	uint32_t bytes_sent;
 
-	/* Send the command to TCP server. */
-	result = cy_socket_send(socket_handle, message, MAX_TCP_DATA_PACKET_LENGTH, CY_SOCKET_FLAGS_NONE, &bytes_sent);
-	if(result == CY_RSLT_SUCCESS ){
-		printf("ack sent: %s\n", message);
+	/* Send the replies to the TCP client. */
+	result = cy_socket_send(socket, data, length, CY_SOCKET_FLAGS_NONE, &bytes_sent);
+	if(result != CY_RSLT_SUCCESS){
+		printf("cy_socket_send failed. Error: %d\n", (int)result);
 	}
-	else{
-		printf("Failed to send ack to client. Error: %d\n", (int)result);
-		if(result == CY_RSLT_MODULE_SECURE_SOCKETS_CLOSED)
-		{
-			/* Disconnect the socket. */
-			cy_socket_disconnect(socket_handle, 0);
-			if(result != CY_RSLT_SUCCESS){
-				printf("Disconnect Failed!\n");
-				CY_ASSERT(0);
-			}
-			/* Delete the client socket. */
-			result = cy_socket_delete(socket_handle);
-			if(result != CY_RSLT_SUCCESS){
-				printf("Socket Delete Failed!\n");
-				CY_ASSERT(0);
-			}
-		}
+	return result == CY_RSLT_SUCCESS;
+}
+
+/*******************************************************************************
+* Function Name: awep_port_close
+*******************************************************************************
+* Summary:
+* Disconnect and delete the socket of a closed client once nothing holds it,
+* called from a callback, a worker task or tcp_server_task.
+*
+* Parameters:
+* void *socket: cy_socket_t of the client
+*
+* Return:
+*  void
+*
+*******************************************************************************/
+void awep_port_close(void *socket){
+
+	if(cy_socket_disconnect(socket, 0) != CY_RSLT_SUCCESS){
+		printf("Disconnect Failed!\n");
+	}
+	if(cy_socket_delete(socket) != CY_RSLT_SUCCESS){
+		printf("Socket Delete Failed!\n");
 	}
 }
 
+ /*******************************************************************************
+ * Function Name: awep_port_repl_accept, awep_port_repl_connect,
+ *                awep_port_repl_receive
+ *******************************************************************************
+ * Summary:
+ *  This server does not replicate: a plain TCP replication port would hand a
+ *  copy of every register to anyone, bypassing TLS. awep_repl_start is never
+ *  called, the shared awep_repl.c only needs these to link.
+ *
+ *******************************************************************************/
+void *awep_port_repl_accept(void)
+{
+    return NULL;
+}
+
+void *awep_port_repl_connect(void)
+{
+    return NULL;
+}
+
+int32_t awep_port_repl_receive(void *socket, char *data, uint32_t length, uint32_t ticks)
+{
+    return -1;
+}
+
+ /*******************************************************************************
+ * Function Name: awep_port_timer
+ *******************************************************************************
+ * Summary:
+ *  The DWT cycle counter, started by tcp_server_task.
+ *
+ *******************************************************************************/
+uint32_t awep_port_timer(void)
+{
+    return DWT->CYCCNT;
+}
+
+ /*******************************************************************************
+ * Function Name: awep_port_timer_micros
+ *******************************************************************************
+ * Summary:
+ *  Convert a span of the DWT cycle counter to microseconds.
+ *
+ *******************************************************************************/
+uint32_t awep_port_timer_micros(uint32_t span)
+{
+    return span / (SystemCoreClock / 1000000u);
+}
+
+ /*******************************************************************************
+ * Function Name: isr_button_press
+ *******************************************************************************
+ * Summary:
+ *  GPIO interrupt service routine, wakes the server task to dump the
+ *  statistics.
+ *
+ * Parameters:
+ *  void *callback_arg : pointer to variable passed to the ISR
+ *  cyhal_gpio_event_t event : GPIO event type
+ *
+ * Return:
+ *  None
+ *
+ *******************************************************************************/
+static void isr_button_press(void *callback_arg, cyhal_gpio_event_t event)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    vTaskNotifyGiveFromISR(server_task_handle, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
  /*******************************************************************************
  * Function Name: tcp_receive_msg_handler
  *******************************************************************************
  * Summary:
- *  Callback function to handle incoming TCP client messages.
+ *  Callback function to handle incoming TCP client messages. The bytes go
+ *  through the stream framer so every complete command in the segment is
+ *  handled and a partial command waits for the rest of it. The commands are
+ *  only queued here, the worker tasks run them and send the replies.
  *
  * Parameters:
  * cy_socket_t socket_handle: Connection handle for the TCP client socket
@@ -467,104 +613,34 @@ void sendAck(char *message, cy_socket_t socket_handle){
  *******************************************************************************/
 cy_rslt_t tcp_receive_msg_handler(cy_socket_t socket_handle, void *arg)
 {
-    char message_buffer[MAX_TCP_RECV_BUFFER_SIZE];
+    char *space;
     cy_rslt_t result;
 
-    // linked list to store connection information in
-	static dbEntry_t head = {
-		.next = NULL,
-		.deviceId = 0,
-		.regId = 0
-	};
-    dbEntry_t receive;
-    char commandId;
+    /* Client the message came from, held until it is handled. */
+    awep_conn_t *conn = awep_conn_get(socket_handle);
+    if(conn == NULL)
+    {
+        printf("Message from a client that is not in the connection table\n");
+        return CY_RSLT_MODULE_SECURE_SOCKETS_INVALID_SOCKET;
+    }
 
     /* Variable to store number of bytes received from TCP client. */
     uint32_t bytes_received = 0;
-    result = cy_socket_recv(socket_handle, message_buffer, MAX_TCP_RECV_BUFFER_SIZE,
+    /* Receive straight into the free space of the framer. */
+    uint32_t space_length = awep_framer_space(&conn->framer, &space);
+    result = cy_socket_recv(socket_handle, space, space_length,
                             CY_SOCKET_FLAGS_NONE, &bytes_received);
-    char returnMessage[MAX_TCP_RECV_BUFFER_SIZE];
-
-    //create char* containing message so strlen() can be used to find length
-    char *messageString = &message_buffer[0];
 
     if(result == CY_RSLT_SUCCESS)
     {
-        printf("Message from TCP Client: %s\n", messageString);
-
-        // to many characters, reject
-        if(strlen(messageString) > 12){
-        	printf("illegal length\n");
-			snprintf(returnMessage, MAX_TCP_RECV_BUFFER_SIZE , "X illegal length");
-			sendAck(returnMessage, socket_handle);
-			return result;
-		}
-
-        // Check that it is the correct length and has a legal command
-        if(!((strlen(messageString) == 7 && message_buffer[0] == 'R') || (strlen(messageString) == 11 && message_buffer[0] == 'W'))){
-        	printf("illegal command\n");
-        	snprintf(returnMessage, MAX_TCP_RECV_BUFFER_SIZE, "X illegal command");
-        	sendAck(returnMessage, socket_handle);
-        	return result;
-        }
-
-        // All of the bytes must be a ASCII hex digit from 1->end of string
-        for(int i = 1; i < strlen(messageString); i++){
-        	if(!isxdigit((int)message_buffer[i])){
-        		printf("illegal character\n");
-        		snprintf(returnMessage, MAX_TCP_RECV_BUFFER_SIZE, "X illegal character");
-        		sendAck(returnMessage, socket_handle);
-        		return result;
-        	}
-        }
-
-        // Write command
-        if(message_buffer[0] == 'W'){
-        	printf("write");
-        	//parse the string
-        	sscanf((const char*)message_buffer,"%c%4x%2x%4x", (char *)&commandId, (int*)&receive.deviceId, (int*)&receive.regId, (int*)&receive.value);
-        	receive.next = NULL;
-        	//See if the device is already in the database, or if theres room to add it
-        	if((dbFind(&head, &receive) != NULL) || (dbGetCount(&head) <= dbGetMax())){
-        		sprintf(returnMessage,"A%04X%02X%04X",(unsigned int)receive.deviceId,(unsigned int)receive.regId,(unsigned int)receive.value);
-        		dbEntry_t *newDB = malloc(sizeof(dbEntry_t)); // make a new entry to put in the database
-        		memcpy(newDB,&receive,sizeof(dbEntry_t)); // copy the received data into the new entry
-        		dbSetValue(&head, newDB); // save it.
-        		sendAck(returnMessage, socket_handle);
-        		return result;
-        	}
-        	else{
-        		sprintf(returnMessage,"X Database Full %d",(int)dbGetCount(&head));
-        		sendAck(returnMessage, socket_handle);
-        		return result;
-        	}
-        }
-        if(message_buffer[0] == 'R'){
-        	//read
-			sscanf((const char *)message_buffer,"%c%4x%2x",(char *)&commandId,( int *)&receive.deviceId,( int *)&receive.regId);
-			dbEntry_t *foundValue = dbFind(&head, &receive); // look through the database to find a previous write of the deviceId/regId
-			if(foundValue){
-				sprintf(returnMessage,"A%04X%02X%04X",(unsigned int)foundValue->deviceId,(unsigned int)foundValue->regId,(unsigned int)foundValue->value);
-				sendAck(returnMessage, socket_handle);
-				return result;
-			}
-			else{
-				sprintf(returnMessage,"X Not Found");
-				sendAck(returnMessage, socket_handle);
-				return result;
-			}
-		}
-
+        awep_server_receive(conn, bytes_received);
     }
     else
     {
         if(result == CY_RSLT_MODULE_SECURE_SOCKETS_CLOSED)
         {
-            /* Disconnect the socket. */
-			cy_socket_disconnect(socket_handle, 0);
-
-			/* Delete the client socket. */
-			result = cy_socket_delete(socket_handle);
+            /* The socket is deleted once the workers are done with the client. */
+            awep_server_close(conn);
 
             printf("TCP Client disconnected! Please reconnect the TCP Client\n");
 			printf("===============================================================\n");
@@ -574,6 +650,7 @@ cy_rslt_t tcp_receive_msg_handler(cy_socket_t socket_handle, void *arg)
         	printf("Failed to receive message from the TCP client. Error: %d\n", (int)result);
         }
     }
+    awep_server_release(conn);
 
     return result;
 }
@@ -594,26 +671,22 @@ cy_rslt_t tcp_receive_msg_handler(cy_socket_t socket_handle, void *arg)
  *******************************************************************************/
 cy_rslt_t tcp_disconnection_handler(cy_socket_t socket_handle, void *arg)
 {
-    cy_rslt_t result;
-
-    /* Disconnect the socket. */
-	result = cy_socket_disconnect(socket_handle, 0);
-	if(result != CY_RSLT_SUCCESS){
-		printf("Disconnect Failed!\n");
-		CY_ASSERT(0);
-	}
-	/* Delete the client socket. */
-	result = cy_socket_delete(socket_handle);
-	if(result != CY_RSLT_SUCCESS){
-		printf("Socket Delete Failed!\n");
-		CY_ASSERT(0);
-	}
+    /* Already closed by the receive callback or the reaper. */
+    awep_conn_t *conn = awep_conn_get(socket_handle);
+    if(conn == NULL)
+    {
+        return CY_RSLT_SUCCESS;
+    }
 
+    /* The socket is disconnected and deleted with the last hold on the
+     * client, a worker may still be answering it. */
+    awep_server_close(conn);
+    awep_server_release(conn);
     printf("TCP Client disconnected! Please reconnect the TCP Client\n");
     printf("===============================================================\n");
     printf("Listening for incoming TCP client connection on Port:%d\n\n", tcp_server_addr.port);
 
-    return result;
+    return CY_RSLT_SUCCESS;
 }
 
 /* [] END OF FILE */
@@ -0,0 +1,311 @@
+//AWEP command decoder and reply encoder, no libc formatted I/O
+#include <stddef.h>
+#include "awep.h"
+
+static const char awepHexDigits[] = "0123456789ABCDEF";
+
+// awepHexValue:
+// Value of an ASCII hex digit, 16 if it is not one
+static uint32_t awepHexValue(char c){
+    if(c >= '0' && c <= '9'){
+        return (uint32_t)(c - '0');
+    }
+    c |= 0x20; // fold to lower case
+    if(c >= 'a' && c <= 'f'){
+        return (uint32_t)(c - 'a') + 10u;
+    }
+    return 16u;
+}
+
+// awepPutString:
+// Append a string to the buffer, always leaving room for the NUL
+static uint32_t awepPutString(char *buffer, uint32_t size, uint32_t length, const char *string){
+    while(*string != '\0' && length + 1u < size){
+        buffer[length++] = *string++;
+    }
+    return length;
+}
+
+// awepPutHex:
+// Append value as exactly digits upper case hex digits
+static uint32_t awepPutHex(char *buffer, uint32_t size, uint32_t length, uint32_t value, uint32_t digits){
+    while(digits > 0 && length + 1u < size){
+        digits--;
+        buffer[length++] = awepHexDigits[(value >> (digits * 4u)) & 0xFu];
+    }
+    return length;
+}
+
+// awepPutDecimal:
+// Append value in decimal
+static uint32_t awepPutDecimal(char *buffer, uint32_t size, uint32_t length, uint32_t value){
+    char digits[10];
+    uint32_t count = 0;
+    do{
+        digits[count++] = (char)('0' + value % 10u);
+        value /= 10u;
+    }while(value != 0);
+    while(count > 0 && length + 1u < size){
+        buffer[length++] = digits[--count];
+    }
+    return length;
+}
+
+// awep_decode:
+// Walk the frame once, up to the NUL or size bytes. Every character after the
+// command letter is checked and folded into its field as it goes by. The
+// checks are then reported in the same order the servers always used:
+// length, then command, then characters.
+awep_status_t awep_decode(const char *frame, uint32_t size, awep_request_t *request){
+    uint32_t length;
+    uint32_t fields[4] = {0, 0, 0, 0};
+    uint32_t badCharacter = 0;
+
+    for(length = 0; length < size && frame[length] != '\0'; length++){
+        if(length == 0){
+            continue;
+        }
+        uint32_t digit = awepHexValue(frame[length]);
+        badCharacter |= digit >> 4;
+        // characters 1-4 are the deviceId, 5-6 the regId, 7-10 the value (the
+        // expected value of a C) and 11-14 the value of a C
+        uint32_t field = (length <= 4u) ? 0u : ((length <= 6u) ? 1u : ((length <= 10u) ? 2u : 3u));
+        fields[field] = (fields[field] << 4) | (digit & 0xFu);
+    }
+
+    request->command = (size > 0) ? frame[0] : '\0';
+    request->length = length;
+    request->deviceId = fields[0];
+    request->regId = fields[1];
+    request->value = fields[2];
+    request->expected = 0;
+
+    if(length > AWEP_MAX_LEN){
+        return AWEP_ERR_LENGTH;
+    }
+    bool watch = (request->command == 'S' || request->command == 'U');
+    bool range = (request->command == 'G');
+    if(!((length == AWEP_READ_LEN && (request->command == 'R' || watch)) ||
+         (length == AWEP_WRITE_LEN && (request->command == 'W' || request->command == 'I')) ||
+         (length == AWEP_WATCH_DEVICE_LEN && (watch || range)) ||
+         (length == AWEP_RANGE_LEN && range) ||
+         (length == AWEP_CAS_LEN && request->command == 'C') ||
+         (length == AWEP_STATS_LEN && request->command == 'T'))){
+        return AWEP_ERR_COMMAND;
+    }
+    if(badCharacter){
+        return AWEP_ERR_CHARACTER;
+    }
+    if(length == AWEP_WATCH_DEVICE_LEN){
+        // a whole device, every regId from 0 to FF for a G
+        request->regId = range ? 0u : AWEP_ALL_REGS;
+        request->value = range ? 0xFFu : 0u;
+    }
+    if(length == AWEP_CAS_LEN){
+        request->expected = fields[2];
+        request->value = fields[3];
+    }
+    return AWEP_OK;
+}
+
+bool awep_is_binary(char first){
+    uint8_t length = (uint8_t)first;
+    return length != 0 && length <= AWEP_BINARY_MAX_LEN && first != '\r' && first != '\n';
+}
+
+// awep_decode_binary:
+// The framer hands over whole frames, length byte included, so only the size
+// and the opcode need checking. There are no characters to reject.
+awep_status_t awep_decode_binary(const uint8_t *frame, uint32_t size, awep_request_t *request){
+    request->command = (size > 1u) ? (char)frame[1] : '\0';
+    request->length = size;
+    request->deviceId = 0;
+    request->regId = 0;
+    request->value = 0;
+    request->expected = 0;
+
+    if(size < AWEP_BINARY_STATS_LEN || size != frame[0] + 1u){
+        return AWEP_ERR_LENGTH;
+    }
+    if(size == AWEP_BINARY_STATS_LEN){
+        // T is the only command without a deviceId
+        return (request->command == 'T') ? AWEP_OK : AWEP_ERR_COMMAND;
+    }
+    if(size < AWEP_BINARY_WATCH_DEVICE_LEN){
+        return AWEP_ERR_LENGTH;
+    }
+    bool watch = (request->command == 'S' || request->command == 'U');
+    bool range = (request->command == 'G');
+    if(!((size == AWEP_BINARY_READ_LEN && (request->command == 'R' || watch)) ||
+         (size == AWEP_BINARY_WRITE_LEN && (request->command == 'W' || request->command == 'I')) ||
+         (size == AWEP_BINARY_WATCH_DEVICE_LEN && (watch || range)) ||
+         (size == AWEP_BINARY_RANGE_LEN && range) ||
+         (size == AWEP_BINARY_CAS_LEN && request->command == 'C'))){
+        return AWEP_ERR_COMMAND;
+    }
+    request->deviceId = ((uint32_t)frame[2] << 8) | frame[3];
+    if(size == AWEP_BINARY_WATCH_DEVICE_LEN){
+        // a whole device, every regId from 0 to FF for a G
+        request->regId = range ? 0u : AWEP_ALL_REGS;
+        request->value = range ? 0xFFu : 0u;
+    }
+    else{
+        request->regId = frame[4];
+    }
+    if(size == AWEP_BINARY_WRITE_LEN){
+        request->value = ((uint32_t)frame[5] << 8) | frame[6];
+    }
+    else if(size == AWEP_BINARY_CAS_LEN){
+        request->expected = ((uint32_t)frame[5] << 8) | frame[6];
+        request->value = ((uint32_t)frame[7] << 8) | frame[8];
+    }
+    else if(size == AWEP_BINARY_RANGE_LEN){
+        request->value = frame[5];
+    }
+    return AWEP_OK;
+}
+
+uint32_t awep_encode_binary_reply(uint8_t *buffer, uint32_t size, awep_status_t status, uint32_t value){
+    uint32_t length = (status == AWEP_OK || status == AWEP_ERR_FULL || status == AWEP_ERR_MISMATCH) ? 4u : 2u;
+    if(size < length){
+        return 0;
+    }
+    buffer[0] = (uint8_t)(length - 1u);
+    buffer[1] = (uint8_t)status;
+    if(length == 4u){
+        buffer[2] = (uint8_t)(value >> 8);
+        buffer[3] = (uint8_t)value;
+    }
+    return length;
+}
+
+uint32_t awep_encode_binary_notify(uint8_t *buffer, uint32_t size, uint32_t deviceId, uint32_t regId, uint32_t value){
+    if(size < AWEP_BINARY_NOTIFY_LEN){
+        return 0;
+    }
+    buffer[0] = (uint8_t)(AWEP_BINARY_NOTIFY_LEN - 1u);
+    buffer[1] = 'N';
+    buffer[2] = (uint8_t)(deviceId >> 8);
+    buffer[3] = (uint8_t)deviceId;
+    buffer[4] = (uint8_t)regId;
+    buffer[5] = (uint8_t)(value >> 8);
+    buffer[6] = (uint8_t)value;
+    return AWEP_BINARY_NOTIFY_LEN;
+}
+
+uint32_t awep_encode_binary_record(uint8_t *buffer, uint32_t size, uint32_t regId, uint32_t value){
+    if(size < 5u){
+        return 0;
+    }
+    buffer[0] = 4u;
+    buffer[1] = 'A';
+    buffer[2] = (uint8_t)regId;
+    buffer[3] = (uint8_t)(value >> 8);
+    buffer[4] = (uint8_t)value;
+    return 5u;
+}
+
+uint32_t awep_encode_binary_stat(uint8_t *buffer, uint32_t size, uint32_t index, uint32_t value){
+    if(size < AWEP_BINARY_STAT_LEN){
+        return 0;
+    }
+    buffer[0] = (uint8_t)(AWEP_BINARY_STAT_LEN - 1u);
+    buffer[1] = 'T';
+    buffer[2] = (uint8_t)index;
+    buffer[3] = (uint8_t)(value >> 24);
+    buffer[4] = (uint8_t)(value >> 16);
+    buffer[5] = (uint8_t)(value >> 8);
+    buffer[6] = (uint8_t)value;
+    return AWEP_BINARY_STAT_LEN;
+}
+
+// awepEncodeRegister:
+// Acks and notifications are the same fields behind a different letter
+static uint32_t awepEncodeRegister(char *buffer, uint32_t size, const char *letter,
+                                   uint32_t deviceId, uint32_t regId, uint32_t value){
+    uint32_t length = 0;
+    if(size == 0){
+        return 0;
+    }
+    length = awepPutString(buffer, size, length, letter);
+    length = awepPutHex(buffer, size, length, deviceId, 4u);
+    length = awepPutHex(buffer, size, length, regId, 2u);
+    length = awepPutHex(buffer, size, length, value, 4u);
+    buffer[length] = '\0';
+    return length;
+}
+
+uint32_t awep_encode_ack(char *buffer, uint32_t size, uint32_t deviceId, uint32_t regId, uint32_t value){
+    return awepEncodeRegister(buffer, size, "A", deviceId, regId, value);
+}
+
+uint32_t awep_encode_notify(char *buffer, uint32_t size, uint32_t deviceId, uint32_t regId, uint32_t value){
+    return awepEncodeRegister(buffer, size, "N", deviceId, regId, value);
+}
+
+uint32_t awep_encode_range_end(char *buffer, uint32_t size, uint32_t deviceId, uint32_t count){
+    uint32_t length = 0;
+    if(size == 0){
+        return 0;
+    }
+    length = awepPutString(buffer, size, length, "E");
+    length = awepPutHex(buffer, size, length, deviceId, 4u);
+    length = awepPutHex(buffer, size, length, count, 4u);
+    buffer[length] = '\0';
+    return length;
+}
+
+uint32_t awep_encode_watch_ack(char *buffer, uint32_t size, uint32_t deviceId, uint32_t regId){
+    uint32_t length = 0;
+    if(size == 0){
+        return 0;
+    }
+    length = awepPutString(buffer, size, length, "A");
+    length = awepPutHex(buffer, size, length, deviceId, 4u);
+    if(regId != AWEP_ALL_REGS){
+        length = awepPutHex(buffer, size, length, regId, 2u);
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+uint32_t awep_encode_stat(char *buffer, uint32_t size, uint32_t index, uint32_t value){
+    uint32_t length = 0;
+    if(size == 0){
+        return 0;
+    }
+    length = awepPutString(buffer, size, length, "T");
+    length = awepPutHex(buffer, size, length, index, 2u);
+    length = awepPutHex(buffer, size, length, value, 8u);
+    buffer[length] = '\0';
+    return length;
+}
+
+uint32_t awep_encode_error(char *buffer, uint32_t size, awep_status_t status, uint32_t value){
+    static const char *const reasons[] = {
+        [AWEP_OK]            = "X",
+        [AWEP_ERR_LENGTH]    = "X illegal length",
+        [AWEP_ERR_COMMAND]   = "X illegal command",
+        [AWEP_ERR_CHARACTER] = "X illegal character",
+        [AWEP_ERR_NOT_FOUND] = "X Not Found",
+        [AWEP_ERR_FULL]      = "X Database Full ",
+        [AWEP_ERR_WATCH_LIMIT] = "X Too Many Watches",
+        [AWEP_ERR_MISMATCH]  = "X Mismatch ",
+        [AWEP_ERR_READ_ONLY] = "X Read Only",
+        [AWEP_ERR_THROTTLED] = "X Throttled",
+        [AWEP_ERR_BUSY]      = "X Server Busy",
+    };
+    uint32_t length = 0;
+    if(size == 0){
+        return 0;
+    }
+    length = awepPutString(buffer, size, length, reasons[status]);
+    if(status == AWEP_ERR_FULL){
+        length = awepPutDecimal(buffer, size, length, value);
+    }
+    else if(status == AWEP_ERR_MISMATCH){
+        length = awepPutHex(buffer, size, length, value, 4u);
+    }
+    buffer[length] = '\0';
+    return length;
+}
@@ -0,0 +1,174 @@
+//table of the clients connected to an AWEP server, looked up by socket
+#include <stddef.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include "awep_conn.h"
+
+static awep_conn_t awepConns[AWEP_MAX_CONNECTIONS];
+static uint32_t awepConnCount;
+
+// Guards the sockets, holds, closing flags and watches of the table. The rest
+// of an entry belongs to whoever holds it
+static SemaphoreHandle_t awepConnLock;
+static StaticSemaphore_t awepConnLockBuffer;
+
+void awep_conn_init(void){
+    if(awepConnLock == NULL){
+        awepConnLock = xSemaphoreCreateMutexStatic(&awepConnLockBuffer);
+    }
+}
+
+// awep_conn_open:
+// An entry is only free once its last hold is gone, so nothing still uses
+// the framer and writer set up here
+awep_conn_t *awep_conn_open(void *socket, uint32_t peerAddress, uint32_t now){
+    awep_conn_t *conn = NULL;
+
+    xSemaphoreTake(awepConnLock, portMAX_DELAY);
+    for(uint32_t i = 0; i < AWEP_MAX_CONNECTIONS; i++){
+        if(awepConns[i].socket == NULL){
+            conn = &awepConns[i];
+            conn->socket = socket;
+            conn->peerAddress = peerAddress;
+            conn->lastActivity = now;
+            conn->bytesReceived = 0;
+            conn->commands = 0;
+            conn->holds = 1u;
+            conn->closing = false;
+            awep_framer_init(&conn->framer);
+            awep_writer_init(&conn->writer);
+            awep_watch_init(&conn->watches);
+            awepConnCount++;
+            break;
+        }
+    }
+    xSemaphoreGive(awepConnLock);
+    return conn;
+}
+
+// awepConnGet:
+// Hold an entry if it is open. Called with the lock held
+static awep_conn_t *awepConnGet(awep_conn_t *conn){
+    if(conn->socket == NULL || conn->closing){
+        return NULL;
+    }
+    conn->holds++;
+    return conn;
+}
+
+// awep_conn_get:
+// The table is a handful of entries, a linear scan beats anything cleverer
+awep_conn_t *awep_conn_get(void *socket){
+    awep_conn_t *conn = NULL;
+
+    if(socket == NULL){
+        return NULL;
+    }
+    xSemaphoreTake(awepConnLock, portMAX_DELAY);
+    for(uint32_t i = 0; i < AWEP_MAX_CONNECTIONS; i++){
+        if(awepConns[i].socket == socket){
+            conn = awepConnGet(&awepConns[i]);
+            break;
+        }
+    }
+    xSemaphoreGive(awepConnLock);
+    return conn;
+}
+
+awep_conn_t *awep_conn_get_at(uint32_t index){
+    awep_conn_t *conn = NULL;
+
+    if(index >= AWEP_MAX_CONNECTIONS){
+        return NULL;
+    }
+    xSemaphoreTake(awepConnLock, portMAX_DELAY);
+    conn = awepConnGet(&awepConns[index]);
+    xSemaphoreGive(awepConnLock);
+    return conn;
+}
+
+bool awep_conn_hold(awep_conn_t *conn){
+    bool held;
+
+    xSemaphoreTake(awepConnLock, portMAX_DELAY);
+    held = (conn->socket != NULL && !conn->closing);
+    if(held){
+        conn->holds++;
+    }
+    xSemaphoreGive(awepConnLock);
+    return held;
+}
+
+void *awep_conn_put(awep_conn_t *conn){
+    void *socket = NULL;
+
+    if(conn == NULL){
+        return NULL;
+    }
+    xSemaphoreTake(awepConnLock, portMAX_DELAY);
+    conn->holds--;
+    if(conn->holds == 0){
+        socket = conn->socket;
+        conn->socket = NULL;
+        awepConnCount--;
+    }
+    xSemaphoreGive(awepConnLock);
+    return socket;
+}
+
+// awep_conn_close:
+// The caller holds the entry too, so dropping the hold for being open never
+// frees it here
+bool awep_conn_close(awep_conn_t *conn){
+    bool first;
+
+    xSemaphoreTake(awepConnLock, portMAX_DELAY);
+    first = (conn->socket != NULL && !conn->closing);
+    if(first){
+        conn->closing = true;
+        conn->holds--;
+    }
+    xSemaphoreGive(awepConnLock);
+    return first;
+}
+
+awep_status_t awep_conn_watch(awep_conn_t *conn, uint32_t deviceId, uint32_t regId, bool watch){
+    awep_status_t status;
+
+    xSemaphoreTake(awepConnLock, portMAX_DELAY);
+    if(watch){
+        status = awep_watch_add(&conn->watches, deviceId, regId);
+    }
+    else{
+        status = awep_watch_remove(&conn->watches, deviceId, regId);
+    }
+    xSemaphoreGive(awepConnLock);
+    return status;
+}
+
+// awep_conn_watchers:
+// Matched under the lock, so no watch is added or removed halfway through
+// and no entry is closed or reopened while it is looked at
+uint32_t awep_conn_watchers(const awep_conn_t *skip, uint32_t deviceId, uint32_t regId,
+                            awep_conn_t **watchers){
+    uint32_t count = 0;
+
+    xSemaphoreTake(awepConnLock, portMAX_DELAY);
+    for(uint32_t i = 0; i < AWEP_MAX_CONNECTIONS; i++){
+        awep_conn_t *conn = &awepConns[i];
+        if(conn != skip && awep_watch_match(&conn->watches, deviceId, regId) &&
+           awepConnGet(conn) != NULL){
+            watchers[count++] = conn;
+        }
+    }
+    xSemaphoreGive(awepConnLock);
+    return count;
+}
+
+uint32_t awep_conn_index(const awep_conn_t *conn){
+    return (uint32_t)(conn - awepConns);
+}
+
+uint32_t awep_conn_count(void){
+    return awepConnCount;
+}
@@ -0,0 +1,61 @@
+#ifndef AWEP_CONN_H_
+#define AWEP_CONN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "awep_framer.h"
+#include "awep_writer.h"
+#include "awep_watch.h"
+
+// Clients served at once, the server checks this against MEMP_NUM_TCP_PCB
+#ifndef AWEP_MAX_CONNECTIONS
+#define AWEP_MAX_CONNECTIONS (4u)
+#endif
+
+// State kept for each connected client. The socket callbacks, the workers and
+// the task that reaps idle clients all use an entry, each holding it for as
+// long as it does. Closing only marks the entry, its socket is deleted and the
+// entry freed for the next client once the last hold is dropped, so a queued
+// job never finds its socket gone or the entry given to someone else
+typedef struct {
+    void *socket;           // cy_socket_t of the client, NULL when the entry is free
+    uint32_t peerAddress;   // IPv4 address of the client
+    uint32_t lastActivity;  // tick count when the client last sent something
+    uint32_t bytesReceived;
+    uint32_t commands;
+    uint32_t holds;         // one while open, one for each user and queued job
+    bool closing;           // closed, waiting for the last hold to go
+    awep_framer_t framer;
+    awep_writer_t writer;
+    awep_watch_list_t watches;
+} awep_conn_t;
+
+//create the table lock, before any connection is accepted
+void awep_conn_init(void);
+//take a free entry for a newly accepted socket, held once for being open.
+//NULL if the table is full
+awep_conn_t *awep_conn_open(void *socket, uint32_t peerAddress, uint32_t now);
+//hold the entry of a socket, NULL if it has none or it is closing
+awep_conn_t *awep_conn_get(void *socket);
+//hold the entry at a position in the table, NULL if it is free or closing
+awep_conn_t *awep_conn_get_at(uint32_t index);
+//hold an entry once more, for a job. False once it is closing
+bool awep_conn_hold(awep_conn_t *conn);
+//drop a hold. After the last one the entry is free and its socket is
+//returned for the caller to delete, otherwise NULL
+void *awep_conn_put(awep_conn_t *conn);
+//mark a held entry closing and drop its hold for being open. True only for
+//the first close of the entry
+bool awep_conn_close(awep_conn_t *conn);
+//add a watch to a held entry, or remove one, AWEP_OK or the awep_watch status
+awep_status_t awep_conn_watch(awep_conn_t *conn, uint32_t deviceId, uint32_t regId, bool watch);
+//hold every open entry but skip that watches deviceId/regId, watchers holds up
+//to AWEP_MAX_CONNECTIONS entries. Returns how many there are
+uint32_t awep_conn_watchers(const awep_conn_t *skip, uint32_t deviceId, uint32_t regId,
+                            awep_conn_t **watchers);
+//position of the entry in the table, from 0 to AWEP_MAX_CONNECTIONS - 1
+uint32_t awep_conn_index(const awep_conn_t *conn);
+//entries in use, open or waiting for their last hold
+uint32_t awep_conn_count(void);
+
+#endif
@@ -0,0 +1,125 @@
+//buffer that splits a TCP byte stream into AWEP commands
+#include <string.h>
+#include "awep.h"
+#include "awep_framer.h"
+
+static bool awepIsTerminator(char c){
+    return c == '\0' || c == '\r' || c == '\n';
+}
+
+void awep_framer_init(awep_framer_t *framer){
+    framer->head = 0;
+    framer->tail = 0;
+    framer->discarding = false;
+    framer->skipping = 0;
+    framer->detected = false;
+    framer->binary = false;
+}
+
+// awep_framer_space:
+// Whatever is left from the last receive (at most a partial command once the
+// callback has framed everything) is moved to the start, so all of the free
+// space is in one piece for cy_socket_recv.
+uint32_t awep_framer_space(awep_framer_t *framer, char **space){
+    if(framer->head != 0){
+        memmove(framer->buffer, &framer->buffer[framer->head], framer->tail - framer->head);
+        framer->tail -= framer->head;
+        framer->head = 0;
+    }
+    *space = &framer->buffer[framer->tail];
+    return AWEP_FRAMER_SIZE - framer->tail;
+}
+
+void awep_framer_commit(awep_framer_t *framer, uint32_t length){
+    framer->tail += length;
+}
+
+// awepNextBinary:
+// A command longer than the frame buffer is handed over as its length byte
+// alone, to be rejected once, and the bytes it declared are dropped as they
+// arrive rather than framed as commands of their own.
+static bool awepNextBinary(awep_framer_t *framer, char *frame, uint32_t size, uint32_t *length){
+    uint32_t used = framer->tail - framer->head;
+    if(framer->skipping != 0){
+        uint32_t drop = (used < framer->skipping) ? used : framer->skipping;
+        framer->head += drop;
+        framer->skipping -= drop;
+        used -= drop;
+    }
+    if(used == 0){
+        return false;
+    }
+    const char *start = &framer->buffer[framer->head];
+    uint32_t n = (uint32_t)(uint8_t)start[0] + 1u;
+    if(n > size){
+        framer->skipping = n - 1u;
+        n = 1u;
+    }
+    else if(used < n){
+        return false; // wait for the rest of the command
+    }
+    memcpy(frame, start, n);
+    framer->head += n;
+    *length = n;
+    return true;
+}
+
+// awep_framer_next:
+// Empty commands (such as the LF of a CR LF pair) are skipped. A command that
+// reaches size - 1 bytes without a terminator is handed out truncated, so the
+// decoder rejects it as too long, and the rest of it is dropped as it arrives.
+bool awep_framer_next(awep_framer_t *framer, char *frame, uint32_t size, uint32_t *length){
+    if(!framer->detected){
+        if(framer->tail == framer->head){
+            return false;
+        }
+        framer->binary = awep_is_binary(framer->buffer[framer->head]);
+        framer->detected = true;
+    }
+    if(framer->binary){
+        return awepNextBinary(framer, frame, size, length);
+    }
+
+    for(;;){
+        const char *start = &framer->buffer[framer->head];
+        uint32_t used = framer->tail - framer->head;
+        uint32_t n;
+        bool terminated = false;
+
+        for(n = 0; n < used; n++){
+            if(awepIsTerminator(start[n])){
+                terminated = true;
+                break;
+            }
+        }
+
+        if(!terminated){
+            if(framer->discarding){
+                framer->head = framer->tail;
+                return false;
+            }
+            if(n + 1u < size){
+                return false; // wait for the rest of the command
+            }
+        }
+
+        uint32_t copy = (n + 1u < size) ? n : size - 1u;
+        memcpy(frame, start, copy);
+        frame[copy] = '\0';
+
+        bool dropped = framer->discarding;
+        if(terminated){
+            framer->head += n + 1u;
+            framer->discarding = false;
+        }
+        else{
+            framer->head += n;
+            framer->discarding = true;
+        }
+
+        if(!dropped && n != 0){
+            *length = copy;
+            return true;
+        }
+    }
+}
@@ -0,0 +1,117 @@
+//server wide AWEP counters, updated from the receive callback and the workers
+#include <stddef.h>
+#include "awep_stats.h"
+
+static volatile uint32_t awepStats[AWEP_STAT_COUNT];
+
+static const char *const awepStatNames[AWEP_STAT_SERVICE_HISTOGRAM + 1] = {
+    [AWEP_STAT_READS]           = "reads",
+    [AWEP_STAT_WRITES]          = "writes",
+    [AWEP_STAT_WATCHES]         = "watches",
+    [AWEP_STAT_RANGES]          = "ranges",
+    [AWEP_STAT_SWAPS]           = "swaps",
+    [AWEP_STAT_INCREMENTS]      = "increments",
+    [AWEP_STAT_STATS]           = "stats",
+    [AWEP_STAT_ERR_LENGTH]      = "illegal length",
+    [AWEP_STAT_ERR_COMMAND]     = "illegal command",
+    [AWEP_STAT_ERR_CHARACTER]   = "illegal character",
+    [AWEP_STAT_ERR_NOT_FOUND]   = "not found",
+    [AWEP_STAT_ERR_FULL]        = "database full",
+    [AWEP_STAT_ERR_WATCH_LIMIT] = "too many watches",
+    [AWEP_STAT_ERR_MISMATCH]    = "mismatch",
+    [AWEP_STAT_ERR_READ_ONLY]   = "read only",
+    [AWEP_STAT_ERR_THROTTLED]   = "throttled",
+    [AWEP_STAT_BYTES_IN]        = "bytes in",
+    [AWEP_STAT_BYTES_OUT]       = "bytes out",
+    [AWEP_STAT_REJECTED]        = "rejected",
+    [AWEP_STAT_REAPED]          = "reaped",
+    [AWEP_STAT_DATAGRAMS]       = "datagrams",
+    [AWEP_STAT_RETRANSMITS]     = "retransmits",
+    [AWEP_STAT_LOG_RECORDS]     = "log records",
+    [AWEP_STAT_LOG_DROPPED]     = "log dropped",
+    [AWEP_STAT_SNAPSHOTS]       = "snapshots",
+    [AWEP_STAT_RESTORE_US]      = "restore us",
+    [AWEP_STAT_REPL_SENT]       = "repl sent",
+    [AWEP_STAT_REPL_APPLIED]    = "repl applied",
+    [AWEP_STAT_REPL_COPIES]     = "repl copies",
+    [AWEP_STAT_REPL_BEHIND]     = "repl behind",
+    [AWEP_STAT_REPL_LAG_US]     = "repl lag us",
+    [AWEP_STAT_REPL_LAG_MAX]    = "repl lag max us",
+    [AWEP_STAT_CONNECTIONS]     = "connections",
+    [AWEP_STAT_DB_COUNT]        = "db entries",
+    [AWEP_STAT_DB_HIGH_WATER]   = "db high water",
+    [AWEP_STAT_DB_MAX]          = "db max",
+    [AWEP_STAT_DB_EVICTIONS]    = "db evictions",
+    [AWEP_STAT_SERVICE_MAX]     = "service max us",
+    [AWEP_STAT_SERVICE_HISTOGRAM] = "service us",
+};
+
+// awepStatsReject:
+// Counter of a rejected command, AWEP_STAT_COUNT for a status without one.
+// AWEP_ERR_BUSY is only sent to a client turned away at accept, it is counted
+// there as AWEP_STAT_REJECTED
+static awep_stat_t awepStatsReject(awep_status_t status){
+    switch(status){
+    case AWEP_ERR_LENGTH:      return AWEP_STAT_ERR_LENGTH;
+    case AWEP_ERR_COMMAND:     return AWEP_STAT_ERR_COMMAND;
+    case AWEP_ERR_CHARACTER:   return AWEP_STAT_ERR_CHARACTER;
+    case AWEP_ERR_NOT_FOUND:   return AWEP_STAT_ERR_NOT_FOUND;
+    case AWEP_ERR_FULL:        return AWEP_STAT_ERR_FULL;
+    case AWEP_ERR_WATCH_LIMIT: return AWEP_STAT_ERR_WATCH_LIMIT;
+    case AWEP_ERR_MISMATCH:    return AWEP_STAT_ERR_MISMATCH;
+    case AWEP_ERR_READ_ONLY:   return AWEP_STAT_ERR_READ_ONLY;
+    case AWEP_ERR_THROTTLED:   return AWEP_STAT_ERR_THROTTLED;
+    case AWEP_OK:
+    case AWEP_ERR_BUSY:
+    default:                   return AWEP_STAT_COUNT;
+    }
+}
+
+void awep_stats_request(const awep_request_t *request, awep_status_t status){
+    awep_stat_t reject = awepStatsReject(status);
+    if(reject != AWEP_STAT_COUNT){
+        awep_stats_add(reject, 1u);
+    }
+    if(status == AWEP_ERR_LENGTH || status == AWEP_ERR_COMMAND || status == AWEP_ERR_CHARACTER){
+        return;
+    }
+    switch(request->command){
+    case 'R': awep_stats_add(AWEP_STAT_READS, 1u); break;
+    case 'W': awep_stats_add(AWEP_STAT_WRITES, 1u); break;
+    case 'S':
+    case 'U': awep_stats_add(AWEP_STAT_WATCHES, 1u); break;
+    case 'G': awep_stats_add(AWEP_STAT_RANGES, 1u); break;
+    case 'C': awep_stats_add(AWEP_STAT_SWAPS, 1u); break;
+    case 'I': awep_stats_add(AWEP_STAT_INCREMENTS, 1u); break;
+    case 'T': awep_stats_add(AWEP_STAT_STATS, 1u); break;
+    default: break;
+    }
+}
+
+void awep_stats_service(uint32_t micros){
+    uint32_t bucket = 0;
+    while(bucket < AWEP_STATS_BUCKETS - 1u && (micros >> bucket) != 0){
+        bucket++;
+    }
+    awep_stats_add((awep_stat_t)(AWEP_STAT_SERVICE_HISTOGRAM + bucket), 1u);
+    // a lost race only loses a maximum that was about to be beaten anyway
+    if(micros > awepStats[AWEP_STAT_SERVICE_MAX]){
+        awepStats[AWEP_STAT_SERVICE_MAX] = micros;
+    }
+}
+
+void awep_stats_add(awep_stat_t stat, uint32_t amount){
+    __atomic_fetch_add(&awepStats[stat], amount, __ATOMIC_RELAXED);
+}
+
+void awep_stats_set(awep_stat_t stat, uint32_t value){
+    awepStats[stat] = value;
+}
+
+uint32_t awep_stats_get(awep_stat_t stat){
+    return awepStats[stat];
+}
+
+const char *awep_stats_name(awep_stat_t stat){
+    return (stat < AWEP_STAT_SERVICE_HISTOGRAM) ? awepStatNames[stat] : awepStatNames[AWEP_STAT_SERVICE_HISTOGRAM];
+}
@@ -0,0 +1,81 @@
+#ifndef AWEP_STATS_H_
+#define AWEP_STATS_H_
+
+#include <stdint.h>
+#include "awep.h"
+
+// Service time histogram buckets, bucket n counts commands that took
+// 2^(n-1) up to 2^n - 1 microseconds, the last one everything slower
+#define AWEP_STATS_BUCKETS  (12u)
+
+// Server wide counters, in the index order a T reports them
+typedef enum {
+    // commands handled, by type
+    AWEP_STAT_READS = 0,
+    AWEP_STAT_WRITES,
+    AWEP_STAT_WATCHES,      // S and U
+    AWEP_STAT_RANGES,
+    AWEP_STAT_SWAPS,
+    AWEP_STAT_INCREMENTS,
+    AWEP_STAT_STATS,
+    // commands rejected, by reason
+    AWEP_STAT_ERR_LENGTH,
+    AWEP_STAT_ERR_COMMAND,
+    AWEP_STAT_ERR_CHARACTER,
+    AWEP_STAT_ERR_NOT_FOUND,
+    AWEP_STAT_ERR_FULL,
+    AWEP_STAT_ERR_WATCH_LIMIT,
+    AWEP_STAT_ERR_MISMATCH,
+    AWEP_STAT_ERR_READ_ONLY,
+    AWEP_STAT_ERR_THROTTLED,
+    // traffic
+    AWEP_STAT_BYTES_IN,
+    AWEP_STAT_BYTES_OUT,
+    // connections turned away at accept and closed for being idle
+    AWEP_STAT_REJECTED,
+    AWEP_STAT_REAPED,
+    // UDP requests, and the retransmissions among them answered from the cache
+    AWEP_STAT_DATAGRAMS,
+    AWEP_STAT_RETRANSMITS,
+    // write log records kept and dropped for want of log space, snapshots
+    // written, and the microseconds the restore at startup took
+    AWEP_STAT_LOG_RECORDS,
+    AWEP_STAT_LOG_DROPPED,
+    AWEP_STAT_SNAPSHOTS,
+    AWEP_STAT_RESTORE_US,
+    // replication: writes sent to the standby or applied from the primary, full
+    // copies, and on the primary the writes the standby has yet to acknowledge
+    // and the microseconds from a write to its ack, the last and the slowest
+    AWEP_STAT_REPL_SENT,
+    AWEP_STAT_REPL_APPLIED,
+    AWEP_STAT_REPL_COPIES,
+    AWEP_STAT_REPL_BEHIND,
+    AWEP_STAT_REPL_LAG_US,
+    AWEP_STAT_REPL_LAG_MAX,
+    // gauges, set by the server just before they are read
+    AWEP_STAT_CONNECTIONS,
+    AWEP_STAT_DB_COUNT,
+    AWEP_STAT_DB_HIGH_WATER,
+    AWEP_STAT_DB_MAX,
+    AWEP_STAT_DB_EVICTIONS,
+    // microseconds spent on the slowest command, then the histogram
+    AWEP_STAT_SERVICE_MAX,
+    AWEP_STAT_SERVICE_HISTOGRAM,
+    AWEP_STAT_COUNT = AWEP_STAT_SERVICE_HISTOGRAM + AWEP_STATS_BUCKETS
+} awep_stat_t;
+
+//count a handled command by type, or by reason when status is an error. A
+//command that did not decode is only counted as rejected
+void awep_stats_request(const awep_request_t *request, awep_status_t status);
+//add the microseconds one command took to the histogram
+void awep_stats_service(uint32_t micros);
+//add to a counter, safe from any task
+void awep_stats_add(awep_stat_t stat, uint32_t amount);
+//set a gauge
+void awep_stats_set(awep_stat_t stat, uint32_t value);
+//current value of a counter
+uint32_t awep_stats_get(awep_stat_t stat);
+//short name of a counter for the console
+const char *awep_stats_name(awep_stat_t stat);
+
+#endif
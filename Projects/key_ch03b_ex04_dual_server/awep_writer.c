@@ -0,0 +1,39 @@
+//queue of AWEP replies sent together at the end of a receive callback
+#include "awep_writer.h"
+
+#if (AWEP_WRITER_SIZE < AWEP_REPLY_MAX)
+#error "AWEP_WRITER_SIZE must hold at least one reply"
+#endif
+
+static awep_writer_stats_t awepWriterStats;
+
+void awep_writer_init(awep_writer_t *writer){
+    writer->length = 0;
+    writer->count = 0;
+}
+
+char *awep_writer_space(awep_writer_t *writer){
+    return &writer->buffer[writer->length];
+}
+
+void awep_writer_commit(awep_writer_t *writer, uint32_t length){
+    writer->length += length;
+    writer->count++;
+}
+
+bool awep_writer_full(const awep_writer_t *writer){
+    return AWEP_WRITER_SIZE - writer->length < AWEP_REPLY_MAX;
+}
+
+// awep_writer_sent:
+// Every worker sends, so the totals are added atomically
+void awep_writer_sent(awep_writer_t *writer){
+    __atomic_fetch_add(&awepWriterStats.bytesSent, writer->length, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&awepWriterStats.sends, 1u, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&awepWriterStats.replies, writer->count, __ATOMIC_RELAXED);
+    awep_writer_init(writer);
+}
+
+const awep_writer_stats_t *awep_writer_get_stats(void){
+    return &awepWriterStats;
+}
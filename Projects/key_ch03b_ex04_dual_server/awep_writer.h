@@ -0,0 +1,40 @@
+#ifndef AWEP_WRITER_H_
+#define AWEP_WRITER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "awep.h"
+
+// Bytes of replies queued per connection before they have to be sent
+#ifndef AWEP_WRITER_SIZE
+#define AWEP_WRITER_SIZE (320u)
+#endif
+
+// Replies queued for one connection, sent together in one send
+typedef struct {
+    char buffer[AWEP_WRITER_SIZE];
+    uint32_t length;    // bytes queued
+    uint32_t count;     // replies queued
+} awep_writer_t;
+
+// Totals over all writers
+typedef struct {
+    uint32_t bytesSent;
+    uint32_t sends;
+    uint32_t replies;
+} awep_writer_stats_t;
+
+//empty the queue
+void awep_writer_init(awep_writer_t *writer);
+//room for the next reply, always at least AWEP_REPLY_MAX bytes
+char *awep_writer_space(awep_writer_t *writer);
+//queue the length bytes of reply written into the space
+void awep_writer_commit(awep_writer_t *writer, uint32_t length);
+//true when another reply might not fit and the queue has to be sent
+bool awep_writer_full(const awep_writer_t *writer);
+//count the queue as sent and empty it
+void awep_writer_sent(awep_writer_t *writer);
+//bytes and sends so far
+const awep_writer_stats_t *awep_writer_get_stats(void);
+
+#endif
@@ -0,0 +1,540 @@
+//open addressing hash table keyed by deviceId/regId
+#include <stddef.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include "database.h"
+
+#define DB_HASH_SIZE (1u << DB_HASH_BITS)
+#define DB_HASH_MASK (DB_HASH_SIZE - 1u)
+
+#if (DB_HASH_SIZE < (2u * DB_MAX_ENTRIES))
+#error "DB_HASH_BITS is too small for DB_MAX_ENTRIES"
+#endif
+
+#if (DB_MAX_ENTRIES > 0xFFFFu)
+#error "DB_MAX_ENTRIES must fit in a 16 bit entry index"
+#endif
+
+// Each slot holds the pool index of a stored entry plus one, 0 marks an empty
+// slot. Evicted entries are removed by shifting their probe run back, so
+// linear probing needs no tombstones. Readers run alongside a writer, so a
+// slot is loaded once per probe step; it always holds 0 or a valid index.
+static volatile uint16_t dbSlots[DB_HASH_SIZE];
+
+#if DB_PACKED_STORAGE
+// Struct-of-arrays records. The key is deviceId high byte, deviceId low byte,
+// regId. A free entry keeps its free-list link in the value array.
+static uint8_t dbKeys[DB_MAX_ENTRIES][3];
+static uint16_t dbValues[DB_MAX_ENTRIES];
+#define DB_LINK(i) dbValues[i]
+
+static inline bool dbKeyIs(uint32_t i, uint32_t deviceId, uint32_t regId){
+    return dbKeys[i][2] == (uint8_t)regId &&
+           dbKeys[i][1] == (uint8_t)deviceId &&
+           dbKeys[i][0] == (uint8_t)(deviceId >> 8);
+}
+
+static inline void dbGetKeyAt(uint32_t i, uint32_t *deviceId, uint32_t *regId){
+    *deviceId = ((uint32_t)dbKeys[i][0] << 8) | dbKeys[i][1];
+    *regId = dbKeys[i][2];
+}
+
+static inline void dbPut(uint32_t i, const dbEntry_t *entry){
+    dbKeys[i][0] = (uint8_t)(entry->deviceId >> 8);
+    dbKeys[i][1] = (uint8_t)entry->deviceId;
+    dbKeys[i][2] = (uint8_t)entry->regId;
+    dbValues[i] = (uint16_t)entry->value;
+}
+
+static inline uint32_t dbGetValueAt(uint32_t i){
+    return dbValues[i];
+}
+
+static inline void dbSetValueAt(uint32_t i, uint32_t value){
+    dbValues[i] = (uint16_t)value;
+}
+#else
+// Array of full records. A free entry keeps its free-list link in value.
+static dbEntry_t dbPool[DB_MAX_ENTRIES];
+#define DB_LINK(i) dbPool[i].value
+
+static inline bool dbKeyIs(uint32_t i, uint32_t deviceId, uint32_t regId){
+    return dbPool[i].deviceId == deviceId && dbPool[i].regId == regId;
+}
+
+static inline void dbGetKeyAt(uint32_t i, uint32_t *deviceId, uint32_t *regId){
+    *deviceId = dbPool[i].deviceId;
+    *regId = dbPool[i].regId;
+}
+
+static inline void dbPut(uint32_t i, const dbEntry_t *entry){
+    dbPool[i] = *entry;
+}
+
+static inline uint32_t dbGetValueAt(uint32_t i){
+    return dbPool[i].value;
+}
+
+static inline void dbSetValueAt(uint32_t i, uint32_t value){
+    dbPool[i].value = value;
+}
+#endif
+
+// Pool indexes of the stored entries sorted by deviceId then regId, so a range
+// read is a binary search and a walk. A write shifts the tail one element at a
+// time, every element a reader picks up is still a valid index.
+static volatile uint16_t dbOrder[DB_MAX_ENTRIES];
+static volatile uint32_t dbOrderCount = 0;
+
+#if DB_EVICTION_POLICY == DB_EVICT_CLOCK
+// CLOCK state. The hand sweeps the pool looking for a victim and dbEpoch counts
+// its revolutions. An entry's stamp is the revolution in which the hand will
+// next reach it after its last access, so it was accessed since the hand last
+// passed it exactly when its stamp equals dbEpoch at that visit.
+static uint8_t dbStamps[DB_MAX_ENTRIES];
+static uint32_t dbHand = 0;
+static uint8_t dbEpoch = 0;
+#endif
+static uint32_t dbEvictions = 0;
+
+// Head of the free-list as index plus one, 0 when the pool is empty. The chain
+// is built by dbInit.
+static uint32_t dbFreeList = 0;
+
+// Pool occupancy, kept so dbGetCount does not have to walk anything
+static uint32_t dbCount = 0;
+static uint32_t dbHighWater = 0;
+
+// Writers hold dbLock and make dbSequence odd while they change the table. A
+// reader that sees the same even count before and after its lookup read a
+// consistent entry.
+static StaticSemaphore_t dbLockBuffer;
+static SemaphoreHandle_t dbLock = NULL;
+static volatile uint32_t dbSequence = 0;
+static uint32_t dbReadRetries = 0;
+
+// Told about every change, with the write lock held
+static dbJournal_t dbJournal = NULL;
+
+void dbInit(void){
+    if(dbLock != NULL){
+        return;
+    }
+    for(uint32_t i = 0; i < DB_MAX_ENTRIES; i++){
+        DB_LINK(i) = (i + 1u < DB_MAX_ENTRIES) ? i + 2u : 0u;
+    }
+    dbFreeList = 1u;
+    dbLock = xSemaphoreCreateMutexStatic(&dbLockBuffer);
+}
+
+static void dbWriteBegin(void){
+    xSemaphoreTake(dbLock, portMAX_DELAY);
+    dbSequence++;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void dbWriteEnd(void){
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    dbSequence++;
+    xSemaphoreGive(dbLock);
+}
+
+// dbReadBegin:
+// Sequence count to check a lookup against. The last try takes the mutex
+// instead, so it cannot fail.
+static uint32_t dbReadBegin(bool locked){
+    if(locked){
+        xSemaphoreTake(dbLock, portMAX_DELAY);
+        return dbSequence;
+    }
+    uint32_t sequence = dbSequence;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return sequence;
+}
+
+// dbReadEnd:
+// True if the lookup since dbReadBegin saw no write
+static bool dbReadEnd(uint32_t sequence, bool locked){
+    if(locked){
+        xSemaphoreGive(dbLock);
+        return true;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if((sequence & 1u) == 0 && dbSequence == sequence){
+        return true;
+    }
+    // readers on every task land here at once, they hold no lock
+    __atomic_fetch_add(&dbReadRetries, 1u, __ATOMIC_RELAXED);
+    return false;
+}
+
+uint32_t dbGetMax(void)
+{
+    return DB_MAX_ENTRIES;
+}
+
+// dbHash:
+// Fibonacci hash of the combined key, the top DB_HASH_BITS bits pick the slot
+static uint32_t dbHash(uint32_t deviceId, uint32_t regId){
+    uint32_t key = (deviceId << 8) ^ regId;
+    return (key * 2654435761u) >> (32u - DB_HASH_BITS);
+}
+
+// dbSlotFor:
+// Probe from the home slot until the key or an empty slot is found. The table
+// is never more than half full so the loop always terminates.
+static volatile uint16_t *dbSlotFor(uint32_t deviceId, uint32_t regId){
+    uint32_t i = dbHash(deviceId, regId);
+    uint32_t entry;
+    while((entry = dbSlots[i]) != 0){
+        if(dbKeyIs(entry - 1u, deviceId, regId)){
+            break;
+        }
+        i = (i + 1u) & DB_HASH_MASK;
+    }
+    return &dbSlots[i];
+}
+
+// dbOrderKey:
+// Sort key of an entry, deviceId then regId
+static uint32_t dbOrderKey(uint32_t i){
+    uint32_t deviceId, regId;
+    dbGetKeyAt(i, &deviceId, &regId);
+    return (deviceId << 8) | regId;
+}
+
+// dbOrderFind:
+// Position of the first entry in dbOrder whose key is at least key
+static uint32_t dbOrderFind(uint32_t key, uint32_t count){
+    uint32_t low = 0;
+    uint32_t high = count;
+    while(low < high){
+        uint32_t middle = (low + high) / 2u;
+        if(dbOrderKey(dbOrder[middle]) < key){
+            low = middle + 1u;
+        }
+        else{
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// dbOrderInsert:
+// Add a new entry to the ordered index
+static void dbOrderInsert(uint32_t entry){
+    uint32_t count = dbOrderCount;
+    uint32_t position = dbOrderFind(dbOrderKey(entry), count);
+    for(uint32_t i = count; i > position; i--){
+        dbOrder[i] = dbOrder[i - 1u];
+    }
+    dbOrder[position] = (uint16_t)entry;
+    dbOrderCount = count + 1u;
+}
+
+// dbTouch:
+// Record an access to an entry for the eviction policy. Readers call it without
+// the lock; a stamp racing with the hand only changes which entry is evicted.
+static void dbTouch(uint32_t i){
+#if DB_EVICTION_POLICY == DB_EVICT_CLOCK
+    dbStamps[i] = (i >= dbHand) ? dbEpoch : (uint8_t)(dbEpoch + 1u);
+#else
+    (void)i;
+#endif
+}
+
+// dbUnlink:
+// Remove an entry from the hash table. Later members of its probe run are
+// shifted back into the hole unless that would move them before their home slot.
+static void dbUnlink(uint32_t entry){
+    uint32_t deviceId, regId;
+    dbGetKeyAt(entry, &deviceId, &regId);
+    uint32_t hole = dbHash(deviceId, regId);
+    while(dbSlots[hole] != entry + 1u){
+        hole = (hole + 1u) & DB_HASH_MASK;
+    }
+    uint32_t j = hole;
+    for(;;){
+        j = (j + 1u) & DB_HASH_MASK;
+        if(dbSlots[j] == 0){
+            break;
+        }
+        dbGetKeyAt(dbSlots[j] - 1u, &deviceId, &regId);
+        uint32_t home = dbHash(deviceId, regId);
+        if(((j - home) & DB_HASH_MASK) >= ((j - hole) & DB_HASH_MASK)){
+            dbSlots[hole] = dbSlots[j];
+            hole = j;
+        }
+    }
+    dbSlots[hole] = 0;
+
+    // and from the ordered index
+    uint32_t count = dbOrderCount - 1u;
+    for(uint32_t i = dbOrderFind(dbOrderKey(entry), count + 1u); i < count; i++){
+        dbOrder[i] = dbOrder[i + 1u];
+    }
+    dbOrderCount = count;
+}
+
+#if DB_EVICTION_POLICY == DB_EVICT_CLOCK
+// dbEvict:
+// Advance the hand to the first entry not accessed since the hand last passed
+// it, journal its removal, unlink it and return its index plus one. Every entry in the pool is in
+// use when this is called. Each entry is skipped at most once per revolution
+// so the search ends within two revolutions, and on average after a few steps.
+static uint32_t dbEvict(void){
+    for(;;){
+        uint32_t victim = dbHand;
+        uint8_t epoch = dbEpoch;
+        if(++dbHand == DB_MAX_ENTRIES){
+            dbHand = 0;
+            dbEpoch++;
+        }
+        if(dbStamps[victim] != epoch){
+            if(dbJournal != NULL){
+                dbEntry_t evicted;
+                dbGetKeyAt(victim, &evicted.deviceId, &evicted.regId);
+                evicted.value = dbGetValueAt(victim);
+                dbJournal(&evicted, true);
+            }
+            dbUnlink(victim);
+            dbEvictions++;
+            return victim + 1u;
+        }
+    }
+}
+#endif
+
+// dbAlloc:
+// Take an entry from the pool, returns its index plus one or 0 if every entry is in use
+static uint32_t dbAlloc(void){
+    uint32_t entry = dbFreeList;
+    if(entry != 0){
+        dbFreeList = DB_LINK(entry - 1u);
+        dbCount++;
+        if(dbCount > dbHighWater){
+            dbHighWater = dbCount;
+        }
+    }
+    return entry;
+}
+
+// dbFind:
+// Search the database for specific deviceId/regId combination. Lookups do not
+// block each other, only a reader that keeps colliding with writes waits.
+dbEntry_t *dbFind(dbEntry_t *find){
+    uint32_t entry;
+    uint32_t value = 0;
+    for(uint32_t tries = 0; ; tries++){
+        bool locked = (tries == DB_READ_RETRIES);
+        uint32_t sequence = dbReadBegin(locked);
+        entry = *dbSlotFor(find->deviceId, find->regId);
+        if(entry != 0){
+            value = dbGetValueAt(entry - 1u);
+        }
+        if(dbReadEnd(sequence, locked)){
+            break;
+        }
+    }
+    if(entry == 0){
+        return NULL;
+    }
+    dbTouch(entry - 1u);
+    find->value = value;
+    return find;
+}
+
+// dbCopy:
+// Binary search the ordered index for the first key, then walk it until the
+// last one. A range read does not count as an access for eviction, so dumping
+// a device does not keep all of it in the pool.
+static uint32_t dbCopy(uint32_t firstKey, uint32_t lastKey, dbEntry_t *out, uint32_t max){
+    uint32_t copied;
+    for(uint32_t tries = 0; ; tries++){
+        bool locked = (tries == DB_READ_RETRIES);
+        uint32_t sequence = dbReadBegin(locked);
+        uint32_t count = dbOrderCount;
+        if(count > DB_MAX_ENTRIES){
+            count = DB_MAX_ENTRIES;
+        }
+        copied = 0;
+        for(uint32_t i = dbOrderFind(firstKey, count); i < count && copied < max; i++){
+            uint32_t entry = dbOrder[i];
+            if(dbOrderKey(entry) > lastKey){
+                break;
+            }
+            dbGetKeyAt(entry, &out[copied].deviceId, &out[copied].regId);
+            out[copied].value = dbGetValueAt(entry);
+            copied++;
+        }
+        if(dbReadEnd(sequence, locked)){
+            break;
+        }
+    }
+    return copied;
+}
+
+uint32_t dbRange(uint32_t deviceId, uint32_t firstReg, uint32_t lastReg, dbEntry_t *out, uint32_t max){
+    return dbCopy((deviceId << 8) | firstReg, (deviceId << 8) | lastReg, out, max);
+}
+
+// dbScan:
+// Continuing from a key rather than a position in the index, so entries
+// inserted between two calls cannot push a register past the scan
+uint32_t dbScan(uint32_t firstKey, dbEntry_t *out, uint32_t max){
+    return dbCopy(firstKey, 0xFFFFFFFFu, out, max);
+}
+
+void dbSetJournal(dbJournal_t journal){
+    dbJournal = journal;
+}
+
+// dbInsert:
+// Copy a register that is not in the table into a pool entry, slot is where
+// dbSlotFor found its key missing. Only an insert takes an entry from the pool.
+// When the pool is empty it either fails or evicts a register, depending on
+// DB_EVICTION_POLICY. Called with the write lock held.
+static bool dbInsert(volatile uint16_t *slot, const dbEntry_t *newValue){
+    uint32_t entry = dbAlloc();
+    if(entry == 0){
+#if DB_EVICTION_POLICY == DB_EVICT_CLOCK
+        entry = dbEvict();
+        // unlinking the victim may have shifted the probe run we were going to use
+        slot = dbSlotFor(newValue->deviceId, newValue->regId);
+#else
+        return false;
+#endif
+    }
+    dbPut(entry - 1u, newValue);
+    dbTouch(entry - 1u);
+    *slot = (uint16_t)entry;
+    dbOrderInsert(entry - 1u);
+    return true;
+}
+
+// dbSetValue
+// searches the database, if newValue is not found then it adds it to the
+// table or overwrite the value if it is found.
+bool dbSetValue(const dbEntry_t *newValue){
+    bool stored = true;
+    dbWriteBegin();
+    volatile uint16_t *slot = dbSlotFor(newValue->deviceId, newValue->regId);
+    if(*slot) // if it is already in the database
+    {
+        dbTouch(*slot - 1u);
+        dbSetValueAt(*slot - 1u, newValue->value);
+    }
+    else{
+        stored = dbInsert(slot, newValue);
+    }
+    if(stored && dbJournal != NULL){
+        dbJournal(newValue, false);
+    }
+    dbWriteEnd();
+    return stored;
+}
+
+// dbRemove:
+// Unlink the register and put its entry back on the free-list
+bool dbRemove(const dbEntry_t *entry){
+    dbWriteBegin();
+    uint32_t i = *dbSlotFor(entry->deviceId, entry->regId);
+    if(i != 0){
+        dbUnlink(i - 1u);
+        DB_LINK(i - 1u) = dbFreeList;
+        dbFreeList = i;
+        dbCount--;
+        if(dbJournal != NULL){
+            dbJournal(entry, true);
+        }
+    }
+    dbWriteEnd();
+    return i != 0;
+}
+
+// dbCompareAndSet:
+// The compare and the store both happen under the write lock, so no other
+// write can land between them
+dbUpdate_t dbCompareAndSet(dbEntry_t *entry, uint32_t expected){
+    dbUpdate_t result = DB_UPDATED;
+    dbWriteBegin();
+    volatile uint16_t *slot = dbSlotFor(entry->deviceId, entry->regId);
+    if(*slot == 0){
+        result = DB_NOT_FOUND;
+    }
+    else{
+        uint32_t i = *slot - 1u;
+        dbTouch(i);
+        if(dbGetValueAt(i) == expected){
+            dbSetValueAt(i, entry->value);
+            if(dbJournal != NULL){
+                dbJournal(entry, false);
+            }
+        }
+        else{
+            entry->value = dbGetValueAt(i);
+            result = DB_MISMATCH;
+        }
+    }
+    dbWriteEnd();
+    return result;
+}
+
+// dbAdd:
+// Read, add and store under the write lock. A register that is not there yet
+// is added as delta, as if it had been 0.
+dbUpdate_t dbAdd(dbEntry_t *entry, uint32_t delta){
+    dbUpdate_t result = DB_UPDATED;
+    dbWriteBegin();
+    volatile uint16_t *slot = dbSlotFor(entry->deviceId, entry->regId);
+    if(*slot){
+        uint32_t i = *slot - 1u;
+        dbTouch(i);
+        entry->value = (dbGetValueAt(i) + delta) & DB_VALUE_MASK;
+        dbSetValueAt(i, entry->value);
+    }
+    else{
+        entry->value = delta & DB_VALUE_MASK;
+        if(!dbInsert(slot, entry)){
+            result = DB_FULL;
+        }
+    }
+    if(result == DB_UPDATED && dbJournal != NULL){
+        dbJournal(entry, false);
+    }
+    dbWriteEnd();
+    return result;
+}
+
+//get number of entries in the database
+uint32_t dbGetCount(void){
+    return dbCount;
+}
+
+//get the most entries the database has held
+uint32_t dbGetHighWater(void){
+    return dbHighWater;
+}
+
+//get number of registers evicted
+uint32_t dbGetEvictions(void){
+    return dbEvictions;
+}
+
+//get number of lookups repeated because of a concurrent write
+uint32_t dbGetReadRetries(void){
+    return __atomic_load_n(&dbReadRetries, __ATOMIC_RELAXED);
+}
+
+//get bytes of SRAM per entry, rounded up
+uint32_t dbGetBytesPerEntry(void){
+#if DB_PACKED_STORAGE
+    uint32_t records = sizeof(dbKeys) + sizeof(dbValues);
+#else
+    uint32_t records = sizeof(dbPool);
+#endif
+#if DB_EVICTION_POLICY == DB_EVICT_CLOCK
+    records += sizeof(dbStamps);
+#endif
+    return (records + sizeof(dbSlots) + sizeof(dbOrder) + DB_MAX_ENTRIES - 1u) / DB_MAX_ENTRIES;
+}
@@ -66,6 +66,13 @@
 /* mDNS */
 #include "mdns.h"
 
+/* Register database */
+#include "database.h"
+
+/* Idle timer wheel */
+#include "awep_idle.h"
+#include "awep_limit.h"
+
 /*******************************************************************************
 * Macros
 ********************************************************************************/
@@ -75,6 +82,9 @@
 #define TCP_SERVER_TASK_PRIORITY                  (1)
 #define CONNECT_TO_WIFI_TASK_PRIORITY			  (2)
 
+/* Interrupt priority of the user button that dumps the statistics */
+#define USER_BTN_INTR_PRIORITY (5)
+
 /*******************************************************************************
 * Global Variables
 ********************************************************************************/
@@ -82,15 +92,19 @@
 volatile int uxTopUsedPriority;
 
 /* TCP server task handle. */
-TaskHandle_t server_task_handle, secure_server_task_handle, connect_to_wifi_task_handle;
-
-// args to pass to the two tasks. One task for secure, one for non-secure
-bool security = true;
-bool noSecurity = false;
+TaskHandle_t server_task_handle, connect_to_wifi_task_handle;
 
 // IP address of the device
 cy_wcm_ip_address_t ip_address;
 
+// User button callback, it has to outlive main once the scheduler starts
+static cyhal_gpio_callback_data_t cb_data;
+
+/*******************************************************************************
+* Function Prototypes
+********************************************************************************/
+static void isr_button_press(void *callback_arg, cyhal_gpio_event_t event);
+
 /*******************************************************************************
  * Function Name: main
  ********************************************************************************
@@ -138,6 +152,24 @@ int main(){
 		CY_ASSERT(0);
 	}
 	printf("Secure Socket initialized\n");
+	dbInit();
+	printf("Register database: %d entries, %d bytes per entry\n",
+	        (int)dbGetMax(), (int)dbGetBytesPerEntry());
+	awep_idle_init(xTaskGetTickCount());
+	awep_limit_init(xTaskGetTickCount());
+	awep_limit_print();
+
+	/* Time each command with the cycle counter. */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	/* The user button dumps the statistics to the console. */
+	cb_data.callback = isr_button_press;
+	cb_data.callback_arg = NULL;
+	cyhal_gpio_init(CYBSP_USER_BTN, CYHAL_GPIO_DIR_INPUT, CYHAL_GPIO_DRIVE_PULLUP, CYBSP_BTN_OFF);
+	cyhal_gpio_register_callback(CYBSP_USER_BTN, &cb_data);
+	cyhal_gpio_enable_event(CYBSP_USER_BTN, CYHAL_GPIO_IRQ_FALL, USER_BTN_INTR_PRIORITY, true);
 
     /* Create connect to wifi task. */
     xTaskCreate(connect_to_wifi_ap_task, "connect to WiFi task", CONNECT_TO_WIFI_TASK_STACK_SIZE, NULL, CONNECT_TO_WIFI_TASK_PRIORITY, &connect_to_wifi_task_handle);
@@ -210,13 +242,11 @@ void connect_to_wifi_ap_task(void *arg){
 				printf("mDNS responder initialized successfully.\n");
 			}
 
-            /* Create the network tasks. */
-            xTaskCreate(tcp_server_task, "non-secure network task", TCP_SERVER_TASK_STACK_SIZE, &noSecurity, TCP_SERVER_TASK_PRIORITY, &server_task_handle);
-        	xTaskCreate(tcp_server_task, "secure Network task", TCP_SERVER_TASK_STACK_SIZE, &security, TCP_SERVER_TASK_PRIORITY, &secure_server_task_handle);
+            /* Create the network task, it serves both the secure and the non-secure port. */
+            xTaskCreate(tcp_server_task, "network task", TCP_SERVER_TASK_STACK_SIZE, NULL, TCP_SERVER_TASK_PRIORITY, &server_task_handle);
 
-            while(true){
-                	vTaskDelay(1);
-                }
+            // The network task also takes the button presses, this one is done
+            vTaskDelete(NULL);
         }
 
         printf("Connection to Wi-Fi network failed with error code %d."
@@ -229,4 +259,23 @@ void connect_to_wifi_ap_task(void *arg){
     CY_ASSERT(0);
 }
 
+/*******************************************************************************
+ * Function Name: isr_button_press
+ *******************************************************************************
+ * Summary:
+ *  GPIO interrupt service routine, wakes the network task to dump the
+ *  statistics.
+ *
+ * Parameters:
+ *  void *callback_arg : pointer to variable passed to the ISR
+ *  cyhal_gpio_event_t event : GPIO event type
+ *
+ * Return:
+ *  None
+ *
+ *******************************************************************************/
+static void isr_button_press(void *callback_arg, cyhal_gpio_event_t event){
+    tcp_server_stats_from_isr();
+}
+
 /* [] END OF FILE */
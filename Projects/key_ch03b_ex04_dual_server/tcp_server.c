@@ -45,23 +45,42 @@
 #include <FreeRTOS.h>
 #include <task.h>
 #include <semphr.h>
+#include <queue.h>
 
 /* Cypress secure socket header file */
 #include "cy_secure_sockets.h"
 #include "cy_tls.h"
 
 /* Standard C header file */
-#include <stdlib.h>
 #include <string.h>
 
 /* TCP server task header file. */
 #include "tcp_server.h"
 
-/* Linked list */
-#include "linkedList.h"
+/* Register database */
+#include "database.h"
 
-/* isxdigit() */
-#include <ctype.h>
+/* AWEP command decoder and reply encoder */
+#include "awep.h"
+
+/* AWEP stream framer */
+#include "awep_framer.h"
+
+/* AWEP reply queue */
+#include "awep_writer.h"
+
+/* Table of connected clients */
+#include "awep_conn.h"
+
+/* Server statistics */
+#include "awep_stats.h"
+
+/* Idle timer wheel */
+#include "awep_idle.h"
+#include "awep_limit.h"
+
+/* lwIP configuration, for the TCP connection limit */
+#include "lwipopts.h"
 
 /* Wi-Fi connection manager header files */
 #include "cy_wcm.h"
@@ -71,14 +90,47 @@
 ********************************************************************************/
 /* RTOS related macros for TCP server task. */
 
+/* Every client holds a TCP PCB for as long as it is connected, and so does
+ * every connection waiting on either listener and the one being turned away. */
+#if (AWEP_MAX_CONNECTIONS + 2 * TCP_SERVER_MAX_PENDING_CONNECTIONS + 1 > MEMP_NUM_TCP_PCB)
+#error "AWEP_MAX_CONNECTIONS and the pending connections must fit in MEMP_NUM_TCP_PCB"
+#endif
+
+
+/*******************************************************************************
+* Data Types
+********************************************************************************/
+/* What a socket callback, or the user button, asks the server task to do. */
+typedef enum {
+    TCP_SERVER_EVENT_ACCEPT,        /* a client is waiting on a listener */
+    TCP_SERVER_EVENT_RECEIVE,       /* a client sent something */
+    TCP_SERVER_EVENT_DISCONNECT,    /* a client closed its end */
+    TCP_SERVER_EVENT_STATS          /* the user button was pressed */
+} tcp_server_event_type_t;
+
+typedef struct {
+    tcp_server_event_type_t type;
+    bool security;                  /* the socket belongs to the secure listener */
+    cy_socket_t socket;             /* listener for an accept, client otherwise */
+} tcp_server_event_t;
 
 /*******************************************************************************
 * Function Prototypes
 ********************************************************************************/
-cy_rslt_t create_tcp_server_socket(bool* security, cy_socket_t* server_handle, cy_socket_sockaddr_t* server_addr, cy_socket_t* client_handle);
+cy_rslt_t create_tcp_server_socket(bool* security, cy_socket_t* server_handle, cy_socket_sockaddr_t* server_addr);
 cy_rslt_t tcp_connection_handler(cy_socket_t socket_handle, void *arg);
 cy_rslt_t tcp_receive_msg_handler(cy_socket_t socket_handle, void *arg);
 cy_rslt_t tcp_disconnection_handler(cy_socket_t socket_handle, void *arg);
+static void start_listener(bool* security, cy_socket_t* server_handle, uint16_t port);
+static void post_event(tcp_server_event_type_t type, bool security, cy_socket_t socket_handle);
+static void accept_client(cy_socket_t server_handle, bool security);
+static void receive_client(cy_socket_t socket_handle, bool security);
+static void disconnect_client(cy_socket_t socket_handle);
+static void refresh_stats(void);
+static uint32_t cycles_to_micros(uint32_t cycles);
+static void close_conn(awep_conn_t *conn);
+static void release_conn(awep_conn_t *conn);
+static void reap_idle(void);
 
 /*******************************************************************************
 * Global Variables
@@ -94,13 +146,36 @@ void *tls_identity;
 extern cy_wcm_ip_address_t ip_address;
 
 // Buffers to print to
-char secureBuffer[100];
-char nonSecureBuffer[100];
+char secureBuffer[128];
+char nonSecureBuffer[128];
+
+// Which listener a socket belongs to, handed to its callbacks
+static bool secure_listener = true;
+static bool plain_listener = false;
+
+// Events from the socket callbacks and the user button, in the order they happened
+static QueueHandle_t server_events;
+
+// Events dropped for a full queue, and the listener of each dropped accept by
+// security, accepted once the server task gets to it
+static volatile uint32_t events_dropped;
+static volatile cy_socket_t missed_accept[2];
+
+// Cycles the server task spent waiting for an event and in all since the
+// statistics were last printed, for its load
+static uint64_t waiting_cycles;
+static uint64_t elapsed_cycles;
+
 /*******************************************************************************
  * Function Name: tcp_server_task
  *******************************************************************************
  * Summary:
- *  Task used to establish a connection to a remote TCP client.
+ *  The one task that serves both the secure and the non-secure port. It sets
+ *  up both listeners and then waits for the next event from the socket
+ *  callbacks. Accepting a client, the TLS handshake, receiving its command,
+ *  running it and sending the reply all happen here, the callbacks only queue
+ *  the event. Between events the task is blocked, waking at the latest when
+ *  the next slot of the idle timer wheel is due.
  *
  * Parameters:
  *  void *args : Task parameter defined during task creation (unused)
@@ -113,66 +188,137 @@ void tcp_server_task(void *arg){
 
 	cy_rslt_t result;
 
-	// var passed in when task is created, 0 for nonsecure, 1 for secure
-	bool security = (*(bool*)arg);
-
-	//server handle and address
+	//listener handles
 	static cy_socket_t server_handle;
-	cy_socket_t client_handle;
-	cy_socket_sockaddr_t server_addr;
+	static cy_socket_t secure_server_handle;
 
-	// Populate the ip var with the device ip and correct port
-	server_addr.ip_address.ip.v4 = ip_address.ip.v4;
-	server_addr.ip_address.version = CY_SOCKET_IP_VER_V4;
+	// event to handle next and when the wheel was last turned
+	tcp_server_event_t event;
+	TickType_t last_reap;
+	TickType_t waited;
 
-	// secure specific setup
-	if(security){
+	// cycle counter when the load was last brought up to date
+	uint32_t last_cycles;
+	uint32_t wait_start;
 
-		server_addr.port = SECURE_TCP_SERVER_PORT;
+	/* TLS credentials of the TCP server. */
+	static const char tcp_server_cert[] = SERVER_CERTIFICATE_PEM;
+	static const char server_private_key[] = SERVER_PRIVATE_KEY_PEM;
 
-		/* TLS credentials of the TCP server. */
-		static const char tcp_server_cert[] = SERVER_CERTIFICATE_PEM;
-		static const char server_private_key[] = SERVER_PRIVATE_KEY_PEM;
+	/* Root CA certificate for TCP client identity verification. */
+	static const char tcp_client_ca_cert[] = ROOTCA_PEM;
 
-		/* Root CA certificate for TCP client identity verification. */
-		static const char tcp_client_ca_cert[] = ROOTCA_PEM;
+	// The callbacks start queueing as soon as a listener is up
+	awep_conn_init();
+	server_events = xQueueCreate(TCP_SERVER_EVENT_QUEUE_LENGTH, sizeof(tcp_server_event_t));
+	if(server_events == NULL){
+		printf("Failed to create the server event queue!\n");
+		CY_ASSERT(0);
+	}
 
-		/* Create TCP server identity using the SSL certificate and private key. */
-		result = cy_tls_create_identity(tcp_server_cert, strlen(tcp_server_cert), server_private_key, strlen(server_private_key), &tls_identity);
-		if(result != CY_RSLT_SUCCESS){
-			printf("Failed cy_tls_create_identity! Error code: %d\n", (int)result);
-			CY_ASSERT(0);
-		}
+	/* Create TCP server identity using the SSL certificate and private key. */
+	result = cy_tls_create_identity(tcp_server_cert, strlen(tcp_server_cert), server_private_key, strlen(server_private_key), &tls_identity);
+	if(result != CY_RSLT_SUCCESS){
+		printf("Failed cy_tls_create_identity! Error code: %d\n", (int)result);
+		CY_ASSERT(0);
+	}
+
+	/* Initializes the global trusted RootCA certificate. This examples uses a self signed
+	 * certificate which implies that the RootCA certificate is same as the TCP client
+	 * certificate. */
+	result = cy_tls_load_global_root_ca_certificates(tcp_client_ca_cert, strlen(tcp_client_ca_cert));
+	if( result != CY_RSLT_SUCCESS){
+		printf("cy_tls_load_global_root_ca_certificates failed\n");
+		CY_ASSERT(0);
+	}
+	else{
+		printf("Global trusted RootCA certificate loaded\n");
+	}
 
-		/* Initializes the global trusted RootCA certificate. This examples uses a self signed
-		 * certificate which implies that the RootCA certificate is same as the TCP client
-		 * certificate. */
-		result = cy_tls_load_global_root_ca_certificates(tcp_client_ca_cert, strlen(tcp_client_ca_cert));
-		if( result != CY_RSLT_SUCCESS){
-			printf("cy_tls_load_global_root_ca_certificates failed\n");
-			CY_ASSERT(0);
+	start_listener(&plain_listener, &server_handle, TCP_SERVER_PORT);
+	start_listener(&secure_listener, &secure_server_handle, SECURE_TCP_SERVER_PORT);
+
+	last_reap = xTaskGetTickCount();
+	last_cycles = DWT->CYCCNT;
+	while(true){
+		// Sleep until something happens or the next slot of the wheel is due.
+		// The loop comes round at least once a slot, well inside a turn of the
+		// cycle counter
+		waited = xTaskGetTickCount() - last_reap;
+		wait_start = DWT->CYCCNT;
+		BaseType_t received = xQueueReceive(server_events, &event,
+				(waited < AWEP_IDLE_SLOT_TICKS) ? AWEP_IDLE_SLOT_TICKS - waited : 0);
+		waiting_cycles += DWT->CYCCNT - wait_start;
+		elapsed_cycles += DWT->CYCCNT - last_cycles;
+		last_cycles = DWT->CYCCNT;
+		if(received == pdTRUE){
+			switch(event.type){
+			case TCP_SERVER_EVENT_ACCEPT:
+				accept_client(event.socket, event.security);
+				break;
+			case TCP_SERVER_EVENT_RECEIVE:
+				receive_client(event.socket, event.security);
+				break;
+			case TCP_SERVER_EVENT_DISCONNECT:
+				disconnect_client(event.socket);
+				break;
+			case TCP_SERVER_EVENT_STATS:
+				print_stats();
+				break;
+			}
 		}
-		else{
-			printf("Global trusted RootCA certificate loaded\n");
+
+		// Accepts dropped while the queue was full, the clients are still waiting
+		for(uint32_t i = 0; i < 2u; i++){
+			cy_socket_t listener = missed_accept[i];
+			if(listener != NULL){
+				missed_accept[i] = NULL;
+				accept_client(listener, i != 0u);
+			}
 		}
 
+		// Close the clients that connected and then said nothing, once per slot of the wheel
+		if(xTaskGetTickCount() - last_reap >= AWEP_IDLE_SLOT_TICKS){
+			last_reap = xTaskGetTickCount();
+			reap_idle();
+		}
 	}
-	// non-secure specific setup
-	else{
-		server_addr.port = TCP_SERVER_PORT;
-	}
+
+ }
+
+/*******************************************************************************
+ * Function Name: start_listener
+ *******************************************************************************
+ * Summary:
+ *  Create the secure or the non-secure listener and start listening on it.
+ *
+ * Parameters:
+ *  bool* security: Which listener, also the argument of its callbacks
+ *  cy_socket_t* server_handle: Handle of the listener created
+ *  uint16_t port: Port to listen on
+ *
+ *******************************************************************************/
+static void start_listener(bool* security, cy_socket_t* server_handle, uint16_t port){
+
+	cy_rslt_t result;
+	cy_socket_sockaddr_t server_addr;
+
+	// Populate the ip var with the device ip and correct port
+	server_addr.ip_address.ip.v4 = ip_address.ip.v4;
+	server_addr.ip_address.version = CY_SOCKET_IP_VER_V4;
+	server_addr.port = port;
 
 	/* Create TCP server socket. */
-	result = create_tcp_server_socket(&security, &server_handle, &server_addr, &client_handle);
+	result = create_tcp_server_socket(security, server_handle, &server_addr);
 	if (result != CY_RSLT_SUCCESS){
 		printf("Failed to create socket!\n");
 		CY_ASSERT(0);
 	}
 
 	/* Start listening on the TCP server socket. */
-	result = cy_socket_listen(server_handle, TCP_SERVER_MAX_PENDING_CONNECTIONS);
+	result = cy_socket_listen(*server_handle, TCP_SERVER_MAX_PENDING_CONNECTIONS);
 	if (result != CY_RSLT_SUCCESS){
-		cy_socket_delete(server_handle);
+		cy_socket_delete(*server_handle);
 		printf("cy_socket_listen returned error. Error: %d\n", (int)result);
 		CY_ASSERT(0);
 	}
@@ -181,12 +327,25 @@ void tcp_server_task(void *arg){
 		printf("Listening for incoming TCP client connection on Port: %d\n",
 				server_addr.port);
 	}
+}
 
-	while(true){
-		vTaskDelay(1);
+/*******************************************************************************
+ * Function Name: tcp_server_stats_from_isr
+ *******************************************************************************
+ * Summary:
+ *  Ask the server task to dump the statistics, from the user button ISR.
+ *
+ *******************************************************************************/
+void tcp_server_stats_from_isr(void){
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	tcp_server_event_t event = {.type = TCP_SERVER_EVENT_STATS, .security = false, .socket = NULL};
+
+	// The button may be pressed before Wi-Fi is up and the server has started
+	if(server_events != NULL){
+		xQueueSendFromISR(server_events, &event, &xHigherPriorityTaskWoken);
+		portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 	}
-
- }
+}
 
 /*******************************************************************************
  * Function Name: create_tcp_server_socket
@@ -195,7 +354,7 @@ void tcp_server_task(void *arg){
  *  Function to create a socket and set the socket options
  *
  *******************************************************************************/
-cy_rslt_t create_tcp_server_socket(bool* security, cy_socket_t* server_handle, cy_socket_sockaddr_t* server_addr, cy_socket_t* client_handle){
+cy_rslt_t create_tcp_server_socket(bool* security, cy_socket_t* server_handle, cy_socket_sockaddr_t* server_addr){
 
     cy_rslt_t result;
 
@@ -255,7 +414,7 @@ cy_rslt_t create_tcp_server_socket(bool* security, cy_socket_t* server_handle, c
 
 	/* Register the callback function to handle connection request from a TCP client. */
 	tcp_connection_option.callback = tcp_connection_handler;
-	tcp_connection_option.arg = client_handle;
+	tcp_connection_option.arg = security;
 	result = cy_socket_setsockopt(*server_handle, CY_SOCKET_SOL_SOCKET, CY_SOCKET_SO_CONNECT_REQUEST_CALLBACK, &tcp_connection_option, sizeof(cy_socket_opt_callback_t));
 	if(result != CY_RSLT_SUCCESS){
 		printf("Set socket option: CY_SOCKET_SO_CONNECT_REQUEST_CALLBACK failed\n");
@@ -273,7 +432,7 @@ cy_rslt_t create_tcp_server_socket(bool* security, cy_socket_t* server_handle, c
 
 	/* Register the callback function to handle disconnection. */
 	tcp_disconnection_option.callback = tcp_disconnection_handler;
-	tcp_disconnection_option.arg = NULL;
+	tcp_disconnection_option.arg = security;
 	result = cy_socket_setsockopt(*server_handle, CY_SOCKET_SOL_SOCKET, CY_SOCKET_SO_DISCONNECT_CALLBACK, &tcp_disconnection_option, sizeof(cy_socket_opt_callback_t));
 	if(result != CY_RSLT_SUCCESS){
 		printf("Set socket option: CY_SOCKET_SO_DISCONNECT_CALLBACK failed\n");
@@ -294,40 +453,95 @@ cy_rslt_t create_tcp_server_socket(bool* security, cy_socket_t* server_handle, c
  * Function Name: tcp_connection_handler
  *******************************************************************************
  * Summary:
- *  Callback function to handle incoming TCP client connection.
+ *  Callback function to handle incoming TCP client connection. It runs in the
+ *  secure sockets worker thread and leaves the accept to the server task.
  *
  * Parameters:
  * cy_socket_t socket_handle: Connection handle for the TCP server socket
- *  void *args : Unused
+ *  void *args : Bool representing whether it is the secure or non secure listener
  *
  * Return:
  *  cy_result result: Result of the operation
  *
  *******************************************************************************/
 cy_rslt_t tcp_connection_handler(cy_socket_t socket_handle, void *arg){
+    post_event(TCP_SERVER_EVENT_ACCEPT, *(bool*)arg, socket_handle);
+    return CY_RSLT_SUCCESS;
+}
+
+ /*******************************************************************************
+ * Function Name: post_event
+ *******************************************************************************
+ * Summary:
+ *  Queue an event for the server task. While the queue is full the secure
+ *  sockets worker waits up to TCP_SERVER_EVENT_WAIT_MS, it carries every
+ *  socket's traffic including the TLS handshake the server task may be in,
+ *  and then the event is dropped. A dropped accept is remembered for the
+ *  server task to do later. A client whose receive or disconnect was dropped
+ *  is closed by the idle reaper.
+ *
+ *******************************************************************************/
+static void post_event(tcp_server_event_type_t type, bool security, cy_socket_t socket_handle){
+    tcp_server_event_t event = {.type = type, .security = security, .socket = socket_handle};
+    if(xQueueSend(server_events, &event, pdMS_TO_TICKS(TCP_SERVER_EVENT_WAIT_MS)) != pdTRUE){
+        events_dropped++;
+        if(type == TCP_SERVER_EVENT_ACCEPT){
+            missed_accept[security ? 1 : 0] = socket_handle;
+        }
+    }
+}
+
+ /*******************************************************************************
+ * Function Name: accept_client
+ *******************************************************************************
+ * Summary:
+ *  Accept the client waiting on a listener, which for the secure listener
+ *  includes the TLS handshake.
+ *
+ * Parameters:
+ * cy_socket_t server_handle: Listener the client is waiting on
+ * bool security: Whether it is the secure or the non secure listener
+ *
+ *******************************************************************************/
+static void accept_client(cy_socket_t server_handle, bool security){
 
     cy_rslt_t result;
 
-    //pointer to client handle passed through arg
-    cy_socket_t* client_handle = arg;
+    // handle of the accepted client
+    cy_socket_t client_handle;
 
     // var to store the address of the connecting client
     cy_socket_sockaddr_t peer_addr;
 
     /* Size of the peer socket address. */
-    uint32_t peer_addr_len;
+    uint32_t peer_addr_len = sizeof(peer_addr);
 
     /* Accept new incoming connection from a TCP client.*/
-    result = cy_socket_accept(socket_handle, &peer_addr, &peer_addr_len, client_handle);
-
-    // Vars to determine if the connection was secure or non-secure
-	cy_socket_tls_auth_mode_t tls_auth_mode;
-	uint32_t length = sizeof(cy_socket_tls_auth_mode_t);
-	cy_socket_getsockopt(socket_handle, CY_SOCKET_SOL_TLS, CY_SOCKET_SO_TLS_AUTH_MODE, &tls_auth_mode, &length);
+    result = cy_socket_accept(server_handle, &peer_addr, &peer_addr_len, &client_handle);
 
     if(result == CY_RSLT_SUCCESS){
+		// Give the client its own framer and reply queue, turn it away if there is no room
+		uint32_t now = xTaskGetTickCount();
+		awep_conn_t *conn = awep_conn_open(client_handle, peer_addr.ip_address.ip.v4, now);
+		if(conn == NULL){
+			// ASCII, the client has not said which protocol it speaks yet
+			char reply[AWEP_REPLY_MAX];
+			uint32_t bytes_sent;
+			uint32_t reply_length = awep_encode_error(reply, sizeof(reply), AWEP_ERR_BUSY, 0) + 1u;
+			if(cy_socket_send(client_handle, reply, reply_length, CY_SOCKET_FLAGS_NONE, &bytes_sent) == CY_RSLT_SUCCESS){
+				awep_stats_add(AWEP_STAT_BYTES_OUT, reply_length);
+			}
+			awep_stats_add(AWEP_STAT_REJECTED, 1u);
+			printf("Connection table full, turned the new connection away\n");
+			cy_socket_disconnect(client_handle, 0);
+			cy_socket_delete(client_handle);
+			return;
+		}
+		awep_idle_start(awep_conn_index(conn), now, TCP_SERVER_IDLE_TICKS);
+		awep_limit_start(awep_conn_index(conn), now);
+
 		// Print Connection Info to the appropriate buffer
-		if(tls_auth_mode == CY_SOCKET_TLS_VERIFY_REQUIRED){
+		if(security){
 			sprintf(secureBuffer,"Connection from IP: %d.%d.%d.%d\tConnection: Secure\t",(uint8)peer_addr.ip_address.ip.v4,
 																						 (uint8)(peer_addr.ip_address.ip.v4 >> 8),
 																						 (uint8)(peer_addr.ip_address.ip.v4 >> 16),
@@ -343,8 +557,6 @@ cy_rslt_t tcp_connection_handler(cy_socket_t socket_handle, void *arg){
     else{
         printf("Failed to accept incoming client connection. Error: %d\n", (int)result);
     }
-
-    return result;
 }
 /*******************************************************************************
 * Function Name: sendAck
@@ -353,50 +565,43 @@ cy_rslt_t tcp_connection_handler(cy_socket_t socket_handle, void *arg){
 * Function to send acknowledgement to tcp client.
 *
 * Parameters:
-* char *message: message to send
-* cy_socket_t socket_handle: Connection handle for the TCP client socket
+* awep_conn_t *conn: Client whose queued reply is sent, only as long as it needs to be
+* bool binary: message is a binary AWEP reply
 *
 * Return:
 *  void
 *
 *******************************************************************************/
-void sendAck(char *message, cy_socket_t socket_handle, bool security){
+void sendAck(awep_conn_t *conn, bool security, bool binary){
 
 	cy_rslt_t result;
 	uint32_t bytes_sent;
+	cy_socket_t socket_handle = conn->socket;
+	awep_writer_t *writer = &conn->writer;
 	// Buffer for creating the connection information prints
-	char writeBuffer[30];
+	char writeBuffer[12 + AWEP_REPLY_MAX];
 
 	/* Send the command to TCP server. */
-	result = cy_socket_send(socket_handle, message, MAX_TCP_DATA_PACKET_LENGTH, CY_SOCKET_FLAGS_NONE, &bytes_sent);
+	result = cy_socket_send(socket_handle, writer->buffer, writer->length, CY_SOCKET_FLAGS_NONE, &bytes_sent);
 	if(result == CY_RSLT_SUCCESS ){
-		if(security){
-			sprintf(writeBuffer,"Response: %s\n", message);
-			strcat(secureBuffer, writeBuffer);
-
+		if(binary){
+			sprintf(writeBuffer,"Response: status %d\n", (int)(uint8_t)writer->buffer[1]);
 		}
 		else{
-			sprintf(writeBuffer,"Response: %s\n", message);
-			strcat(nonSecureBuffer, writeBuffer);
+			sprintf(writeBuffer,"Response: %s\n", writer->buffer);
 		}
+		strcat(security ? secureBuffer : nonSecureBuffer, writeBuffer);
+		awep_stats_add(AWEP_STAT_BYTES_OUT, writer->length);
+		awep_writer_sent(writer);
 	}
 	else{
 		printf("Failed to send ack to client. Error: %d\n", (int)result);
+		awep_writer_init(writer);
 	}
 
 
-	// Disconnect once the ack has been sent
-	result = cy_socket_disconnect(socket_handle, 0);
-	if(result != CY_RSLT_SUCCESS){
-		printf("Disconnect Failed!\n");
-		CY_ASSERT(0);
-	}
-	/* Delete the client socket. */
-	result = cy_socket_delete(socket_handle);
-	if(result != CY_RSLT_SUCCESS){
-		printf("Socket Delete Failed!\n");
-		CY_ASSERT(0);
-	}
+	// Disconnect once the ack has been sent, the socket goes with the caller's hold
+	close_conn(conn);
 
 	// Print the connection information
 	if(security){
@@ -408,11 +613,149 @@ void sendAck(char *message, cy_socket_t socket_handle, bool security){
 }
 
 
+ /*******************************************************************************
+ * Function Name: handle_command
+ *******************************************************************************
+ * Summary:
+ *  Decode one AWEP command, run it against the register database and send the
+ *  reply, which also closes the connection. A command over the rate limit is
+ *  answered "X Throttled" without being run.
+ *
+ * Parameters:
+ * char *frame: Command from the stream framer
+ * uint32_t length: Length of the command
+ * awep_conn_t *conn: Client the command came from
+ * bool security: Whether the command came from the secure or non secure socket
+ * bool throttled: The client or the server is out of tokens
+ *
+ * Return:
+ *  void
+ *
+ *******************************************************************************/
+static void handle_command(char *frame, uint32_t length, awep_conn_t *conn, bool security, bool throttled){
+
+    // The command is binary AWEP
+    bool binary = conn->framer.binary;
+
+    // Buffer for creating the connection information prints
+    char writeBuffer[30];
+
+    // Buffer the connection information prints are added to
+    char *logBuffer = security ? secureBuffer : nonSecureBuffer;
+
+    //new database entry to add onto the list
+    dbEntry_t receive;
+
+    // decoded command and the result of decoding it
+    awep_request_t request;
+    awep_status_t status;
+
+    // register value, or the entry count when the database is full
+    uint32_t value = 0;
+
+    // queue the reply is written into
+    awep_writer_t *writer = &conn->writer;
+    char *returnMessage = awep_writer_space(writer);
+    uint32_t returnLength;
+
+    if(binary){
+        status = awep_decode_binary((const uint8_t *)frame, length, &request);
+    }
+    else{
+        // Check the length, the command and that the rest are ASCII hex digits
+        status = awep_decode(frame, length, &request);
+    }
+    // The connection closes after one send, there is nothing to push watches to
+    // and a range read or the statistics may not fit
+    if(status == AWEP_OK && (request.command == 'S' || request.command == 'U' ||
+                             request.command == 'G' || request.command == 'T')){
+        status = AWEP_ERR_COMMAND;
+    }
+    // Over the rate limit the command is answered but not run
+    if(status == AWEP_OK && throttled){
+        status = AWEP_ERR_THROTTLED;
+    }
+    if(status != AWEP_OK){
+        sprintf(writeBuffer,"Message: Length: %d\t", (int)request.length);
+        strcat(logBuffer, writeBuffer);
+    }
+    else{
+        receive.deviceId = request.deviceId;
+        receive.regId = request.regId;
+        receive.value = request.value;
+
+        // Write command
+        if(request.command == 'W'){
+            //Save it, this fails only if the device is new and there is no room to add it
+            if(dbSetValue(&receive)){
+                value = receive.value;
+            }
+            else{
+                status = AWEP_ERR_FULL;
+                value = dbGetCount();
+            }
+        }
+        // Compare and swap, the reply carries the current value when it does not match
+        else if(request.command == 'C'){
+            dbUpdate_t update = dbCompareAndSet(&receive, request.expected);
+            value = receive.value;
+            if(update == DB_MISMATCH){
+                status = AWEP_ERR_MISMATCH;
+            }
+            else if(update == DB_NOT_FOUND){
+                status = AWEP_ERR_NOT_FOUND;
+            }
+        }
+        // Increment, the ack carries the value after the add
+        else if(request.command == 'I'){
+            if(dbAdd(&receive, request.value) == DB_UPDATED){
+                value = receive.value;
+            }
+            else{
+                status = AWEP_ERR_FULL;
+                value = dbGetCount();
+            }
+        }
+        // read, look through the database to find a previous write of the deviceId/regId
+        else if(dbFind(&receive)){
+            value = receive.value;
+        }
+        else{
+            status = AWEP_ERR_NOT_FOUND;
+        }
+
+        if(status == AWEP_OK){
+            if(binary){
+                sprintf(writeBuffer,"Message: %c%04X%02X\t", request.command,
+                        (unsigned int)request.deviceId, (unsigned int)request.regId);
+            }
+            else{
+                sprintf(writeBuffer,"Message: %s\t", frame);
+            }
+            strcat(logBuffer, writeBuffer);
+        }
+    }
+
+    awep_stats_request(&request, status);
+    if(binary){
+        returnLength = awep_encode_binary_reply((uint8_t *)returnMessage, AWEP_REPLY_MAX, status, value);
+    }
+    else if(status == AWEP_OK){
+        returnLength = awep_encode_ack(returnMessage, AWEP_REPLY_MAX, receive.deviceId, receive.regId, value) + 1u;
+    }
+    else{
+        returnLength = awep_encode_error(returnMessage, AWEP_REPLY_MAX, status, value) + 1u;
+    }
+    awep_writer_commit(writer, returnLength);
+    sendAck(conn, security, binary);
+}
+
  /*******************************************************************************
  * Function Name: tcp_receive_msg_handler
  *******************************************************************************
  * Summary:
- *  Callback function to handle incoming TCP client messages.
+ *  Callback function to handle incoming TCP client messages, the server task
+ *  receives them.
  *
  * Parameters:
  * cy_socket_t socket_handle: Connection handle for the TCP client socket
@@ -423,148 +766,63 @@ void sendAck(char *message, cy_socket_t socket_handle, bool security){
  *
  *******************************************************************************/
 cy_rslt_t tcp_receive_msg_handler(cy_socket_t socket_handle, void *arg){
+    post_event(TCP_SERVER_EVENT_RECEIVE, *(bool*)arg, socket_handle);
+    return CY_RSLT_SUCCESS;
+}
 
-	// Security var passed in
-	bool security = (*(bool*)arg);
+ /*******************************************************************************
+ * Function Name: receive_client
+ *******************************************************************************
+ * Summary:
+ *  Receive what a client sent. The bytes go through the stream framer so a
+ *  command split across segments waits for the rest of it. Each connection
+ *  carries one command, so only the first complete command is handled.
+ *
+ * Parameters:
+ * cy_socket_t socket_handle: Connection handle for the TCP client socket
+ * bool security: Whether the message came from the secure or non secure socket
+ *
+ *******************************************************************************/
+static void receive_client(cy_socket_t socket_handle, bool security){
 
     cy_rslt_t result;
 
-    // buffer to store the message that is being recieved
-    char message_buffer[MAX_TCP_RECV_BUFFER_SIZE];
-
-    // Buffer for creating the connection information prints
-    char writeBuffer[30];
-
-    // linked list to store connection information in
-    static dbEntry_t head = {
-    	.next = NULL,
-    	.deviceId = 0,
-    	.regId = 0
-    };
+    // client the message came from, none once its reply has closed it
+    awep_conn_t *conn = awep_conn_get(socket_handle);
+    if(conn == NULL){
+        return;
+    }
 
-    //new database entry to add onto the list
-    dbEntry_t receive;
+    // framer holding what has been received on this connection
+    awep_framer_t *framer = &conn->framer;
 
-    // var to store commandID - W/R
-    char commandId;
+    // next complete command from the framer
+    char frame[MAX_TCP_RECV_BUFFER_SIZE];
+    uint32_t frame_length;
 
     /* Variable to store number of bytes received from TCP client. */
     uint32_t bytes_received = 0;
 
-    // Receive
-    result = cy_socket_recv(socket_handle, message_buffer, MAX_TCP_RECV_BUFFER_SIZE,
+    // Receive straight into the free space of the framer
+    char *space;
+    uint32_t space_length = awep_framer_space(framer, &space);
+    result = cy_socket_recv(socket_handle, space, space_length,
                             CY_SOCKET_FLAGS_NONE, &bytes_received);
 
-    // buffer to store message to send
-    char returnMessage[MAX_TCP_RECV_BUFFER_SIZE];
-
-    //create char* containing message so strlen() can be used to find length
-    char *messageString = &message_buffer[0];
-
     if(result == CY_RSLT_SUCCESS)
     {
-
-        // to many characters, reject
-        if(strlen(messageString) > 12){
-			snprintf(returnMessage, MAX_TCP_RECV_BUFFER_SIZE , "X illegal length");
-			if(security){
-				sprintf(writeBuffer,"Message: Length: %d\t", strlen(messageString));
-				strcat(secureBuffer, writeBuffer);
-			}
-			else{
-				sprintf(writeBuffer,"Message: Length: %d\t", strlen(messageString));
-				strcat(nonSecureBuffer, writeBuffer);
-			}
-			sendAck(returnMessage, socket_handle, security);
-			return result;
-		}
-
-        // Check that it is the correct length and has a legal command
-        if(!((strlen(messageString) == 7 && message_buffer[0] == 'R') || (strlen(messageString) == 11 && message_buffer[0] == 'W'))){
-        	snprintf(returnMessage, MAX_TCP_RECV_BUFFER_SIZE, "X illegal command");
-        	if(security){
-				sprintf(writeBuffer,"Message: Length: %d\t", strlen(messageString));
-				strcat(secureBuffer, writeBuffer);
-			}
-			else{
-				sprintf(writeBuffer,"Message: Length: %d\t", strlen(messageString));
-				strcat(nonSecureBuffer, writeBuffer);
-			}
-        	sendAck(returnMessage, socket_handle, security);
-        	return result;
+        conn->bytesReceived += bytes_received;
+        conn->lastActivity = xTaskGetTickCount();
+        awep_idle_touch(awep_conn_index(conn), conn->lastActivity);
+        awep_stats_add(AWEP_STAT_BYTES_IN, bytes_received);
+        awep_framer_commit(framer, bytes_received);
+        if(awep_framer_next(framer, frame, sizeof(frame), &frame_length)){
+            conn->commands++;
+            uint32_t start = DWT->CYCCNT;
+            bool throttled = !awep_limit_take(awep_conn_index(conn), xTaskGetTickCount());
+            handle_command(frame, frame_length, conn, security, throttled);
+            awep_stats_service(cycles_to_micros(DWT->CYCCNT - start));
         }
-
-        // All of the bytes must be a ASCII hex digit from 1->end of string
-        for(int i = 1; i < strlen(messageString); i++){
-        	if(!isxdigit((int)message_buffer[i])){
-        		snprintf(returnMessage, MAX_TCP_RECV_BUFFER_SIZE, "X illegal character");
-        		if(security){
-					sprintf(writeBuffer,"Message: Length: %d\t", strlen(messageString));
-					strcat(secureBuffer, writeBuffer);
-				}
-				else{
-					sprintf(writeBuffer,"Message: Length: %d\t", strlen(messageString));
-					strcat(nonSecureBuffer, writeBuffer);
-				}
-        		sendAck(returnMessage, socket_handle, security);
-        		return result;
-        	}
-        }
-
-        // Write command
-        if(message_buffer[0] == 'W'){
-        	//parse the string
-        	sscanf((const char*)message_buffer,"%c%4x%2x%4x", (char *)&commandId, (int*)&receive.deviceId, (int*)&receive.regId, (int*)&receive.value);
-        	receive.next = NULL;
-
-        	//See if the device is already in the database, or if there's room to add it
-        	if((dbFind(&head, &receive) != NULL) || (dbGetCount(&head) <= dbGetMax())){
-        		sprintf(returnMessage,"A%04X%02X%04X",(unsigned int)receive.deviceId,(unsigned int)receive.regId,(unsigned int)receive.value);
-        		dbEntry_t *newDB = malloc(sizeof(dbEntry_t)); // make a new entry to put in the database
-        		memcpy(newDB,&receive,sizeof(dbEntry_t)); // copy the received data into the new entry
-        		dbSetValue(&head, newDB); // save it.
-        		if(security){
-					sprintf(writeBuffer,"Message: %s\t", messageString);
-					strcat(secureBuffer, writeBuffer);
-				}
-				else{
-					sprintf(writeBuffer,"Message: %s\t", messageString);
-					strcat(nonSecureBuffer, writeBuffer);
-				}
-        		sendAck(returnMessage, socket_handle, security);
-        		return result;
-        	}
-        	else{
-        		sprintf(returnMessage,"X Database Full %d",(int)dbGetCount(&head));
-        		sendAck(returnMessage, socket_handle, security);
-        		return result;
-        	}
-        }
-        // read
-        if(message_buffer[0] == 'R'){
-        	// Parse the string
-			sscanf((const char *)message_buffer,"%c%4x%2x",(char *)&commandId,( int *)&receive.deviceId,( int *)&receive.regId);
-			dbEntry_t *foundValue = dbFind(&head, &receive); // look through the database to find a previous write of the deviceId/regId
-			if(foundValue){
-				sprintf(returnMessage,"A%04X%02X%04X",(unsigned int)foundValue->deviceId,(unsigned int)foundValue->regId,(unsigned int)foundValue->value);
-				if(security){
-					sprintf(writeBuffer,"Message: %s\t", messageString);
-					strcat(secureBuffer, writeBuffer);
-				}
-				else{
-					sprintf(writeBuffer,"Message: %s\t", messageString);
-					strcat(nonSecureBuffer, writeBuffer);
-				}
-				sendAck(returnMessage, socket_handle, security);
-				return result;
-			}
-			else{
-				sprintf(returnMessage,"X Not Found");
-				sendAck(returnMessage, socket_handle, security);
-				return result;
-			}
-		}
-
     }
     // cy_socket_recv did not return CY_RSLT_SUCCESS
     else
@@ -573,36 +831,90 @@ cy_rslt_t tcp_receive_msg_handler(cy_socket_t socket_handle, void *arg){
               (int)result);
         if(result == CY_RSLT_MODULE_SECURE_SOCKETS_CLOSED)
         {
-            /* Disconnect the socket. */
-			result = cy_socket_disconnect(socket_handle, 0);
-
-			/* Delete the client socket. */
-			result = cy_socket_delete(socket_handle);
+            close_conn(conn);
         }
 
     }
-
-    return result;
+    release_conn(conn);
 }
 
  /*******************************************************************************
  * Function Name: tcp_disconnection_handler
  *******************************************************************************
  * Summary:
- *  Callback function to handle TCP client disconnection event.
+ *  Callback function to handle TCP client disconnection event, the server task
+ *  closes the socket.
  *
  * Parameters:
  * cy_socket_t socket_handle: Connection handle for the TCP client socket
- *  void *args : Parameter passed on to the function (unused)
+ *  void *args : Bool representing whether it is a secure or non secure client
  *
  * Return:
  *  cy_result result: Result of the operation
  *
  *******************************************************************************/
 cy_rslt_t tcp_disconnection_handler(cy_socket_t socket_handle, void *arg){
+    post_event(TCP_SERVER_EVENT_DISCONNECT, *(bool*)arg, socket_handle);
+    return CY_RSLT_SUCCESS;
+}
+
+ /*******************************************************************************
+ * Function Name: disconnect_client
+ *******************************************************************************
+ * Summary:
+ *  Close the socket of a client that disconnected. A client whose reply
+ *  already closed it has no entry left and nothing to close.
+ *
+ * Parameters:
+ * cy_socket_t socket_handle: Connection handle for the TCP client socket
+ *
+ *******************************************************************************/
+static void disconnect_client(cy_socket_t socket_handle){
+
+    awep_conn_t *conn = awep_conn_get(socket_handle);
+    if(conn == NULL){
+        return;
+    }
+    close_conn(conn);
+    release_conn(conn);
+}
+
+ /*******************************************************************************
+ * Function Name: close_conn
+ *******************************************************************************
+ * Summary:
+ *  Stop the idle timeout of a client that is done and mark its entry closed.
+ *  Its socket is closed when the hold the server task has on it is released.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client that is done, held by the server task
+ *
+ *******************************************************************************/
+static void close_conn(awep_conn_t *conn){
+    if(awep_conn_close(conn)){
+        awep_idle_stop(awep_conn_index(conn));
+    }
+}
+
+ /*******************************************************************************
+ * Function Name: release_conn
+ *******************************************************************************
+ * Summary:
+ *  Release the server task's hold on a client. For a closed client it is the
+ *  last one, the socket is disconnected and deleted and the entry freed.
+ *
+ * Parameters:
+ * awep_conn_t *conn: Client held by awep_conn_get
+ *
+ *******************************************************************************/
+static void release_conn(awep_conn_t *conn){
 
     cy_rslt_t result;
+    cy_socket_t socket_handle = awep_conn_put(conn);
 
+    if(socket_handle == NULL){
+        return;
+    }
     /* Disconnect the socket. */
 	result = cy_socket_disconnect(socket_handle, 0);
 	if(result != CY_RSLT_SUCCESS){
@@ -615,9 +927,101 @@ cy_rslt_t tcp_disconnection_handler(cy_socket_t socket_handle, void *arg){
 		printf("Socket Delete Failed!\n");
 		CY_ASSERT(0);
 	}
+}
 
-    return result;
+ /*******************************************************************************
+ * Function Name: reap_idle
+ *******************************************************************************
+ * Summary:
+ *  Close every client that has not sent a whole command within
+ *  TCP_SERVER_IDLE_TICKS.
+ *
+ *******************************************************************************/
+static void reap_idle(void){
+    uint8_t expired[AWEP_MAX_CONNECTIONS];
+    uint32_t count = awep_idle_expire(xTaskGetTickCount(), expired);
+
+    for(uint32_t i = 0; i < count; i++){
+        awep_conn_t *conn = awep_conn_get_at(expired[i]);
+        if(conn == NULL){
+            continue;
+        }
+        printf("Closing a client idle for %d ticks\n", (int)(xTaskGetTickCount() - conn->lastActivity));
+        awep_stats_add(AWEP_STAT_REAPED, 1u);
+        close_conn(conn);
+        release_conn(conn);
+    }
 }
 
-/* [] END OF FILE */
+ /*******************************************************************************
+ * Function Name: refresh_stats
+ *******************************************************************************
+ * Summary:
+ *  Set the gauges, the connections and the register database occupancy, to
+ *  their current values.
+ *
+ *******************************************************************************/
+static void refresh_stats(void){
+    awep_stats_set(AWEP_STAT_CONNECTIONS, awep_conn_count());
+    awep_stats_set(AWEP_STAT_DB_COUNT, dbGetCount());
+    awep_stats_set(AWEP_STAT_DB_HIGH_WATER, dbGetHighWater());
+    awep_stats_set(AWEP_STAT_DB_MAX, dbGetMax());
+    awep_stats_set(AWEP_STAT_DB_EVICTIONS, dbGetEvictions());
+}
+
+ /*******************************************************************************
+ * Function Name: print_stats
+ *******************************************************************************
+ * Summary:
+ *  Dump every statistics counter of both servers to the console, the
+ *  histogram as the range of microseconds each bucket covers. The time
+ *  includes sending the reply, which closes the connection. Called from the
+ *  server task, which also reports the least stack it has had left, the TLS
+ *  handshakes being the deepest thing it runs, and its load since the last
+ *  dump: the share of the time it was not waiting for an event.
+ *
+ *******************************************************************************/
+void print_stats(void){
+    refresh_stats();
+    printf("===============================================================\n");
+    for(uint32_t i = 0; i < AWEP_STAT_SERVICE_HISTOGRAM; i++){
+        printf("%-20s %lu\n", awep_stats_name((awep_stat_t)i),
+                (unsigned long)awep_stats_get((awep_stat_t)i));
+    }
+    for(uint32_t i = 0; i < AWEP_STATS_BUCKETS; i++){
+        uint32_t low = (i == 0) ? 0u : (1u << (i - 1u));
+        unsigned long count = (unsigned long)awep_stats_get((awep_stat_t)(AWEP_STAT_SERVICE_HISTOGRAM + i));
+        if(i == AWEP_STATS_BUCKETS - 1u){
+            // the last bucket has no upper end
+            printf("%-10s %5lu+     %lu\n", awep_stats_name(AWEP_STAT_SERVICE_HISTOGRAM), (unsigned long)low, count);
+        }
+        else{
+            printf("%-10s %5lu-%-5lu%lu\n", awep_stats_name(AWEP_STAT_SERVICE_HISTOGRAM), (unsigned long)low,
+                    (unsigned long)((1u << i) - 1u), count);
+        }
+    }
+    printf("%-20s %lu\n", "stack free bytes",
+            (unsigned long)(uxTaskGetStackHighWaterMark(NULL) * sizeof(StackType_t)));
+    if(elapsed_cycles != 0){
+        uint32_t permille = (uint32_t)((elapsed_cycles - waiting_cycles) * 1000u / elapsed_cycles);
+        printf("%-20s %lu.%lu%%\n", "server task load",
+                (unsigned long)(permille / 10u), (unsigned long)(permille % 10u));
+        waiting_cycles = 0;
+        elapsed_cycles = 0;
+    }
+    printf("%-20s %lu\n", "events dropped", (unsigned long)events_dropped);
+    printf("===============================================================\n");
+}
 
+ /*******************************************************************************
+ * Function Name: cycles_to_micros
+ *******************************************************************************
+ * Summary:
+ *  Convert a span of the DWT cycle counter to microseconds.
+ *
+ *******************************************************************************/
+static uint32_t cycles_to_micros(uint32_t cycles){
+    return cycles / (SystemCoreClock / 1000000u);
+}
+
+/* [] END OF FILE */
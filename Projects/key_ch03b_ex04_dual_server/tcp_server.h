@@ -69,10 +69,17 @@
 /* TCP server related macros. */
 #define TCP_SERVER_PORT                           (50007)
 #define SECURE_TCP_SERVER_PORT					  (50008)
-#define TCP_SERVER_MAX_PENDING_CONNECTIONS        (3)
+#define TCP_SERVER_MAX_PENDING_CONNECTIONS        (1)
 #define TCP_SERVER_RECV_TIMEOUT_MS                (4000)
+/* Ticks a client may take to send its one command before it is closed */
+#define TCP_SERVER_IDLE_TICKS                     (5000u)
 #define MAX_TCP_RECV_BUFFER_SIZE                  (20)
 #define MAX_TCP_DATA_PACKET_LENGTH				  (20)
+/* Socket events waiting for the server task, a few for every client and
+ * listener. The secure sockets worker waits this long for room in a full
+ * queue and then drops the event, rather than stall every other socket */
+#define TCP_SERVER_EVENT_QUEUE_LENGTH             (16)
+#define TCP_SERVER_EVENT_WAIT_MS                  (10)
 
 
 /*******************************************************************************
@@ -80,5 +87,7 @@
 ********************************************************************************/
 void tcp_server_task(void *arg);
 void connect_to_wifi_ap_task(void *arg);
+void print_stats(void);
+void tcp_server_stats_from_isr(void);
 
 #endif /* TCP_SERVER_H_ */
@@ -0,0 +1,35 @@
+'''
+Load test of the connection table in the host build of the AWEP server
+
+Runs 1, 2, 4 and 6 clients at once, each writing its own registers one
+command at a time, and reports the latency they see and how many of them the
+server served. The table holds AWEP_MAX_CONNECTIONS (4) clients, the rest are
+turned away. Each case starts a fresh server, see awep_pipeline.py.
+
+    make -C Projects/key_ch03a_ex03_server/host all client
+    python Scripts/awep_clients.py
+
+Developed on Python 3.8, standard library only
+'''
+
+import argparse
+import os
+
+from awep_pipeline import hostPath, run_case
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Latency by number of clients, one command in flight each')
+    parser.add_argument('--port', type=int, default=50407, help='server port')
+    parser.add_argument('-n', '--commands', type=int, default=20000, help='writes per client (default 20000)')
+    parser.add_argument('-c', '--clients', type=int, nargs='+', default=[1, 2, 4, 6], help='client counts to run (default 1 2 4 6)')
+    args = parser.parse_args()
+
+    server = os.path.join(hostPath, 'build', 'awep_server')
+    for clients in args.clients:
+        print('N=%d' % clients)
+        print(run_case(args, server, '-c', str(clients), '-d', '1'))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,359 @@
+'''
+Load generator for the AWEP servers
+
+Opens N connections to an AWEP server and keeps each one busy with a mix of
+R and W commands over a key space of device/register pairs, with up to
+--depth commands in flight per connection. At the end it reports the
+throughput, the reply counts and the latency percentiles and histogram.
+
+Works against the board (key_ch03a_ex03_server, key_ch03b_ex02_server_secure
+with --tls) and against the host build in key_ch03a_ex03_server/host.
+
+The dual server (key_ch03b_ex04_dual_server) answers one command per
+connection, use --one-shot for it. To drive both of its ports at once:
+    python awep_load.py awep.local --port 50007 --tls-port 50008 --one-shot
+
+--rate paces each connection to that many commands a second instead of
+sending as fast as the replies come back, a well behaved client to run next
+to a flood of them.
+
+--udp sends each command as a datagram behind a request ID instead, one
+command in flight per client, retransmitted after --retry ms without a reply.
+Compare it with --one-shot to see what the connection per command costs.
+
+Developed on Python 3.8, standard library only
+'''
+
+import argparse
+import asyncio
+import os
+import random
+import re
+import ssl
+import sys
+import tempfile
+import time
+
+path = os.path.dirname(os.path.realpath(__file__))
+certPath = os.path.join(path, '..', 'ClassCerts', 'AWEP')
+
+# Replies the server can send: an ack, the end of a G, a notification, an error
+replyKinds = {'A': 'ack', 'E': 'end', 'N': 'notify', 'X': 'error'}
+
+
+#Function that turns one of the ClassCerts/AWEP C headers back into PEM text
+def header_to_pem(filename):
+    with open(filename, 'r') as fd:
+        text = fd.read()
+    return '\n'.join(re.findall(r'"([^"]*)\\n"', text)) + '\n'
+
+
+#Function that makes a TLS context with the class client certificate and key
+def make_tls_context(directory):
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    # the server certificate names no host, the class root CA is the check
+    context.check_hostname = False
+    context.load_verify_locations(cadata=header_to_pem(os.path.join(directory, 'root_ca_crt.h')))
+    # ssl only loads the client identity from files
+    with tempfile.TemporaryDirectory() as temp:
+        certFile = os.path.join(temp, 'client.crt')
+        keyFile = os.path.join(temp, 'client.key')
+        with open(certFile, 'w') as fd:
+            fd.write(header_to_pem(os.path.join(directory, 'client_crt.h')))
+        with open(keyFile, 'w') as fd:
+            fd.write(header_to_pem(os.path.join(directory, 'client_key.h')))
+        context.load_cert_chain(certFile, keyFile)
+    return context
+
+
+#Function that builds the next command for a key
+def make_command(args, rng, serial):
+    key = rng.randrange(args.keys)
+    device = args.device + key // 256
+    reg = key % 256
+    if rng.random() < args.reads:
+        if args.binary:
+            return bytes([4, ord('R'), device >> 8, device & 0xFF, reg])
+        return b'R%04X%02X\n' % (device, reg)
+    value = serial & 0xFFFF
+    if args.binary:
+        return bytes([6, ord('W'), device >> 8, device & 0xFF, reg, value >> 8, value & 0xFF])
+    return b'W%04X%02X%04X\n' % (device, reg, value)
+
+
+#Class that collects the results of every connection
+class Results:
+    def __init__(self):
+        self.latencies = []
+        self.replies = {}
+        self.commands = 0
+        self.connects = 0
+        self.failures = 0
+        self.retransmits = 0
+
+    def reply(self, kind, latency):
+        self.replies[kind] = self.replies.get(kind, 0) + 1
+        if latency is not None:
+            self.latencies.append(latency)
+
+
+#Function that reads one reply, the kind of it and whether it answers a command
+async def read_reply(reader, binary):
+    if binary:
+        length = (await reader.readexactly(1))[0]
+        body = await reader.readexactly(length)
+        if body[0] == ord('N'):
+            return 'notify', False
+        return ('ack' if body[0] == 0 else 'error %d' % body[0]), True
+    reply = await reader.readuntil(b'\0')
+    kind = replyKinds.get(chr(reply[0]), 'unknown')
+    if kind == 'error':
+        kind = reply[:-1].decode('ascii', 'replace')
+    return kind, kind != 'notify'
+
+
+#Function that opens a connection to one of the targets
+async def connect(args, target):
+    host, port, context = target
+    return await asyncio.wait_for(asyncio.open_connection(host, port, ssl=context), args.timeout)
+
+
+#Function that keeps one connection busy until the deadline, depth commands in
+#flight, or at most --rate commands a second
+async def pipelined_client(args, target, results, deadline, rng):
+    reader, writer = await connect(args, target)
+    results.connects += 1
+    sent = []
+    serial = 0
+    due = time.perf_counter()
+    try:
+        while True:
+            now = time.perf_counter()
+            batch = []
+            while now < deadline and len(sent) < args.depth and (not args.rate or now >= due):
+                batch.append(make_command(args, rng, serial))
+                sent.append(now)
+                serial += 1
+                if args.rate:
+                    due = max(due, now - 1.0 / args.rate) + 1.0 / args.rate
+            if batch:
+                writer.write(b''.join(batch))
+                results.commands += len(batch)
+                await writer.drain()
+            if not sent:
+                if args.rate and now < deadline:
+                    await asyncio.sleep(min(due, deadline) - now)
+                    continue
+                break
+            kind, answer = await asyncio.wait_for(read_reply(reader, args.binary), args.timeout)
+            if answer:
+                results.reply(kind, time.perf_counter() - sent.pop(0))
+            else:
+                results.reply(kind, None)
+    finally:
+        writer.close()
+
+
+#Function that sends one command per connection until the deadline, for the dual server
+async def one_shot_client(args, target, results, deadline, rng):
+    serial = 0
+    while time.perf_counter() < deadline:
+        start = time.perf_counter()
+        try:
+            reader, writer = await connect(args, target)
+        except (OSError, asyncio.TimeoutError):
+            results.failures += 1
+            await asyncio.sleep(0.01)
+            continue
+        results.connects += 1
+        try:
+            writer.write(make_command(args, rng, serial))
+            results.commands += 1
+            serial += 1
+            await writer.drain()
+            kind, answer = await asyncio.wait_for(read_reply(reader, args.binary), args.timeout)
+            results.reply(kind, time.perf_counter() - start)
+        except (OSError, asyncio.IncompleteReadError, asyncio.TimeoutError):
+            results.failures += 1
+        finally:
+            writer.close()
+
+
+#Class that matches the reply datagrams of one UDP client to its request ID
+class DatagramClient(asyncio.DatagramProtocol):
+    def __init__(self):
+        self.waiting = None
+        self.requestId = None
+
+    def datagram_received(self, data, address):
+        if (len(data) > 2 and self.waiting is not None and not self.waiting.done() and
+                int.from_bytes(data[:2], 'big') == self.requestId):
+            self.waiting.set_result(data[2:])
+
+
+#Function that reads the kind of a reply datagram
+def datagram_kind(reply, binary):
+    if binary:
+        return 'ack' if reply[1] == 0 else 'error %d' % reply[1]
+    kind = replyKinds.get(chr(reply[0]), 'unknown')
+    if kind == 'error':
+        kind = reply.rstrip(b'\0').decode('ascii', 'replace')
+    return kind
+
+
+#Function that sends one datagram at a time until the deadline, retransmitting
+#with the same request ID until the reply comes
+async def udp_client(args, target, results, deadline, rng):
+    host, port, context = target
+    loop = asyncio.get_running_loop()
+    transport, protocol = await loop.create_datagram_endpoint(DatagramClient, remote_addr=(host, port))
+    results.connects += 1
+    serial = 0
+    requestId = rng.randrange(0x10000)
+    try:
+        while time.perf_counter() < deadline:
+            requestId = (requestId + 1) & 0xFFFF
+            datagram = requestId.to_bytes(2, 'big') + make_command(args, rng, serial)
+            serial += 1
+            protocol.requestId = requestId
+            protocol.waiting = loop.create_future()
+            results.commands += 1
+            start = time.perf_counter()
+            reply = None
+            while reply is None and time.perf_counter() - start < args.timeout:
+                transport.sendto(datagram)
+                try:
+                    reply = await asyncio.wait_for(asyncio.shield(protocol.waiting), args.retry / 1000)
+                except asyncio.TimeoutError:
+                    results.retransmits += 1
+            if reply is None:
+                results.failures += 1
+                continue
+            results.reply(datagram_kind(reply, args.binary), time.perf_counter() - start)
+    finally:
+        transport.close()
+
+
+#Function that writes every key once so the reads find something
+async def prefill(args, target):
+    reader, writer = await connect(args, target)
+    for start in range(0, args.keys, args.depth):
+        keys = range(start, min(start + args.depth, args.keys))
+        for key in keys:
+            device = args.device + key // 256
+            if args.binary:
+                writer.write(bytes([6, ord('W'), device >> 8, device & 0xFF, key % 256, 0, 0]))
+            else:
+                writer.write(b'W%04X%02X0000\n' % (device, key % 256))
+        await writer.drain()
+        for key in keys:
+            await asyncio.wait_for(read_reply(reader, args.binary), args.timeout)
+    writer.close()
+
+
+#Function that returns the latency below which a fraction of the replies came
+def percentile(ordered, fraction):
+    if not ordered:
+        return 0.0
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+#Function that prints the throughput, reply counts and latency histogram
+def report(args, results, elapsed):
+    ordered = sorted(results.latencies)
+    print('===============================================================')
+    print('%d connections, depth %d, %d%% reads, %d keys, %.1f s' %
+          (args.connections, 1 if (args.one_shot or args.udp) else args.depth, round(args.reads * 100), args.keys, elapsed) +
+          (', %g commands a second each' % args.rate if args.rate else ''))
+    print('commands sent   %d' % results.commands)
+    print('replies         %d (%.0f per second)' % (len(ordered), len(ordered) / elapsed))
+    print('connects        %d, %d failed' % (results.connects, results.failures))
+    if args.udp:
+        print('retransmits     %d' % results.retransmits)
+    for kind in sorted(results.replies):
+        print('  %-22s %d' % (kind, results.replies[kind]))
+    if not ordered:
+        return
+    print('latency ms      p50 %.3f  p99 %.3f  p99.9 %.3f  max %.3f' %
+          (percentile(ordered, 0.5) * 1e3, percentile(ordered, 0.99) * 1e3,
+           percentile(ordered, 0.999) * 1e3, ordered[-1] * 1e3))
+    # power of two microsecond buckets, like the server's service time histogram
+    buckets = {}
+    for latency in ordered:
+        buckets[int(latency * 1e6).bit_length()] = buckets.get(int(latency * 1e6).bit_length(), 0) + 1
+    for bucket in range(min(buckets), max(buckets) + 1):
+        low = 0 if bucket == 0 else 1 << (bucket - 1)
+        count = buckets.get(bucket, 0)
+        print('%8d-%-8d us %8d %s' % (low, (1 << bucket) - 1, count, '#' * round(50 * count / len(ordered))))
+
+
+async def run(args):
+    targets = []
+    context = make_tls_context(args.certs) if (args.tls or args.tls_port) else None
+    for port in args.port:
+        targets.append((args.host, port, context if args.tls else None))
+    for port in args.tls_port:
+        targets.append((args.host, port, context))
+
+    if args.prefill:
+        await prefill(args, targets[0])
+
+    results = Results()
+    if args.udp:
+        client = udp_client
+    else:
+        client = one_shot_client if args.one_shot else pipelined_client
+    start = time.perf_counter()
+    deadline = start + args.duration
+    tasks = [client(args, targets[i % len(targets)], results, deadline, random.Random(args.seed + i))
+             for i in range(args.connections)]
+    outcomes = await asyncio.gather(*tasks, return_exceptions=True)
+    for outcome in outcomes:
+        if isinstance(outcome, Exception):
+            results.failures += 1
+            print('connection failed: %r' % outcome)
+    report(args, results, time.perf_counter() - start)
+
+
+#Main function. Execution starts here
+if __name__ == '__main__':
+
+    parser = argparse.ArgumentParser(description='Drive an AWEP server with many connections')
+    parser.add_argument('host', nargs='?', default='awep.local', help='server address (default awep.local)')
+    parser.add_argument('--port', type=int, action='append', default=[], help='plain TCP port, repeatable (default 50007)')
+    parser.add_argument('--tls-port', type=int, action='append', default=[], help='TLS port, repeatable')
+    parser.add_argument('--tls', action='store_true', help='use TLS on the --port ports too')
+    parser.add_argument('--certs', default=certPath, help='directory of the class certificate headers')
+    parser.add_argument('-c', '--connections', type=int, default=4, help='concurrent connections (default 4)')
+    parser.add_argument('-d', '--depth', type=int, default=8, help='commands in flight per connection (default 8)')
+    parser.add_argument('-r', '--reads', type=float, default=0.8, help='fraction of commands that are R (default 0.8)')
+    parser.add_argument('-k', '--keys', type=int, default=256, help='device/register pairs used (default 256)')
+    parser.add_argument('--device', type=lambda text: int(text, 16), default=0x1000, help='first deviceId, hex (default 1000)')
+    parser.add_argument('-t', '--duration', type=float, default=10.0, help='seconds to run (default 10)')
+    parser.add_argument('--rate', type=float, default=0.0, help='commands a second per connection, 0 for as fast as it goes (default 0)')
+    parser.add_argument('--binary', action='store_true', help='use the binary protocol')
+    parser.add_argument('--one-shot', action='store_true', help='one command per connection, for the dual server')
+    parser.add_argument('--udp', action='store_true', help='one datagram per command over UDP')
+    parser.add_argument('--retry', type=float, default=200.0, help='ms before a datagram is sent again (default 200)')
+    parser.add_argument('--prefill', action='store_true', help='write every key once before the run')
+    parser.add_argument('--timeout', type=float, default=5.0, help='seconds to wait for a connect or reply')
+    parser.add_argument('--seed', type=int, default=1, help='random seed')
+    args = parser.parse_args()
+
+    if not args.port and not args.tls_port:
+        args.port = [50007]
+    if args.connections < 1 or args.depth < 1 or args.keys < 1 or not 0.0 <= args.reads <= 1.0:
+        parser.error('connections, depth and keys must be positive and reads between 0 and 1')
+    if args.prefill and args.one_shot:
+        parser.error('--prefill needs a server that keeps the connection open')
+    if args.rate < 0.0 or (args.rate and (args.one_shot or args.udp)):
+        parser.error('--rate is for pipelined connections and cannot be negative')
+    if args.udp and (args.tls or args.tls_port or args.one_shot):
+        parser.error('--udp has no TLS and no connections')
+
+    try:
+        asyncio.run(run(args))
+    except KeyboardInterrupt:
+        sys.exit(1)
+
+# [] END OF FILE
@@ -0,0 +1,86 @@
+'''
+Pipelining benchmark for the host build of the AWEP server
+
+Times one connection writing registers with 1, 4, 16 and 64 commands in
+flight, using build/awep_client from key_ch03a_ex03_server/host, which unlike
+awep_load.py is fast enough to keep the server busy over loopback. Each case
+starts a fresh server.
+
+--batch also rebuilds the server with other AWEP_SERVER_MAX_BATCH values, the
+replies it queues before a send, and runs the deepest case against each.
+
+    make -C Projects/key_ch03a_ex03_server/host all client
+    python Scripts/awep_pipeline.py --batch 1 4 16 64
+
+Developed on Python 3.8, standard library only
+'''
+
+import argparse
+import os
+import signal
+import socket
+import subprocess
+import tempfile
+import time
+
+path = os.path.dirname(os.path.realpath(__file__))
+hostPath = os.path.join(path, '..', 'Projects', 'key_ch03a_ex03_server', 'host')
+
+# bytes of each reply the server queues, an ack and its NUL
+replyBytes = 12
+
+
+#Function that waits for the server to take connections
+def wait_for(port):
+    for _ in range(100):
+        try:
+            socket.create_connection(('127.0.0.1', port)).close()
+            return
+        except OSError:
+            time.sleep(0.05)
+    raise RuntimeError('the server did not start')
+
+
+#Function that runs awep_client against a fresh server and returns its report
+def run_case(args, server, *options):
+    with tempfile.TemporaryDirectory() as store:
+        process = subprocess.Popen([server, str(args.port), store], stdout=subprocess.DEVNULL)
+        try:
+            wait_for(args.port)
+            report = subprocess.run([os.path.join(hostPath, 'build', 'awep_client'), '-p', str(args.port),
+                                     '-n', str(args.commands), *options],
+                                    stdout=subprocess.PIPE, check=True).stdout.decode()
+        finally:
+            process.send_signal(signal.SIGINT)
+            process.wait()
+    return '\n'.join('    ' + line for line in report.strip().split('\n'))
+
+
+#Function that builds the server with another reply batch, in a directory of its own
+def build_batch(batch):
+    build = os.path.join('build', 'batch%d' % batch)
+    flags = '-O2 -g -DAWEP_SERVER_MAX_BATCH=%du -DAWEP_WRITER_SIZE=%du' % (batch, max(320, (batch + 2) * replyBytes))
+    subprocess.run(['make', '-s', '-C', hostPath, 'BUILD=' + build], check=True,
+                   env=dict(os.environ, CFLAGS=flags))
+    return os.path.join(hostPath, build, 'awep_server')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Writes a second on one connection by pipeline depth')
+    parser.add_argument('--port', type=int, default=50407, help='server port')
+    parser.add_argument('-n', '--commands', type=int, default=200000, help='writes per case (default 200000)')
+    parser.add_argument('-d', '--depth', type=int, nargs='+', default=[1, 4, 16, 64], help='depths to run (default 1 4 16 64)')
+    parser.add_argument('--batch', type=int, nargs='*', default=[], help='AWEP_SERVER_MAX_BATCH values to build and run at the deepest depth')
+    args = parser.parse_args()
+
+    server = os.path.join(hostPath, 'build', 'awep_server')
+    for depth in args.depth:
+        print('depth %d' % depth)
+        print(run_case(args, server, '-d', str(depth)))
+    for batch in args.batch:
+        print('depth %d, batch %d' % (max(args.depth), batch))
+        print(run_case(args, build_batch(batch), '-d', str(max(args.depth))))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,220 @@
+'''
+Replication test for the host build of the AWEP server
+
+Starts two key_ch03a_ex03_server/host servers, a primary and a standby that
+follows it, and drives the primary with awep_load.py. Meanwhile a probe
+writes a fresh value to a register of its own on the primary and times how
+long it takes to show up on the standby. Then more registers than the table
+holds are written on a device of their own, reading back earlier ones in
+between so the primary's CLOCK hand has something to tell apart. At the end
+every register written is read from both servers and compared, then the
+standby is promoted and has to take a write.
+
+    make -C Projects/key_ch03a_ex03_server/host
+    python Scripts/awep_replication.py -t 10 -c 3 -r 0.5
+
+The default build turns writes past the table size away, a build with CLOCK
+eviction replaces registers instead and the standby has to drop the same ones
+
+    CPPFLAGS=-DDB_EVICTION_POLICY=DB_EVICT_CLOCK make -C Projects/key_ch03a_ex03_server/host BUILD=build/clock
+    python Scripts/awep_replication.py --server Projects/key_ch03a_ex03_server/host/build/clock/awep_server
+
+Developed on Python 3.8, standard library only
+'''
+
+import argparse
+import asyncio
+import os
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+path = os.path.dirname(os.path.realpath(__file__))
+defaultServer = os.path.join(path, '..', 'Projects', 'key_ch03a_ex03_server', 'host', 'build', 'awep_server')
+
+# The probe register, on a device the load does not use
+probeDevice = 0xFFFE
+# Registers written past capacity start on this device
+fillDevice = 0xE000
+
+
+#Function that sends one ASCII command and returns the reply without its NUL
+async def command(reader, writer, text):
+    writer.write(text.encode() + b'\n')
+    reply = await reader.readuntil(b'\0')
+    return reply[:-1].decode()
+
+
+#Function that waits for a server to take connections
+async def wait_for(port, timeout=5.0):
+    deadline = time.monotonic() + timeout
+    while True:
+        try:
+            return await asyncio.open_connection('127.0.0.1', port)
+        except OSError:
+            if time.monotonic() > deadline:
+                raise
+            await asyncio.sleep(0.05)
+
+
+#Function that waits for the standby to follow the primary, it retries the
+#connection once a second
+async def wait_for_standby(args):
+    primary = await wait_for(args.port)
+    standby = await wait_for(args.port + 100)
+    expected = 'A%04X%02X0000' % (probeDevice, 0xFF)
+    await command(*primary, 'W%04X%02X0000' % (probeDevice, 0xFF))
+    deadline = time.monotonic() + 5.0
+    while await command(*standby, 'R%04X%02X' % (probeDevice, 0xFF)) != expected:
+        if time.monotonic() > deadline:
+            raise RuntimeError('the standby did not follow the primary')
+        await asyncio.sleep(0.05)
+    for _, writer in (primary, standby):
+        writer.close()
+
+
+#Function that writes the probe register on the primary and polls the standby
+#until it reads back the same value, returning the lags in milliseconds
+async def probe(args, deadline):
+    primary = await wait_for(args.port)
+    standby = await wait_for(args.port + 100)
+    lags = []
+    missed = 0
+    serial = 0
+    while time.monotonic() < deadline:
+        serial += 1
+        value = '%04X' % (serial & 0xFFFF)
+        reg = serial % 16
+        await command(*primary, 'W%04X%02X%s' % (probeDevice, reg, value))
+        written = time.monotonic()
+        expected = 'A%04X%02X%s' % (probeDevice, reg, value)
+        while True:
+            if await command(*standby, 'R%04X%02X' % (probeDevice, reg)) == expected:
+                lags.append((time.monotonic() - written) * 1000.0)
+                break
+            if time.monotonic() - written > 1.0:
+                missed += 1
+                break
+        await asyncio.sleep(args.interval / 1000.0)
+    for _, writer in (primary, standby):
+        writer.close()
+    return lags, missed
+
+
+#Function that writes args.fill registers on the primary, each followed by a
+#read of an earlier one, and returns how many the primary turned away
+async def fill(args):
+    primary = await wait_for(args.port)
+    refused = 0
+    for key in range(args.fill):
+        reply = await command(*primary, 'W%04X%02X%04X' % (fillDevice + key // 256, key % 256, key & 0xFFFF))
+        if not reply.startswith('A'):
+            refused += 1
+        older = (key * 7919) % (key + 1)
+        await command(*primary, 'R%04X%02X' % (fillDevice + older // 256, older % 256))
+    primary[1].close()
+    return refused
+
+
+#Function that reads every register the load and the fill wrote from both
+#servers, returning how many differ and how many the primary holds
+async def compare(args):
+    primary = await wait_for(args.port)
+    standby = await wait_for(args.port + 100)
+    reads = ['R%04X%02X' % (args.device + key // 256, key % 256) for key in range(args.keys)]
+    reads += ['R%04X%02X' % (fillDevice + key // 256, key % 256) for key in range(args.fill)]
+    differ = 0
+    held = 0
+    for read in reads:
+        reply = await command(*primary, read)
+        if reply != await command(*standby, read):
+            differ += 1
+        if reply.startswith('A'):
+            held += 1
+    for _, writer in (primary, standby):
+        writer.close()
+    return differ, held, len(reads)
+
+
+def percentile(ordered, fraction):
+    if not ordered:
+        return 0.0
+    return ordered[min(len(ordered) - 1, int(len(ordered) * fraction))]
+
+
+async def run(args, servers):
+    await wait_for_standby(args)
+    load = await asyncio.create_subprocess_exec(
+        sys.executable, os.path.join(path, 'awep_load.py'), '127.0.0.1',
+        '--port', str(args.port), '-c', str(args.connections), '-d', str(args.depth),
+        '-r', str(args.reads), '-k', str(args.keys), '-t', str(args.duration), '--prefill',
+        stdout=asyncio.subprocess.PIPE)
+    lags, missed = await probe(args, time.monotonic() + args.duration)
+    output, _ = await load.communicate()
+    report = output.decode()
+    if args.quiet:
+        report = '\n'.join(line for line in report.split('\n') if line.startswith(('replies', 'latency')))
+    print(report)
+    refused = await fill(args)
+
+    # the standby acks within a few ms, let it drain before comparing
+    await asyncio.sleep(0.5)
+    differ, held, compared = await compare(args)
+
+    servers[1].send_signal(signal.SIGUSR2)
+    await asyncio.sleep(1.2)
+    reader, writer = await wait_for(args.port + 100)
+    promoted = await command(reader, writer, 'W%04X000001' % probeDevice)
+    writer.close()
+
+    lags.sort()
+    print('Probe writes: %d, not seen on the standby within 1 s: %d' % (len(lags) + missed, missed))
+    print('Replication lag ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f' % (
+        percentile(lags, 0.5), percentile(lags, 0.9), percentile(lags, 0.99), percentile(lags, 1.0)))
+    print('Registers written past the table size: %d, turned away: %d, held by the primary: %d of %d' % (
+        args.fill, refused, held, compared))
+    print('Registers that differ between primary and standby: %d of %d' % (differ, compared))
+    print('Write to the promoted standby: %s' % promoted)
+    return differ == 0 and missed == 0 and promoted.startswith('A')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Replicate between two host AWEP servers under load')
+    parser.add_argument('--server', default=defaultServer, help='host server binary')
+    parser.add_argument('--port', type=int, default=50207, help='primary port, the standby gets port + 100')
+    # the probe takes one of the four connections the server allows
+    parser.add_argument('-c', '--connections', type=int, default=3, help='load connections (default 3)')
+    parser.add_argument('-d', '--depth', type=int, default=8, help='commands in flight per connection (default 8)')
+    parser.add_argument('-r', '--reads', type=float, default=0.5, help='fraction of load commands that are R (default 0.5)')
+    parser.add_argument('-k', '--keys', type=int, default=256, help='device/register pairs the load uses (default 256)')
+    parser.add_argument('--device', type=lambda text: int(text, 16), default=0x1000, help='first deviceId, hex (default 1000)')
+    # the host build holds 400 registers
+    parser.add_argument('--fill', type=int, default=1000, help='registers written after the load, past the table size (default 1000)')
+    parser.add_argument('-t', '--duration', type=float, default=10, help='seconds of load (default 10)')
+    parser.add_argument('--interval', type=float, default=5, help='ms between probe writes (default 5)')
+    parser.add_argument('--quiet', action='store_true', help='only the throughput and latency of the load report')
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as store:
+        servers = []
+        try:
+            servers.append(subprocess.Popen(
+                [args.server, str(args.port), os.path.join(store, 'primary')],
+                stdout=subprocess.DEVNULL))
+            servers.append(subprocess.Popen(
+                [args.server, str(args.port + 100), os.path.join(store, 'standby'),
+                 '127.0.0.1:%d' % (args.port + 1)],
+                stdout=subprocess.DEVNULL))
+            passed = asyncio.run(run(args, servers))
+        finally:
+            for server in servers:
+                server.send_signal(signal.SIGINT)
+                server.wait()
+    print('PASS' if passed else 'FAIL')
+    sys.exit(0 if passed else 1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,104 @@
+'''
+Rate limit test for the host build of the AWEP server
+
+Runs well behaved clients, paced to a steady rate, next to one client that
+floods the server with pipelined writes, and reports the latency the well
+behaved ones see. Each case starts a fresh key_ch03a_ex03_server/host server:
+the paced clients alone, with the flood and no rate limits, and with the flood
+and the limits given by --client-limit and --global-limit.
+
+    make -C Projects/key_ch03a_ex03_server/host
+    python Scripts/awep_throttle.py -t 10
+
+Developed on Python 3.8, standard library only
+'''
+
+import argparse
+import asyncio
+import os
+import signal
+import subprocess
+import sys
+import tempfile
+
+path = os.path.dirname(os.path.realpath(__file__))
+defaultServer = os.path.join(path, '..', 'Projects', 'key_ch03a_ex03_server', 'host', 'build', 'awep_server')
+
+
+#Function that runs awep_load.py and returns its report
+async def load(args, *options):
+    process = await asyncio.create_subprocess_exec(
+        sys.executable, os.path.join(path, 'awep_load.py'), '127.0.0.1',
+        '--port', str(args.port), '-t', str(args.duration), *options,
+        stdout=asyncio.subprocess.PIPE)
+    output, _ = await process.communicate()
+    return output.decode()
+
+
+#Function that waits for the server to take connections
+async def wait_for(port):
+    for _ in range(100):
+        try:
+            _, writer = await asyncio.open_connection('127.0.0.1', port)
+            writer.close()
+            return
+        except OSError:
+            await asyncio.sleep(0.05)
+    raise RuntimeError('the server did not start')
+
+
+#Function that keeps the lines of a report worth comparing
+def summary(report):
+    return '\n'.join('    ' + line for line in report.split('\n')
+                     if line.startswith(('replies', 'latency', '  ')))
+
+
+async def run_case(args, flood):
+    await wait_for(args.port)
+    paced = load(args, '-c', str(args.clients), '-d', '1', '--rate', str(args.rate),
+                 '-r', '0.5', '-k', str(args.keys), '--seed', '1', '--prefill')
+    if not flood:
+        return await paced, None
+    # the flood writes its own keys, on a device of its own
+    flooder = load(args, '-c', '1', '-d', str(args.depth), '-r', '0', '-k', str(args.keys),
+                   '--device', '2000', '--seed', '2')
+    return await asyncio.gather(paced, flooder)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Latency of paced clients next to a flood, with and without rate limits')
+    parser.add_argument('--server', default=defaultServer, help='host server binary')
+    parser.add_argument('--port', type=int, default=50307, help='server port')
+    parser.add_argument('-c', '--clients', type=int, default=2, help='paced clients (default 2)')
+    parser.add_argument('--rate', type=float, default=200, help='commands a second per paced client (default 200)')
+    parser.add_argument('-d', '--depth', type=int, default=16, help='commands the flood keeps in flight (default 16)')
+    # both sides together have to fit the register database
+    parser.add_argument('-k', '--keys', type=int, default=128, help='device/register pairs each side uses (default 128)')
+    parser.add_argument('-t', '--duration', type=float, default=10, help='seconds per case (default 10)')
+    parser.add_argument('--client-limit', default='1000/100', help='per client limit, rate/burst (default 1000/100)')
+    parser.add_argument('--global-limit', default='5000/500', help='limit over all clients, rate/burst (default 5000/500)')
+    args = parser.parse_args()
+
+    cases = [('paced clients alone', False, {}),
+             ('with the flood, no limits', True, {}),
+             ('with the flood, limits %s per client and %s in all' % (args.client_limit, args.global_limit), True,
+              {'AWEP_CLIENT_LIMIT': args.client_limit, 'AWEP_GLOBAL_LIMIT': args.global_limit})]
+    for title, flood, limits in cases:
+        with tempfile.TemporaryDirectory() as store:
+            server = subprocess.Popen([args.server, str(args.port), store], stdout=subprocess.DEVNULL,
+                                      env=dict(os.environ, **limits))
+            try:
+                paced, flooder = asyncio.run(run_case(args, flood))
+            finally:
+                server.send_signal(signal.SIGINT)
+                server.wait()
+        print('=== %s' % title)
+        print('  paced:')
+        print(summary(paced))
+        if flooder is not None:
+            print('  flood:')
+            print(summary(flooder))
+
+
+if __name__ == '__main__':
+    main()